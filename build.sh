@@ -61,27 +61,42 @@ create_directories() {
     mkdir -p "${BUILD_DIR}" "${BOOT_DIR}"
 }
 
+compile_wexfs() {
+    print_info "Compiling WexFS core..."
+    "${CC}" ${CFLAGS} -c kernel/wexfs.c -o "${BUILD_DIR}/wexfs.o"
+}
+
 compile_kernel() {
     print_info "Compiling kernel..."
     "${CC}" ${CFLAGS} -c kernel/kernel.c -o "${BUILD_DIR}/kernel.o"
-    "${LD}" ${LDFLAGS} -o "${BUILD_DIR}/kernel.bin" "${BUILD_DIR}/kernel.o" -e _start
+    "${LD}" ${LDFLAGS} -o "${BUILD_DIR}/kernel.bin" "${BUILD_DIR}/kernel.o" "${BUILD_DIR}/wexfs.o" -e _start
     cp "${BUILD_DIR}/kernel.bin" "${BOOT_DIR}/"
 }
 
 compile_recovery() {
     print_info "Compiling recovery..."
     "${CC}" ${CFLAGS} -c kernel/recovery.c -o "${BUILD_DIR}/recovery.o"
-    "${LD}" ${LDFLAGS} -o "${BUILD_DIR}/recovery.bin" "${BUILD_DIR}/recovery.o" -e _start
+    "${LD}" ${LDFLAGS} -o "${BUILD_DIR}/recovery.bin" "${BUILD_DIR}/recovery.o" "${BUILD_DIR}/wexfs.o" -e _start
     cp "${BUILD_DIR}/recovery.bin" "${BOOT_DIR}/"
 }
 
 compile_installer() {
     print_info "Compiling installer..."
     "${CC}" ${CFLAGS} -c kernel/install.c -o "${BUILD_DIR}/install.o"
-    "${LD}" ${LDFLAGS} -o "${BUILD_DIR}/install.bin" "${BUILD_DIR}/install.o" -e _start
+    "${LD}" ${LDFLAGS} -o "${BUILD_DIR}/install.bin" "${BUILD_DIR}/install.o" "${BUILD_DIR}/wexfs.o" -e _start
     cp "${BUILD_DIR}/install.bin" "${BOOT_DIR}/"
 }
 
+compile_tool() {
+    print_info "Compiling wexfstool..."
+    cc -O2 -DWEXFS_HOST -Ikernel tools/wexfstool.c kernel/wexfs.c -o "${BUILD_DIR}/wexfstool"
+}
+
+pack_systemroot() {
+    print_info "Packing SystemRoot boot module..."
+    "${BUILD_DIR}/wexfstool" pack "${BOOT_DIR}/systemroot.img" SystemRoot :SystemRoot
+}
+
 copy_systemroot() {
     print_info "Copying SystemRoot..."
     if [ -d "${SOURCE_DIR}" ]; then
@@ -120,9 +135,12 @@ main() {
     
     check_dependencies
     create_directories
+    compile_wexfs
     compile_kernel
     compile_recovery
     compile_installer
+    compile_tool
+    pack_systemroot
     copy_systemroot
     build_iso
     cleanup
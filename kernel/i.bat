@@ -1,2 +1,2 @@
-gcc -m32 -o os.exe kernel.c
+gcc -m32 -o os.exe kernel.c wexfs.c
 pause
\ No newline at end of file
@@ -1,25 +1,7 @@
 #define MULTIBOOT_MAGIC 0x1BADB002
 #define MULTIBOOT_FLAGS 0
 
-typedef unsigned int u32;
-typedef unsigned short u16;
-typedef unsigned char u8;
-
-#define NULL ((void*)0)
-#define MAX_NAME 256
-#define MAX_PATH 1024
-#define SECTOR_SIZE 512
-#define FS_SECTOR_START 1
-#define MAX_FILES 64
-
-/* Структура файловой системы*/
-typedef struct { 
-    char name[MAX_PATH];        
-    int is_dir; 
-    char content[4096];         
-    u32 next_sector;
-    u32 size;
-} FSNode;
+#include "wexfs.h"
 
 /* Function prototypes */
 void putchar(char ch);
@@ -39,7 +21,7 @@ void newline();
 void itoa(int value, char* str, int base);
 void clear_screen();
 void delay(int seconds);
-void fs_format(void);
+void fs_format(u32 block_size, u32 nodes, u32 features);
 void reboot_system(void);
 
 /* VGA text buffer */
@@ -76,11 +58,6 @@ static inline void outw(unsigned short port, u16 val) {
 #define ATA_STATUS 0x1F7
 #define ATA_CMD 0x1F7
 
-FSNode fs_cache[MAX_FILES];
-int fs_count = 0;
-char current_dir[MAX_PATH] = "/";
-int fs_dirty = 0;
-
 /* Multiboot header */
 typedef struct {
     u32 magic;
@@ -285,224 +262,13 @@ void ata_write_sector(u32 lba, u8* buffer) {
     }
 }
 
-/* Filesystem functions */
-void fs_load_from_disk() {
-    u8 sector_buffer[SECTOR_SIZE];
-    u32 sector = FS_SECTOR_START;
-    fs_count = 0;
-    fs_dirty = 0;
-
-    #define SECTORS_PER_NODE 11
-
-    while (sector != 0 && fs_count < MAX_FILES) {
-        u8* node_data = (u8*)&fs_cache[fs_count];
-        
-        for (int j = 0; j < SECTORS_PER_NODE; j++) {
-            ata_read_sector(sector + j, sector_buffer);
-            int offset = j * SECTOR_SIZE;
-            if (offset < sizeof(FSNode)) {
-                memcpy(node_data + offset, sector_buffer, SECTOR_SIZE);
-            }
-        }
-        
-        sector = fs_cache[fs_count].next_sector;
-        fs_count++;
-    }
-
-    if (fs_count == 0) {
-        strcpy(fs_cache[0].name, "/");
-        fs_cache[0].is_dir = 1;
-        fs_cache[0].content[0] = '\0';
-        fs_cache[0].next_sector = 0;
-        fs_cache[0].size = 0;
-        fs_count = 1;
-        fs_dirty = 1;
-        fs_save_to_disk();
-    }
-}
-
-void fs_save_to_disk() {
-    if (!fs_dirty) return;
-
-    u8 sector_buffer[SECTOR_SIZE];
-    u32 sector = FS_SECTOR_START;
-
-    #define SECTORS_PER_NODE 11
-
-    for (int i = 0; i < fs_count; i++) {
-        u8* node_data = (u8*)&fs_cache[i];
-        
-        for (int j = 0; j < SECTORS_PER_NODE; j++) {
-            int offset = j * SECTOR_SIZE;
-            if (offset < sizeof(FSNode)) {
-                memcpy(sector_buffer, node_data + offset, SECTOR_SIZE);
-            } else {
-                memset(sector_buffer, 0, SECTOR_SIZE);
-            }
-            ata_write_sector(sector + j, sector_buffer);
-        }
-        
-        sector = (i == fs_count - 1) ? 0 : FS_SECTOR_START + (i + 1) * SECTORS_PER_NODE;
-        if (i < fs_count - 1) {
-            fs_cache[i].next_sector = sector;
-        } else {
-            fs_cache[i].next_sector = 0;
-        }
-    }
-
-    fs_dirty = 0;
-}
-
-void fs_mark_dirty() {
-    fs_dirty = 1;
-}
-
-void fs_init() {
-    fs_load_from_disk();
-    strcpy(current_dir, "/");
-}
-
-void fs_mkdir(const char* name) {
-    if (fs_count >= MAX_FILES) {
-        prints("Error: Maximum files reached\n");
-        return;
-    }
-
-    char full_path[MAX_PATH];
-    if (strcmp(current_dir, "/") == 0) {
-        if (strlen(name) >= MAX_NAME) {
-            prints("Error: Name too long: ");
-            prints(name);
-            newline();
-            return;
-        }
-        strcpy(full_path, name);
-    } else {
-        if (strlen(current_dir) + strlen(name) + 1 >= MAX_PATH) {
-            prints("Error: Path too long: ");
-            prints(name);
-            newline();
-            return;
-        }
-        strcpy(full_path, current_dir);
-        strcat(full_path, name);
-    }
-
-    for (int i = 0; i < fs_count; i++) {
-        if (strcmp(fs_cache[i].name, full_path) == 0) {
-            prints("Error: Name already exists: ");
-            prints(name);
-            newline();
-            return;
-        }
-    }
-
-    strcpy(fs_cache[fs_count].name, full_path);
-    fs_cache[fs_count].is_dir = 1;
-    fs_cache[fs_count].content[0] = '\0';
-    fs_cache[fs_count].next_sector = 0;
-    fs_cache[fs_count].size = 0;
-    fs_count++;
-    fs_mark_dirty();
-    fs_save_to_disk();
-    prints("Directory '");
-    prints(name);
-    prints("' created\n");
-}
-
-void fs_touch(const char* name) {
-    if (fs_count >= MAX_FILES) {
-        prints("Error: Maximum files reached\n");
-        return;
-    }
-
-    char full_path[MAX_PATH];
-    if (strcmp(current_dir, "/") == 0) {
-        if (strlen(name) >= MAX_NAME) {
-            prints("Error: Name too long: ");
-            prints(name);
-            newline();
-            return;
-        }
-        strcpy(full_path, name);
-    } else {
-        if (strlen(current_dir) + strlen(name) + 1 >= MAX_PATH) {
-            prints("Error: Path too long: ");
-            prints(name);
-            newline();
-            return;
-        }
-        strcpy(full_path, current_dir);
-        strcat(full_path, name);
-    }
-
-    for (int i = 0; i < fs_count; i++) {
-        if (strcmp(fs_cache[i].name, full_path) == 0) {
-            prints("Error: Name already exists: ");
-            prints(name);
-            newline();
-            return;
-        }
-    }
-
-    strcpy(fs_cache[fs_count].name, full_path);
-    fs_cache[fs_count].is_dir = 0;
-    fs_cache[fs_count].content[0] = '\0';
-    fs_cache[fs_count].next_sector = 0;
-    fs_cache[fs_count].size = 0;
-    fs_count++;
-    fs_mark_dirty();
-    fs_save_to_disk();
-    prints("File '");
-    prints(name);
-    prints("' created\n");
-}
-
-FSNode* fs_find_file(const char* name) {
-    char full_path[MAX_PATH];
-    if (strcmp(current_dir, "/") == 0) {
-        if (strlen(name) >= MAX_NAME) {
-            prints("Error: Name too long: ");
-            prints(name);
-            newline();
-            return NULL;
-        }
-        strcpy(full_path, name);
-    } else {
-        if (strlen(current_dir) + strlen(name) + 1 >= MAX_PATH) {
-            prints("Error: Path too long: ");
-            prints(name);
-            newline();
-            return NULL;
-        }
-        strcpy(full_path, current_dir);
-        strcat(full_path, name);
-    }
-
-    for (int i = 0; i < fs_count; i++) {
-        if (strcmp(fs_cache[i].name, full_path) == 0 && !fs_cache[i].is_dir) {
-            return &fs_cache[i];
-        }
-    }
-    return NULL;
-}
-
-void fs_format(void) {
+void fs_format(u32 block_size, u32 nodes, u32 features) {
     prints("Formatting filesystem...\n");
     
-    // Сбрасываем файловую систему к начальному состоянию
-    fs_count = 1;
-    strcpy(fs_cache[0].name, "/");
-    fs_cache[0].is_dir = 1;
-    fs_cache[0].content[0] = '\0';
-    fs_cache[0].next_sector = 0;
-    fs_cache[0].size = 0;
+    // Новый том с выбранными параметрами
+    fs_mkfs(block_size, nodes, features);
     
-    // Сбрасываем текущую директорию
-    strcpy(current_dir, "/");
-    
-    // Помечаем как измененную и сохраняем
-    fs_mark_dirty();
+    // Сохраняем: пишутся только корень и суперблок
     fs_save_to_disk();
     
     prints("Filesystem formatted successfully.\n");
@@ -623,10 +389,61 @@ void install_wexos() {
         }
     }
 
+    // Сжатие текстовых файлов тома
+    prints("Do you want to enable WexFS compression? Y/N: ");
+    char lz_confirm = keyboard_getchar();
+    putchar(lz_confirm);
+    newline();
+    u32 features = FS_FEATURE_DEFAULT;
+    if (lz_confirm == 'Y' || lz_confirm == 'y') features |= FS_FEATURE_LZ;
+
+    // Параметры тома: размер блока, число узлов и возможности
+    u32 block_size = FS_DEFAULT_BLOCK_SIZE;
+    u32 nodes = FS_DEFAULT_NODES;
+    prints("Do you want to set custom WexFS format parameters? Y/N: ");
+    char custom = keyboard_getchar();
+    putchar(custom);
+    newline();
+    if (custom == 'Y' || custom == 'y') {
+        prints("Block size: 1) 1 KB 2) 2 KB 3) 4 KB 4) 8 KB 5) 16 KB 6) 32 KB 7) 64 KB: ");
+        char choice = keyboard_getchar();
+        putchar(choice);
+        newline();
+        if (choice >= '1' && choice <= '7') block_size = 1024u << (choice - '1');
+        else prints("Using default block size\n");
+
+        // Системе нужно 52 узла; каждый слот занимает на диске 1.5 КБ
+        prints("Node slots: 1) 64 2) 256 3) 1024: ");
+        choice = keyboard_getchar();
+        putchar(choice);
+        newline();
+        if (choice >= '1' && choice <= '3') nodes = FS_DEFAULT_NODES << ((choice - '1') * 2);
+        else prints("Using default node count\n");
+
+        prints("Merge duplicate blocks? Y/N: ");
+        choice = keyboard_getchar();
+        putchar(choice);
+        newline();
+        if (choice == 'N' || choice == 'n') features &= ~FS_FEATURE_DEDUP;
+
+        prints("Keep block checksums? Y/N: ");
+        choice = keyboard_getchar();
+        putchar(choice);
+        newline();
+        if (choice == 'N' || choice == 'n') features &= ~FS_FEATURE_CRC;
+
+        prints("Reserve space for snapshots? Y/N: ");
+        choice = keyboard_getchar();
+        putchar(choice);
+        newline();
+        if (choice == 'N' || choice == 'n') features &= ~FS_FEATURE_SNAP;
+    }
+
     // Форматирование и создание директорий
     prints("Formatting disks to WexFS...\n");
     prints("Removing old system directories if they exist...\n");
-    fs_format();
+    fs_begin();
+    fs_format(block_size, nodes, features);
 
     prints("Creating system directories...\n");
     fs_mkdir("home");
@@ -693,8 +510,8 @@ void install_wexos() {
     fs_touch("SystemRoot/config/autorun.cfg");
     FSNode* autorun_file = fs_find_file("SystemRoot/config/autorun.cfg");
     if (autorun_file) {
-        strcpy(autorun_file->content, "desktop");
-        autorun_file->size = strlen("desktop");
+        fs_write_content(autorun_file, "desktop", strlen("desktop"));
+        fs_save_to_disk();
         prints("Desktop autorun configured\n");
     }
 
@@ -703,13 +520,15 @@ void install_wexos() {
         fs_touch("SystemRoot/config/pass.cfg");
         FSNode* passfile = fs_find_file("SystemRoot/config/pass.cfg");
         if (passfile) {
-            strcpy(passfile->content, password);
-            passfile->size = strlen(password);
-            fs_mark_dirty();
+            fs_write_content(passfile, password, strlen(password));
             fs_save_to_disk();
         }
     }
 
+    // Новый том ложится на диск одним проходом
+    prints("Writing filesystem to disk...\n");
+    fs_commit();
+
     // Завершение установки и перезагрузка
     prints("\nInstallation completed successfully!\n");
     prints("Please reboot to start the installed system.\n");
@@ -1,18 +1,14 @@
 #include <stdint.h>
+#include "wexfs.h"
 
 #define MULTIBOOT_MAGIC 0x1BADB002
-#define MULTIBOOT_FLAGS 0
-
-typedef unsigned int u32;
-typedef unsigned short u16;
-typedef unsigned char u8;
-
-#define NULL ((void*)0)
-#define MAX_NAME 256
-#define MAX_PATH 1024
-#define SECTOR_SIZE 512
-#define FS_SECTOR_START 1
-#define MAX_FILES 64
+#define MULTIBOOT_PAGE_ALIGN  0x1              // модули по границе 4 КБ
+#define MULTIBOOT_MEMORY_INFO 0x2              // mem_lower/mem_upper
+#define MULTIBOOT_FLAGS (MULTIBOOT_PAGE_ALIGN | MULTIBOOT_MEMORY_INFO)
+#define MULTIBOOT_BOOT_MAGIC 0x2BADB002        // в EAX при входе от загрузчика
+#define MULTIBOOT_INFO_MEMORY 0x1
+#define MULTIBOOT_INFO_MODS   0x8
+
 #define MAX_HISTORY 10
 
 #define SCREEN_WIDTH 800
@@ -38,6 +34,7 @@ typedef unsigned char u8;
 #define EXPLORER_HEIGHT ROWS
 #define MAX_VISIBLE_FILES (ROWS - 4)
 #define PATH_MAX_DISPLAY 70
+#define EXPLORER_MAX_FILES 64     // записей в одной директории проводника
 
 #define AUTORUN_FILE "SystemRoot/config/autorun.cfg"
 #define AUTORUN_MAX_COMMAND 128
@@ -53,21 +50,13 @@ typedef struct {
     int x, y;
     int width, height;
     char title[MAX_NAME];
-    FileEntry files[MAX_FILES];
+    FileEntry files[EXPLORER_MAX_FILES];
     int file_count;
     int selected_index;
     int scroll_offset;
     char current_path[MAX_PATH];
 } Explorer;
 
-typedef struct { 
-    char name[MAX_PATH];
-    int is_dir; 
-    char content[4096];  // Увеличил до 4096 байт
-    u32 next_sector;
-    u32 size;
-} FSNode;
-
 /* Function prototypes */
 void itoa(int value, char* str, int base);
 void coreview_command(void);
@@ -105,6 +94,8 @@ void ata_wait_ready();
 void ata_wait_drq();
 void memory_command(void);
 void clear_screen();
+void vga_flush(void);
+void console_pager_wait(void);
 void fs_load_from_disk();
 void fs_save_to_disk();
 void fs_mark_dirty();
@@ -118,8 +109,8 @@ FSNode* fs_find_file(const char* name);
 void fs_copy(const char* src_name, const char* dest_name);
 void fs_size(const char* name);
 void fs_format(void);
-void fs_check_integrity(void);
-void fsck_command(void);
+int fs_check_integrity(void);
+void fsck_command(const char* args);
 void fs_cat(const char* filename);
 void writer_command(const char* filename);
 void wexplorer_command(void);
@@ -170,9 +161,68 @@ multiboot_header_t multiboot_header __attribute__((section(".multiboot"))) = {
     -(MULTIBOOT_MAGIC + MULTIBOOT_FLAGS)
 };
 
-/* VGA text buffer */
-volatile unsigned short* VGA = (unsigned short*)0xB8000;
+/* Multiboot information passed by the boot loader (the fields we read) */
+typedef struct {
+    u32 flags;
+    u32 mem_lower;           /* KB below 1 MB */
+    u32 mem_upper;           /* KB above 1 MB */
+    u32 boot_device;
+    u32 cmdline;
+    u32 mods_count;
+    u32 mods_addr;
+} __attribute__((packed)) multiboot_info_t;
+
+typedef struct {
+    u32 mod_start;
+    u32 mod_end;
+    u32 string;
+    u32 reserved;
+} __attribute__((packed)) multiboot_module_t;
+
+static u32 boot_memory_kb = 0;             // 0, если загрузчик не сообщил
+static int boot_systemroot_entries = -1;   // записи SystemRoot из модуля
+
+/* VGA text buffer
+ * Everything is drawn into VGA, a copy of the text page in RAM. vga_flush()
+ * brings the hardware up to date: each row is compared with vga_front, the
+ * copy of what the screen shows, and only the changed span is written, two
+ * cells per 32-bit store. Text memory is never read. The flush runs when
+ * the keyboard is polled, before a delay and every VGA_FLUSH_CYCLES while
+ * output streams.
+ *
+ * The shadow mirrors the whole 32 KB text window and VGA points at the
+ * visible page inside it. Scrolling moves VGA down one row and the flush
+ * moves the CRTC start address after it; rows are copied back to the top
+ * only when the page reaches the end of the window. */
 enum { ROWS=25, COLS=80 };
+#define VGA_TEXT ((volatile u32*)0xB8000)
+#define VGA_WINDOW_ROWS (0x8000 / 2 / COLS) // 204 строки в окне 32 КБ
+#define VGA_FLUSH_CYCLES (1u << 24)          // около 60 раз в секунду на 1 ГГц
+typedef u32 __attribute__((may_alias)) vga_pair;
+static unsigned short vga_shadow[VGA_WINDOW_ROWS * COLS];
+static unsigned short vga_front[VGA_WINDOW_ROWS * COLS];
+static int vga_front_valid = 0;             // 0, пока на экране чужой текст
+static int vga_start = -1;                  // начало страницы в CRTC, ячейки
+static u32 vga_flush_stamp = 0;
+unsigned short* VGA = vga_shadow;
+
+/* Scrollback
+ * Rows leaving the top of the screen are kept in a ring. While the user
+ * looks back (scrollback_offset > 0) the flush shows scrollback_view, built
+ * from the ring and the live page, instead of VGA. */
+#define SCROLLBACK_LINES 2048
+static unsigned short scrollback[SCROLLBACK_LINES * COLS];
+static int scrollback_head = 0;             // куда пойдёт следующая строка
+static int scrollback_count = 0;
+static int scrollback_offset = 0;           // строк назад, 0 — живой экран
+static unsigned short scrollback_view[ROWS * COLS];
+
+/* Pager
+ * "more <command>" stops after every screenful that scrolled by since the
+ * last key press. */
+static int pager_active = 0;
+static int pager_scrolled = 0;              // строк прокручено без нажатия
+static int pager_quit = 0;                  // Q: остаток вывода отбрасывается
 static unsigned int cursor_row=0, cursor_col=0;
 static unsigned char text_color=0x07;
 
@@ -190,6 +240,26 @@ static inline u16 inw(unsigned short port) {
     __asm__ volatile("inw %1,%0" : "=a"(r) : "Nd"(port));
     return r;
 }
+
+static inline u64 rdtsc(void) {
+    u32 lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((u64)hi << 32) | lo;
+}
+
+// Состояние контроллера клавиатуры. Тот, кто её опрашивает, ждёт
+// пользователя, поэтому экран сначала догоняет теневой буфер.
+// Нажатая клавиша значит, что экран прочитан: пейджер считает заново.
+static inline unsigned char kbd_status(void) {
+    vga_flush();
+    unsigned char st = inb(0x64);
+    if (st & 1) {
+        pager_scrolled = 0;
+        pager_quit = 0;
+    }
+    return st;
+}
+
 static inline void outw(unsigned short port, u16 val) {
     __asm__ volatile("outw %0,%1" : : "a"(val), "Nd"(port));
 }
@@ -204,11 +274,6 @@ static inline void outw(unsigned short port, u16 val) {
 #define ATA_STATUS 0x1F7
 #define ATA_CMD 0x1F7
 
-FSNode fs_cache[MAX_FILES];
-int fs_count = 0;
-char current_dir[MAX_PATH] = "/";
-int fs_dirty = 0;
-
 /* Command history */
 char command_history[MAX_HISTORY][128];
 
@@ -272,207 +337,6 @@ void memset(void* ptr, int value, int num) {
     }
 }
 
-/* Filesystem functions */
-void fs_load_from_disk() {
-    u8 sector_buffer[SECTOR_SIZE];
-    u32 sector = FS_SECTOR_START;
-    fs_count = 0;
-    fs_dirty = 0;
-
-    #define SECTORS_PER_NODE 11
-
-    while (sector != 0 && fs_count < MAX_FILES) {
-        u8* node_data = (u8*)&fs_cache[fs_count];
-        
-        for (int j = 0; j < SECTORS_PER_NODE; j++) {
-            ata_read_sector(sector + j, sector_buffer);
-            int offset = j * SECTOR_SIZE;
-            if (offset < sizeof(FSNode)) {
-                memcpy(node_data + offset, sector_buffer, SECTOR_SIZE);
-            }
-        }
-        
-        sector = fs_cache[fs_count].next_sector;
-        fs_count++;
-    }
-
-    if (fs_count == 0) {
-        strcpy(fs_cache[0].name, "/");
-        fs_cache[0].is_dir = 1;
-        fs_cache[0].content[0] = '\0';
-        fs_cache[0].next_sector = 0;
-        fs_cache[0].size = 0;
-        fs_count = 1;
-        fs_dirty = 1;
-        fs_save_to_disk();
-    }
-}
-
-void fs_save_to_disk() {
-    if (!fs_dirty) return;
-
-    u8 sector_buffer[SECTOR_SIZE];
-    u32 sector = FS_SECTOR_START;
-
-    // Теперь структура FSNode занимает примерно 4096 + 1024 + 4 + 4 = 5128 байт
-    // 5128 / 512 = 10.01 → 11 секторов на узел
-    #define SECTORS_PER_NODE 11
-
-    for (int i = 0; i < fs_count; i++) {
-        u8* node_data = (u8*)&fs_cache[i];
-        
-        for (int j = 0; j < SECTORS_PER_NODE; j++) {
-            int offset = j * SECTOR_SIZE;
-            if (offset < sizeof(FSNode)) {
-                memcpy(sector_buffer, node_data + offset, SECTOR_SIZE);
-            } else {
-                memset(sector_buffer, 0, SECTOR_SIZE);
-            }
-            ata_write_sector(sector + j, sector_buffer);
-        }
-        
-        sector = (i == fs_count - 1) ? 0 : FS_SECTOR_START + (i + 1) * SECTORS_PER_NODE;
-        if (i < fs_count - 1) {
-            fs_cache[i].next_sector = sector;
-        } else {
-            fs_cache[i].next_sector = 0;
-        }
-    }
-
-    fs_dirty = 0;
-}
-
-void fs_mark_dirty() {
-    fs_dirty = 1;
-}
-
-void fs_init() {
-    fs_load_from_disk();
-    strcpy(current_dir, "/");
-}
-
-void fs_ls() {
-    prints("Contents of ");
-    prints(current_dir);
-    prints(":\n");
-
-    for (int i = 0; i < fs_count; i++) {
-        if (strcmp(current_dir, "/") == 0) {
-            char* slash = strchr(fs_cache[i].name, '/');
-            if (slash == NULL || slash == fs_cache[i].name) {
-                prints(fs_cache[i].name);
-                if (fs_cache[i].is_dir) prints("/");
-                newline();
-            }
-        } else {
-            if (strstr(fs_cache[i].name, current_dir) == fs_cache[i].name) {
-                char* name_part = fs_cache[i].name + strlen(current_dir);
-                if (*name_part != '\0' && strchr(name_part, '/') == NULL) {
-                    prints(name_part);
-                    if (fs_cache[i].is_dir) prints("/");
-                    newline();
-                }
-            }
-        }
-    }
-}
-
-void fs_mkdir(const char* name) {
-    if (fs_count >= MAX_FILES) {
-        prints("Error: Maximum files reached\n");
-        return;
-    }
-
-    char full_path[MAX_PATH];
-    if (strcmp(current_dir, "/") == 0) {
-        if (strlen(name) >= MAX_NAME) {
-            prints("Error: Name too long: ");
-            prints(name);
-            newline();
-            return;
-        }
-        strcpy(full_path, name);
-    } else {
-        if (strlen(current_dir) + strlen(name) + 1 >= MAX_PATH) {
-            prints("Error: Path too long: ");
-            prints(name);
-            newline();
-            return;
-        }
-        strcpy(full_path, current_dir);
-        strcat(full_path, name);
-    }
-
-    for (int i = 0; i < fs_count; i++) {
-        if (strcmp(fs_cache[i].name, full_path) == 0) {
-            prints("Error: Name already exists: ");
-            prints(name);
-            newline();
-            return;
-        }
-    }
-
-    strcpy(fs_cache[fs_count].name, full_path);
-    fs_cache[fs_count].is_dir = 1;
-    fs_cache[fs_count].content[0] = '\0';
-    fs_cache[fs_count].next_sector = 0;
-    fs_cache[fs_count].size = 0;
-    fs_count++;
-    fs_mark_dirty();
-    fs_save_to_disk();
-    prints("Directory '");
-    prints(name);
-    prints("' created\n");
-}
-
-void fs_touch(const char* name) {
-    if (fs_count >= MAX_FILES) {
-        prints("Error: Maximum files reached\n");
-        return;
-    }
-
-    char full_path[MAX_PATH];
-    if (strcmp(current_dir, "/") == 0) {
-        if (strlen(name) >= MAX_NAME) {
-            prints("Error: Name too long: ");
-            prints(name);
-            newline();
-            return;
-        }
-        strcpy(full_path, name);
-    } else {
-        if (strlen(current_dir) + strlen(name) + 1 >= MAX_PATH) {
-            prints("Error: Path too long: ");
-            prints(name);
-            newline();
-            return;
-        }
-        strcpy(full_path, current_dir);
-        strcat(full_path, name);
-    }
-
-    for (int i = 0; i < fs_count; i++) {
-        if (strcmp(fs_cache[i].name, full_path) == 0) {
-            prints("Error: Name already exists: ");
-            prints(name);
-            newline();
-            return;
-        }
-    }
-
-    strcpy(fs_cache[fs_count].name, full_path);
-    fs_cache[fs_count].is_dir = 0;
-    fs_cache[fs_count].content[0] = '\0';
-    fs_cache[fs_count].next_sector = 0;
-    fs_cache[fs_count].size = 0;
-    fs_count++;
-    fs_mark_dirty();
-    fs_save_to_disk();
-    prints("File '");
-    prints(name);
-    prints("' created\n");
-}
-
 void fs_rm(const char* name) {
     nek_see_lum_update();
     
@@ -484,23 +348,14 @@ void fs_rm(const char* name) {
         }
     }
     
-    char full_path[MAX_PATH];
-    if (strcmp(current_dir, "/") == 0) {
-        strcpy(full_path, name);
-    } else {
-        strcpy(full_path, current_dir);
-        strcat(full_path, name);
-    }
-
-    int found = -1;
-    for (int i = 0; i < fs_count; i++) {
-        if (strcmp(fs_cache[i].name, full_path) == 0) {
-            found = i;
-            break;
-        }
+    // Файл нижнего слоя не удаляется, а закрывается пометкой в WexFS
+    int status = fs_unlink(name);
+    if (status == -2) {
+        prints("Error: Maximum files reached\n");
+        return;
     }
 
-    if (found == -1) {
+    if (status == -1) {
         if (nek_see_lum_active && (rand() % 100) < 15) {
             prints("nek_see_lum: IT WAS NEVER THERE\n");
         } else {
@@ -511,11 +366,6 @@ void fs_rm(const char* name) {
         return;
     }
 
-    for (int i = found; i < fs_count - 1; i++) {
-        fs_cache[i] = fs_cache[i + 1];
-    }
-    fs_count--;
-    fs_mark_dirty();
     fs_save_to_disk();
 
     if (nek_see_lum_active && (rand() % 100) < 25) {
@@ -527,225 +377,6 @@ void fs_rm(const char* name) {
     }
 }
 
-void fs_cd(const char* name) {
-    if (strcmp(name, "..") == 0) {
-        if (strcmp(current_dir, "/") != 0) {
-            char* last_slash = strrchr(current_dir, '/');
-            if (last_slash != NULL) {
-                *last_slash = '\0';
-                if (current_dir[0] == '\0') {
-                    strcpy(current_dir, "/");
-                }
-            }
-        }
-    } else if (strcmp(name, "/") == 0) {
-        strcpy(current_dir, "/");
-    } else {
-        char full_path[MAX_PATH];
-        if (strcmp(current_dir, "/") == 0) {
-            if (strlen(name) >= MAX_NAME) {
-                prints("Error: Name too long: ");
-                prints(name);
-                newline();
-                return;
-            }
-            strcpy(full_path, name);
-        } else {
-            if (strlen(current_dir) + strlen(name) + 1 >= MAX_PATH) {
-                prints("Error: Path too long: ");
-                prints(name);
-                newline();
-                return;
-            }
-            strcpy(full_path, current_dir);
-            strcat(full_path, name);
-        }
-
-        int found = 0;
-        for (int i = 0; i < fs_count; i++) {
-            if (strcmp(fs_cache[i].name, full_path) == 0 && fs_cache[i].is_dir) {
-                strcpy(current_dir, full_path);
-                if (strcmp(full_path, "/") != 0) {
-                    strcat(current_dir, "/");
-                }
-                found = 1;
-                break;
-            }
-        }
-
-        if (!found) {
-            prints("Error: Directory not found: ");
-            prints(name);
-            newline();
-        }
-    }
-}
-
-FSNode* fs_find_file(const char* name) {
-    char full_path[MAX_PATH];
-    if (strcmp(current_dir, "/") == 0) {
-        if (strlen(name) >= MAX_NAME) {
-            prints("Error: Name too long: ");
-            prints(name);
-            newline();
-            return NULL;
-        }
-        strcpy(full_path, name);
-    } else {
-        if (strlen(current_dir) + strlen(name) + 1 >= MAX_PATH) {
-            prints("Error: Path too long: ");
-            prints(name);
-            newline();
-            return NULL;
-        }
-        strcpy(full_path, current_dir);
-        strcat(full_path, name);
-    }
-
-    for (int i = 0; i < fs_count; i++) {
-        if (strcmp(fs_cache[i].name, full_path) == 0 && !fs_cache[i].is_dir) {
-            return &fs_cache[i];
-        }
-    }
-    return NULL;
-}
-
-void fs_copy(const char* src_name, const char* dest_name) {
-    char src_path[MAX_PATH];
-    if (strcmp(current_dir, "/") == 0) {
-        if (strlen(src_name) >= MAX_NAME) {
-            prints("Error: Source name too long: ");
-            prints(src_name);
-            newline();
-            return;
-        }
-        strcpy(src_path, src_name);
-    } else {
-        if (strlen(current_dir) + strlen(src_name) + 1 >= MAX_PATH) {
-            prints("Error: Source path too long: ");
-            prints(src_name);
-            newline();
-            return;
-        }
-        strcpy(src_path, current_dir);
-        strcat(src_path, src_name);
-    }
-
-    FSNode* src = NULL;
-    for (int i = 0; i < fs_count; i++) {
-        if (strcmp(fs_cache[i].name, src_path) == 0 && !fs_cache[i].is_dir) {
-            src = &fs_cache[i];
-            break;
-        }
-    }
-
-    if (!src) {
-        prints("Error: Source file not found: ");
-        prints(src_name);
-        newline();
-        return;
-    }
-
-    if (fs_count >= MAX_FILES) {
-        prints("Error: Maximum files reached\n");
-        return;
-    }
-
-    char full_path[MAX_PATH];
-    if (strcmp(current_dir, "/") == 0) {
-        if (strlen(dest_name) >= MAX_NAME) {
-            prints("Error: Destination name too long: ");
-            prints(dest_name);
-            newline();
-            return;
-        }
-        strcpy(full_path, dest_name);
-    } else {
-        if (strlen(current_dir) + strlen(dest_name) + 1 >= MAX_PATH) {
-            prints("Error: Destination path too long: ");
-            prints(dest_name);
-            newline();
-            return;
-        }
-        strcpy(full_path, current_dir);
-        strcat(full_path, dest_name);
-    }
-
-    strcpy(fs_cache[fs_count].name, full_path);
-    fs_cache[fs_count].is_dir = 0;
-    strcpy(fs_cache[fs_count].content, src->content);
-    fs_cache[fs_count].next_sector = 0;
-    fs_cache[fs_count].size = src->size;
-    fs_count++;
-    fs_mark_dirty();
-    fs_save_to_disk();
-    prints("File copied to '");
-    prints(dest_name);
-    prints("'\n");
-}
-
-int folder_size(const char* folder_path) {
-    int total = 0;
-    char path_with_slash[MAX_PATH];
-    strcpy(path_with_slash, folder_path);
-    if (folder_path[strlen(folder_path) - 1] != '/') {
-        strcat(path_with_slash, "/");
-    }
-
-    for (int i = 0; i < fs_count; i++) {
-        FSNode* node = &fs_cache[i];
-        if (!node->is_dir && strstr(node->name, path_with_slash) == node->name) {
-            total += node->size;
-        }
-    }
-    return total;
-}
-
-void fs_size(const char* name) {
-    FSNode* node = NULL;
-    // ищем узел с точным именем
-    for (int i = 0; i < fs_count; i++) {
-        if (strcmp(fs_cache[i].name, name) == 0) {
-            node = &fs_cache[i];
-            break;
-        }
-    }
-
-    if (!node) {
-        prints("Error: File or folder not found: ");
-        prints(name);
-        newline();
-        return;
-    }
-
-    int size;
-    if (node->is_dir) {
-        size = folder_size(node->name);
-        prints("Folder size: ");
-    } else {
-        size = node->size;
-        prints("File size: ");
-    }
-
-    char size_str[16];
-    itoa(size, size_str, 10);
-    prints(size_str);
-    prints(" Bytes\n");
-}
-
-void find_command(const char* pattern) {
-    prints("Searching for: ");
-    prints(pattern);
-    newline();
-    for(int i = 0; i < fs_count; i++) {
-        if(strstr(fs_cache[i].name, pattern) != NULL) {
-            prints(fs_cache[i].name);
-            if(fs_cache[i].is_dir) prints("/");
-            newline();
-        }
-    }
-}
-
 void pwd_command() { 
     prints(current_dir); 
     newline(); 
@@ -760,21 +391,17 @@ void fs_format(void) {
     newline();
     
     if (confirm == 'y' || confirm == 'Y') {
+        prints("Enable compression? (y/N): ");
+        char compress = keyboard_getchar();
+        putchar(compress);
+        newline();
+
         prints("Formatting filesystem...\n");
         
         // Сбрасываем файловую систему к начальному состоянию
-        fs_count = 1;
-        strcpy(fs_cache[0].name, "/");
-        fs_cache[0].is_dir = 1;
-        fs_cache[0].content[0] = '\0';
-        fs_cache[0].next_sector = 0;
-        fs_cache[0].size = 0;
+        fs_reset((compress == 'y' || compress == 'Y') ? FS_FEATURE_LZ : 0);
         
-        // Сбрасываем текущую директорию
-        strcpy(current_dir, "/");
-        
-        // Помечаем как измененную и сохраняем
-        fs_mark_dirty();
+        // Сохраняем: пишутся только корень и суперблок
         fs_save_to_disk();
         
         prints("Filesystem formatted successfully.\n");
@@ -783,128 +410,6 @@ void fs_format(void) {
     }
 }
 
-
-/* Function implementations */
-void fs_check_integrity(void) {
-    prints("Checking filesystem integrity...\n");
-    prints("Filesystem: WexFS\n");
-    prints("Version: 1.0\n");
-    prints("======================================\n");
-    
-    int errors_found = 0;
-    int warnings_found = 0;
-    
-    // Проверка на дубликаты
-    prints("Phase 1: Checking for duplicates...\n");
-    for (int i = 0; i < fs_count; i++) {
-        for (int j = i + 1; j < fs_count; j++) {
-            if (strcmp(fs_cache[i].name, fs_cache[j].name) == 0) {
-                prints("ERROR: Duplicate filename: ");
-                prints(fs_cache[i].name);
-                newline();
-                errors_found++;
-            }
-        }
-    }
-    
-    // Проверка размера контента
-    prints("Phase 2: Checking file sizes...\n");
-    for (int i = 0; i < fs_count; i++) {
-        if (!fs_cache[i].is_dir) {
-            if (fs_cache[i].size > sizeof(fs_cache[i].content)) {
-                prints("ERROR: File size exceeds content buffer: ");
-                prints(fs_cache[i].name);
-                newline();
-                prints("  File size: ");
-                char size_str[20];
-                itoa(fs_cache[i].size, size_str, 10);
-                prints(size_str);
-                prints(", Max allowed: ");
-                itoa(sizeof(fs_cache[i].content), size_str, 10);
-                prints(size_str);
-                newline();
-                errors_found++;
-            }
-        }
-    }
-    
-    // Проверка максимального количества файлов
-    prints("Phase 3: Checking filesystem limits...\n");
-    if (fs_count >= MAX_FILES) {
-        prints("WARNING: Filesystem at maximum capacity (");
-        char max_str[10];
-        itoa(MAX_FILES, max_str, 10);
-        prints(max_str);
-        prints(" files)\n");
-        warnings_found++;
-    }
-    
-    // Статистика
-    prints("Phase 4: Generating statistics...\n");
-    int total_files = 0;
-    int total_dirs = 0;
-    
-    for (int i = 0; i < fs_count; i++) {
-        if (fs_cache[i].is_dir) {
-            total_dirs++;
-        } else {
-            total_files++;
-        }
-    }
-    
-    prints("======================================\n");
-    prints("Filesystem check completed.\n");
-    
-    char buf[20];
-    itoa(total_files, buf, 10);
-    prints("Files: "); prints(buf); newline();
-    itoa(total_dirs, buf, 10);
-    prints("Directories: "); prints(buf); newline();
-    itoa(fs_count, buf, 10);
-    prints("Total objects: "); prints(buf); newline();
-    itoa(MAX_FILES - fs_count, buf, 10);
-    prints("Free slots: "); prints(buf); newline();
-    
-    if (errors_found > 0) {
-        itoa(errors_found, buf, 10);
-        prints("Errors found: "); prints(buf); newline();
-        prints("Run 'format' to fix filesystem errors.\n");
-    } else {
-        prints("No errors found.\n");
-    }
-    
-    if (warnings_found > 0) {
-        itoa(warnings_found, buf, 10);
-        prints("Warnings: "); prints(buf); newline();
-    }
-    
-    prints("Filesystem is ");
-    if (errors_found == 0) {
-        prints("OK");
-    } else {
-        prints("CORRUPTED");
-    }
-    prints(".\n");
-}
-void fsck_command(void) {
-    prints("Filesystem Consistency Check\n");
-    prints("============================\n");
-    prints("This utility will check WexFS filesystem for errors\n");
-    prints("and report any inconsistencies.\n\n");
-    
-    prints("Continue? (y/N): ");
-    
-    char confirm = keyboard_getchar();
-    putchar(confirm);
-    newline();
-    
-    if (confirm == 'y' || confirm == 'Y') {
-        fs_check_integrity();
-    } else {
-        prints("Operation cancelled.\n");
-    }
-}
-
 int check_login() {
     FSNode* passfile = fs_find_file("SystemRoot/config/pass.cfg");
     if (!passfile || passfile->size == 0) {
@@ -912,6 +417,10 @@ int check_login() {
         return 1;
     }
 
+    char password[64];
+    int pass_len = fs_node_pread(passfile, password, sizeof(password) - 1, 0);
+    password[pass_len > 0 ? pass_len : 0] = '\0';
+
     unsigned char old_color = text_color;
     
     // Очищаем экран и рисуем фон с озером и полем
@@ -1073,7 +582,7 @@ int check_login() {
         update_buttons_display(button_area_x, button_area_y, selected_button, focus_on_buttons);
         
         // Обработка ввода
-        unsigned char st = inb(0x64);
+        unsigned char st = kbd_status();
         if (st & 1) {
             unsigned char sc = inb(0x60);
             
@@ -1093,7 +602,7 @@ int check_login() {
                         buffer[buffer_len] = '\0';
                         newline();
                         
-                        if (strcmp(buffer, passfile->content) == 0) {
+                        if (strcmp(buffer, password) == 0) {
                             // Успешный вход - очищаем экран и возвращаемся
                             text_color = old_color;
                             clear_screen();
@@ -1119,6 +628,7 @@ int check_login() {
                             buffer[0] = '\0';
                             
                             // Ждём немного перед очисткой сообщения
+                            vga_flush();
                             for (volatile int i = 0; i < 1000000; i++);
                         }
                     }
@@ -1233,37 +743,6 @@ void update_buttons_display(int button_area_x, int button_area_y, int selected_b
     prints("Shutdown");
 }
 
-/* Function implementation */
-void fs_cat(const char* filename) {
-    if (filename == NULL || strlen(filename) == 0) {
-        prints("Usage: cat <filename>\n");
-        return;
-    }
-
-    FSNode* file = fs_find_file(filename);
-    if (!file) {
-        prints("Error: File not found: ");
-        prints(filename);
-        newline();
-        return;
-    }
-
-    if (file->is_dir) {
-        prints("Error: '");
-        prints(filename);
-        prints("' is a directory\n");
-        return;
-    }
-
-    // Выводим содержимое файла
-    if (file->size > 0) {
-        prints(file->content);
-        newline();
-    } else {
-        prints("File is empty\n");
-    }
-}
-
 /* WexExplorer - файловый менеджер */
 void explorer_refresh(Explorer* exp) {
     exp->file_count = 0;
@@ -1279,49 +758,21 @@ void explorer_refresh(Explorer* exp) {
     }
     
     // Временные массивы для сортировки
-    FileEntry folders[MAX_FILES];
-    FileEntry files[MAX_FILES];
+    FileEntry folders[EXPLORER_MAX_FILES];
+    FileEntry files[EXPLORER_MAX_FILES];
     int folder_count = 0;
     int file_count = 0;
     
-    // Сканируем файловую систему
-    for (int i = 0; i < fs_count; i++) {
-        int is_in_current_dir = 0;
-        char relative_path[MAX_NAME] = "";
+    // Сканируем содержимое текущей директории
+    FSPath dir_path;
+    int dir = fs_path_resolve(exp->current_path, &dir_path) == 0 ? fs_path_find(&dir_path) : -1;
+    for (int i = 0; dir >= 0 && i < fs_count; i++) {
+        int is_in_current_dir = fs_cache[i].parent == fs_cache[dir].slot;
+        const char* relative_path = fs_node_name(&fs_cache[i]);
         
-        if (strcmp(exp->current_path, "/") == 0) {
-            // Корневая директория
-            if (fs_cache[i].name[0] == '/') {
-                char* second_slash = strchr(fs_cache[i].name + 1, '/');
-                if (second_slash == NULL) {
-                    is_in_current_dir = 1;
-                    strcpy(relative_path, fs_cache[i].name + 1);
-                }
-            } else {
-                is_in_current_dir = 1;
-                strcpy(relative_path, fs_cache[i].name);
-            }
-        } else {
-            // Поддиректории
-            char search_path[MAX_PATH];
-            strcpy(search_path, exp->current_path);
-            if (search_path[strlen(search_path)-1] != '/') {
-                strcat(search_path, "/");
-            }
-            
-            if (strstr(fs_cache[i].name, search_path) == fs_cache[i].name) {
-                char* name_part = fs_cache[i].name + strlen(search_path);
-                if (name_part[0] != '\0') {
-                    char* next_slash = strchr(name_part, '/');
-                    if (next_slash == NULL) {
-                        is_in_current_dir = 1;
-                        strcpy(relative_path, name_part);
-                    }
-                }
-            }
-        }
-        
-        if (is_in_current_dir && strlen(relative_path) > 0) {
+        // Пометки удаления оверлея в списке не показываются
+        int overlay_marker = strstr(relative_path, FS_WHITEOUT) == relative_path;
+        if (is_in_current_dir && strlen(relative_path) > 0 && !overlay_marker) {
             int duplicate = 0;
             for (int j = 0; j < exp->file_count; j++) {
                 if (strcmp(exp->files[j].name, relative_path) == 0) {
@@ -1332,11 +783,13 @@ void explorer_refresh(Explorer* exp) {
             
             if (!duplicate) {
                 if (fs_cache[i].is_dir) {
+                    if (folder_count == EXPLORER_MAX_FILES) continue;
                     strcpy(folders[folder_count].name, relative_path);
                     folders[folder_count].is_dir = 1;
-                    folders[folder_count].size = fs_cache[i].size;
+                    folders[folder_count].size = fs_cache[i].tree_size;
                     folder_count++;
                 } else {
+                    if (file_count == EXPLORER_MAX_FILES) continue;
                     strcpy(files[file_count].name, relative_path);
                     files[file_count].is_dir = 0;
                     files[file_count].size = fs_cache[i].size;
@@ -1369,12 +822,12 @@ void explorer_refresh(Explorer* exp) {
     }
     
     // Объединяем: сначала папки, потом файлы
-    for (int i = 0; i < folder_count && exp->file_count < MAX_FILES; i++) {
+    for (int i = 0; i < folder_count && exp->file_count < EXPLORER_MAX_FILES; i++) {
         exp->files[exp->file_count] = folders[i];
         exp->file_count++;
     }
     
-    for (int i = 0; i < file_count && exp->file_count < MAX_FILES; i++) {
+    for (int i = 0; i < file_count && exp->file_count < EXPLORER_MAX_FILES; i++) {
         exp->files[exp->file_count] = files[i];
         exp->file_count++;
     }
@@ -1482,7 +935,16 @@ void draw_status_bar(Explorer* exp) {
     strcat(stat_buf, " folders, ");
     itoa(file_count, count_str, 10);
     strcat(stat_buf, count_str);
-    strcat(stat_buf, " files)");
+    strcat(stat_buf, " files, ");
+    
+    // Размер папки берётся из итогов директории, без обхода
+    char folder[MAX_PATH];
+    strcpy(folder, exp->current_path);
+    int folder_len = strlen(folder);
+    if (folder_len > 1 && folder[folder_len - 1] == '/') folder[folder_len - 1] = '\0';
+    itoa(folder_size(folder), count_str, 10);
+    strcat(stat_buf, count_str);
+    strcat(stat_buf, " bytes)");
     
     // Выбранный файл
     if (exp->file_count > 0 && exp->selected_index < exp->file_count) {
@@ -1552,13 +1014,13 @@ int explorer_handle_input(Explorer* exp) {
     int list_height = ROWS - 4;
     
     while (1) {
-        unsigned char st = inb(0x64);
+        unsigned char st = kbd_status();
         if (st & 1) {
             unsigned char sc = inb(0x60);
             
             if (sc == 0xE0) {
                 // Extended key
-                while (!(inb(0x64) & 1));
+                while (!(kbd_status() & 1));
                 sc = inb(0x60);
                 
                 switch (sc) {
@@ -1666,11 +1128,10 @@ void wexplorer_command(void) {
                             
                             // Проверяем, что это действительно папка
                             int is_valid_dir = 0;
-                            for (int i = 0; i < fs_count; i++) {
-                                if (strcmp(fs_cache[i].name, new_path) == 0 && fs_cache[i].is_dir) {
-                                    is_valid_dir = 1;
-                                    break;
-                                }
+                            FSPath folder_path;
+                            if (fs_path_resolve(new_path, &folder_path) == 0) {
+                                int folder = fs_path_find(&folder_path);
+                                is_valid_dir = folder >= 0 && fs_cache[folder].is_dir;
                             }
                             
                             if (is_valid_dir) {
@@ -1803,48 +1264,344 @@ void itoa(int value, char* str, int base) {
 
 
 /* VGA output */
+void vga_flush(void) {
+    vga_pair* front = (vga_pair*)vga_front;
+    int start = (int)(VGA - vga_shadow);
+    const vga_pair* page = (const vga_pair*)(scrollback_offset ? scrollback_view : VGA);
+
+    if (!vga_front_valid) {
+        // Первый вывод: всё окно приводится к теневой копии
+        const vga_pair* back = (const vga_pair*)vga_shadow;
+        for (int i = 0; i < VGA_WINDOW_ROWS * COLS / 2; i++) {
+            front[i] = back[i];
+            VGA_TEXT[i] = back[i];
+        }
+        vga_front_valid = 1;
+    }
+
+    for (int r = 0; r < ROWS; r++) {
+        const vga_pair* src = page + r * COLS / 2;
+        int row = (start + r * COLS) / 2;
+        int first = 0, last = COLS / 2 - 1;
+        while (first <= last && src[first] == front[row + first]) first++;
+        if (first > last) continue;
+        while (src[last] == front[row + last]) last--;
+        for (int i = first; i <= last; i++) {
+            front[row + i] = src[i];
+            VGA_TEXT[row + i] = src[i];
+        }
+    }
+
+    // Страница уже записана, теперь её можно показать
+    if (start != vga_start) {
+        outb(0x3D4, 0x0C);
+        outb(0x3D5, (unsigned char)(start >> 8));
+        outb(0x3D4, 0x0D);
+        outb(0x3D5, (unsigned char)(start & 0xFF));
+        vga_start = start;
+    }
+    vga_flush_stamp = (u32)rdtsc();
+}
+
+// Прокрутка на строку вверх: страница съезжает по окну на строку вниз,
+// копирование нужно только когда окно кончилось
+static void vga_scroll(void) {
+    unsigned short blank = (unsigned short)(' ' | (text_color << 8));
+    vga_pair* saved = (vga_pair*)&scrollback[scrollback_head * COLS];
+    const vga_pair* top = (const vga_pair*)VGA;
+
+    for (int i = 0; i < COLS / 2; i++) saved[i] = top[i];
+    scrollback_head = (scrollback_head + 1) % SCROLLBACK_LINES;
+    if (scrollback_count < SCROLLBACK_LINES) scrollback_count++;
+
+    if (VGA + (ROWS + 1) * COLS > vga_shadow + VGA_WINDOW_ROWS * COLS) {
+        vga_pair* dst = (vga_pair*)vga_shadow;
+        const vga_pair* src = (const vga_pair*)(VGA + COLS);
+        for (int i = 0; i < (ROWS - 1) * COLS / 2; i++) dst[i] = src[i];
+        VGA = vga_shadow;
+    } else {
+        VGA += COLS;
+    }
+    for (int c = 0; c < COLS; c++) VGA[(ROWS-1) * COLS + c] = blank;
+    cursor_row = ROWS-1;
+
+    if (pager_active && ++pager_scrolled >= ROWS - 1) console_pager_wait();
+}
+
+// Собирает страницу просмотра: строки кольца сверху, под ними живой экран
+static void scrollback_render(void) {
+    vga_pair* dst = (vga_pair*)scrollback_view;
+
+    for (int r = 0; r < ROWS; r++) {
+        int line = r - scrollback_offset;
+        const unsigned short* src = line < 0
+            ? &scrollback[((scrollback_head + line + SCROLLBACK_LINES) % SCROLLBACK_LINES) * COLS]
+            : &VGA[line * COLS];
+        for (int i = 0; i < COLS / 2; i++) dst[r * COLS / 2 + i] = ((const vga_pair*)src)[i];
+    }
+
+    char mark[24] = " Scrollback -";
+    itoa(scrollback_offset, mark + strlen(mark), 10);
+    strcat(mark, " ");
+    int len = strlen(mark);
+    for (int i = 0; i < len; i++)
+        scrollback_view[COLS - len + i] = (unsigned short)((unsigned char)mark[i] | (0x70 << 8));
+}
+
+/* ANSI escape sequences
+ * putchar() feeds ESC sequences through a small VT100 state machine. ESC [
+ * collects numeric parameters, and the final byte selects a handler from
+ * ansi_csi. The supported sequences are cursor movement (A B C D G H d f s
+ * u), erase (J K), SGR colours (m), the scroll region (r) and region
+ * scrolling (S T). Unknown sequences and DEC private modes (ESC [ ? ...)
+ * are consumed without effect. */
+enum { ANSI_GROUND, ANSI_ESC, ANSI_CSI };
+#define ANSI_MAX_PARAMS 8
+static int ansi_state = ANSI_GROUND;
+static int ansi_params[ANSI_MAX_PARAMS];
+static int ansi_nparams = 0;
+static int ansi_private = 0;
+static int ansi_top = 0, ansi_bottom = ROWS - 1;   // область прокрутки
+static unsigned int ansi_saved_row = 0, ansi_saved_col = 0;
+static unsigned char ansi_base_color = 0x07;       // цвет до первого SGR
+static unsigned char ansi_fg = 0x07, ansi_bg = 0x00;
+static int ansi_sgr_active = 0;
+static int ansi_reverse = 0;
+
+static int ansi_param(int i, int def) {
+    return i < ansi_nparams && ansi_params[i] > 0 ? ansi_params[i] : def;
+}
+
+static int ansi_clamp(int v, int lo, int hi) {
+    return v < lo ? lo : v > hi ? hi : v;
+}
+
+// Гасит ячейки экрана [from, to) текущим цветом
+static void console_fill(int from, int to) {
+    unsigned short blank = (unsigned short)(' ' | (text_color << 8));
+    for (int i = from; i < to; i++) VGA[i] = blank;
+}
+
+// Сдвигает строки top..bottom на n вверх (n < 0 — вниз), освободившиеся
+// строки гаснут. В кольцо прокрутки такие строки не попадают.
+static void console_scroll(int top, int bottom, int n) {
+    vga_pair* cells = (vga_pair*)VGA;
+    int height = bottom - top + 1;
+
+    n = ansi_clamp(n, -height, height);
+    if (n > 0) {
+        for (int r = top; r <= bottom - n; r++)
+            for (int i = 0; i < COLS / 2; i++) cells[r * COLS / 2 + i] = cells[(r + n) * COLS / 2 + i];
+        console_fill((bottom - n + 1) * COLS, (bottom + 1) * COLS);
+    } else if (n < 0) {
+        n = -n;
+        for (int r = bottom; r >= top + n; r--)
+            for (int i = 0; i < COLS / 2; i++) cells[r * COLS / 2 + i] = cells[(r - n) * COLS / 2 + i];
+        console_fill(top * COLS, (top + n) * COLS);
+    }
+}
+
+// Перевод строки. Внизу области прокрутки сдвигается только она,
+// полноэкранная прокрутка идёт через vga_scroll() и кольцо.
+static void console_linefeed(void) {
+    if ((int)cursor_row == ansi_bottom && (ansi_top > 0 || ansi_bottom < ROWS - 1)) {
+        console_scroll(ansi_top, ansi_bottom, 1);
+        return;
+    }
+    cursor_row++;
+    if (cursor_row >= ROWS) vga_scroll();
+}
+
+// Управляющие символы C0; 0, если символ не управляющий и его надо рисовать
+static int console_control(unsigned char c) {
+    if (c == '\n') {
+        cursor_col = 0;
+        console_linefeed();
+    } else if (c == '\r') {
+        cursor_col = 0;
+    } else if (c == '\b') {
+        // С начала строки — в конец предыдущей, чтобы стирать перенесённый ввод
+        if (cursor_col > 0) {
+            cursor_col--;
+        } else if ((int)cursor_row > ansi_top) {
+            cursor_row--;
+            cursor_col = COLS - 1;
+        }
+    } else if (c == '\t') {
+        cursor_col = (cursor_col + 8) & ~7u;
+        if (cursor_col >= COLS) cursor_col = COLS - 1;
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+static void ansi_cuu(void) { cursor_row = ansi_clamp((int)cursor_row - ansi_param(0, 1), 0, ROWS - 1); }
+static void ansi_cud(void) { cursor_row = ansi_clamp((int)cursor_row + ansi_param(0, 1), 0, ROWS - 1); }
+static void ansi_cuf(void) { cursor_col = ansi_clamp((int)cursor_col + ansi_param(0, 1), 0, COLS - 1); }
+static void ansi_cub(void) { cursor_col = ansi_clamp((int)cursor_col - ansi_param(0, 1), 0, COLS - 1); }
+static void ansi_cha(void) { cursor_col = ansi_clamp(ansi_param(0, 1) - 1, 0, COLS - 1); }
+static void ansi_vpa(void) { cursor_row = ansi_clamp(ansi_param(0, 1) - 1, 0, ROWS - 1); }
+static void ansi_scp(void) { ansi_saved_row = cursor_row; ansi_saved_col = cursor_col; }
+static void ansi_rcp(void) { cursor_row = ansi_saved_row; cursor_col = ansi_saved_col; }
+static void ansi_su(void)  { console_scroll(ansi_top, ansi_bottom, ansi_param(0, 1)); }
+static void ansi_sd(void)  { console_scroll(ansi_top, ansi_bottom, -ansi_param(0, 1)); }
+
+static void ansi_cup(void) {
+    cursor_row = ansi_clamp(ansi_param(0, 1) - 1, 0, ROWS - 1);
+    cursor_col = ansi_clamp(ansi_param(1, 1) - 1, 0, COLS - 1);
+}
+
+static void ansi_ed(void) {
+    int at = cursor_row * COLS + cursor_col;
+    int mode = ansi_param(0, 0);
+
+    if (mode == 0) console_fill(at, ROWS * COLS);
+    else if (mode == 1) console_fill(0, at + 1);
+    else {
+        console_fill(0, ROWS * COLS);
+        if (mode == 3) scrollback_count = 0;
+    }
+}
+
+static void ansi_el(void) {
+    int line = cursor_row * COLS;
+    int mode = ansi_param(0, 0);
+
+    if (mode == 0) console_fill(line + cursor_col, line + COLS);
+    else if (mode == 1) console_fill(line, line + cursor_col + 1);
+    else console_fill(line, line + COLS);
+}
+
+// Область прокрутки; без параметров — весь экран. Курсор уходит домой.
+static void ansi_stbm(void) {
+    int top = ansi_param(0, 1) - 1;
+    int bottom = ansi_param(1, ROWS) - 1;
+
+    if (top < bottom && bottom < ROWS) {
+        ansi_top = top;
+        ansi_bottom = bottom;
+    }
+    cursor_row = 0;
+    cursor_col = 0;
+}
+
+// SGR. Цвета ANSI идут в другом порядке, чем в VGA. Яркий фон (100-107)
+// даёт обычный: бит 7 атрибута VGA означает мигание.
+static void ansi_sgr(void) {
+    static const unsigned char vga_of_ansi[8] = { 0, 4, 2, 6, 1, 5, 3, 7 };
+    int count = ansi_nparams ? ansi_nparams : 1;
+
+    for (int i = 0; i < count; i++) {
+        int p = ansi_params[i];
+        if (p == 0) {
+            if (ansi_sgr_active) text_color = ansi_base_color;
+            ansi_sgr_active = 0;
+            continue;
+        }
+        if (!ansi_sgr_active) {
+            ansi_base_color = text_color;
+            ansi_fg = text_color & 0x0F;
+            ansi_bg = text_color >> 4;
+            ansi_reverse = 0;
+            ansi_sgr_active = 1;
+        }
+        if (p == 1) ansi_fg |= 0x08;
+        else if (p == 22) ansi_fg &= 0x07;
+        else if (p == 7) ansi_reverse = 1;
+        else if (p == 27) ansi_reverse = 0;
+        else if (p >= 30 && p <= 37) ansi_fg = (ansi_fg & 0x08) | vga_of_ansi[p - 30];
+        else if (p == 39) ansi_fg = ansi_base_color & 0x0F;
+        else if (p >= 40 && p <= 47) ansi_bg = vga_of_ansi[p - 40];
+        else if (p == 49) ansi_bg = ansi_base_color >> 4;
+        else if (p >= 90 && p <= 97) ansi_fg = 0x08 | vga_of_ansi[p - 90];
+        else if (p >= 100 && p <= 107) ansi_bg = vga_of_ansi[p - 100];
+    }
+    if (ansi_sgr_active)
+        text_color = ansi_reverse ? (unsigned char)(((ansi_fg & 0x07) << 4) | ansi_bg)
+                                  : (unsigned char)((ansi_bg << 4) | ansi_fg);
+}
+
+// Обработчики CSI по конечному байту 0x40..0x7E
+static void (* const ansi_csi[0x3F])(void) = {
+    ['A' - '@'] = ansi_cuu,  ['B' - '@'] = ansi_cud,  ['C' - '@'] = ansi_cuf,
+    ['D' - '@'] = ansi_cub,  ['G' - '@'] = ansi_cha,  ['H' - '@'] = ansi_cup,
+    ['J' - '@'] = ansi_ed,   ['K' - '@'] = ansi_el,   ['S' - '@'] = ansi_su,
+    ['T' - '@'] = ansi_sd,   ['d' - '@'] = ansi_vpa,  ['f' - '@'] = ansi_cup,
+    ['m' - '@'] = ansi_sgr,  ['r' - '@'] = ansi_stbm, ['s' - '@'] = ansi_scp,
+    ['u' - '@'] = ansi_rcp,
+};
+
+static void ansi_feed(unsigned char c) {
+    if (c == 0x1B) {                        // ESC прерывает начатую последовательность
+        ansi_state = ANSI_ESC;
+        return;
+    }
+    if (c < 0x20) {                         // как в VT100: C0 выполняются посреди последовательности
+        if (c == 0x18 || c == 0x1A) ansi_state = ANSI_GROUND;  // CAN, SUB
+        else console_control(c);
+        return;
+    }
+    if (ansi_state == ANSI_ESC) {
+        ansi_state = ANSI_GROUND;
+        if (c == '[') {
+            ansi_state = ANSI_CSI;
+            ansi_nparams = 0;
+            ansi_private = 0;
+            for (int i = 0; i < ANSI_MAX_PARAMS; i++) ansi_params[i] = 0;
+        } else if (c == '7') {
+            ansi_scp();
+        } else if (c == '8') {
+            ansi_rcp();
+        } else if (c == 'M') {              // обратный перевод строки
+            if ((int)cursor_row == ansi_top) console_scroll(ansi_top, ansi_bottom, -1);
+            else if (cursor_row > 0) cursor_row--;
+        }
+        return;
+    }
+
+    if (c >= '0' && c <= '9') {
+        if (ansi_nparams == 0) ansi_nparams = 1;
+        int* p = &ansi_params[ansi_nparams - 1];
+        if (*p < 1000) *p = *p * 10 + (c - '0');
+    } else if (c == ';') {
+        if (ansi_nparams == 0) ansi_nparams = 1;
+        if (ansi_nparams < ANSI_MAX_PARAMS) ansi_nparams++;
+    } else if (c == '?') {
+        ansi_private = 1;
+    } else if (c >= 0x40 && c <= 0x7E) {
+        ansi_state = ANSI_GROUND;
+        if (!ansi_private && ansi_csi[c - 0x40]) ansi_csi[c - 0x40]();
+    }
+}
+
 void clear_screen() {
     for(int r = 0; r < ROWS; r++)
         for(int c = 0; c < COLS; c++)
             VGA[r * COLS + c] = (unsigned short)(' ' | (text_color << 8));
     cursor_row = 0;
     cursor_col = 0;
+    ansi_top = 0;
+    ansi_bottom = ROWS - 1;
 }
 
 void putchar(char ch) {
-    if(ch == '\n') {
-        cursor_col = 0;
-        cursor_row++;
-        if(cursor_row >= ROWS) {
-            for(int r = 0; r < ROWS-1; r++) {
-                for(int c = 0; c < COLS; c++) {
-                    VGA[r * COLS + c] = VGA[(r+1) * COLS + c];
-                }
-            }
-            for(int c = 0; c < COLS; c++) {
-                VGA[(ROWS-1) * COLS + c] = (unsigned short)(' ' | (text_color << 8));
-            }
-            cursor_row = ROWS-1;
-        }
-        return;
-    }
-    VGA[cursor_row * COLS + cursor_col] = (unsigned short)(ch | (text_color << 8));
-    cursor_col++;
-    if(cursor_col >= COLS) {
-        cursor_col = 0;
-        cursor_row++;
-        if(cursor_row >= ROWS) {
-            for(int r = 0; r < ROWS-1; r++) {
-                for(int c = 0; c < COLS; c++) {
-                    VGA[r * COLS + c] = VGA[(r+1) * COLS + c];
-                }
-            }
-            for(int c = 0; c < COLS; c++) {
-                VGA[(ROWS-1) * COLS + c] = (unsigned short)(' ' | (text_color << 8));
-            }
-            cursor_row = ROWS-1;
+    if (pager_quit) return;
+    scrollback_offset = 0;                  // новый вывод возвращает к живому экрану
+
+    if (ansi_state != ANSI_GROUND || ch == '\033') {
+        ansi_feed((unsigned char)ch);
+    } else if (!console_control((unsigned char)ch)) {
+        VGA[cursor_row * COLS + cursor_col] = (unsigned short)((unsigned char)ch | (text_color << 8));
+        cursor_col++;
+        if(cursor_col >= COLS) {
+            cursor_col = 0;
+            console_linefeed();
         }
     }
+
+    // Длинный вывод виден по ходу, но экран обновляется кадрами
+    if ((u32)rdtsc() - vga_flush_stamp > VGA_FLUSH_CYCLES) vga_flush();
 }
 
 void prints(const char* s) {
@@ -1857,6 +1614,7 @@ void newline() {
 
 /* Delay function */
 void delay(int seconds) {
+    vga_flush();
     for (volatile int i = 0; i < seconds * 10000000; i++);
 }
 
@@ -1990,23 +1748,77 @@ void get_datetime(char *buffer) {
 
 /* Keyboard input */
 static unsigned char shift_pressed = 0;
+static unsigned char kbd_e0 = 0;            // пришёл префикс E0
+
+// Разбирает байт скан-кода (набор 1) и ведёт состояние Shift. Возвращает
+// код нажатия или 0, если байт ничего не нажимает: отпускание, префикс,
+// сам Shift. В *extended — был ли перед кодом E0. Серые клавиши при
+// зажатом Shift клавиатура обрамляет ложными E0 AA / E0 2A: Shift от них
+// не меняется.
+static unsigned char kbd_scancode(unsigned char sc, int* extended) {
+    int e0 = kbd_e0;
+
+    kbd_e0 = 0;
+    *extended = e0;
+    if (sc == 0xE0) {
+        kbd_e0 = 1;
+        return 0;
+    }
+    if ((sc & 0x7F) == 0x2A || (sc & 0x7F) == 0x36) {
+        if (!e0) shift_pressed = !(sc & 0x80);
+        return 0;
+    }
+    if (sc & 0x80) return 0;
+    return sc;
+}
+
+// Shift+PgUp/PgDn листают кольцо прокрутки, любая другая клавиша
+// возвращает живой экран. Возвращает 1, если клавиша съедена.
+static int scrollback_key(unsigned char sc) {
+    int offset;
+
+    if (shift_pressed && sc == 0x49) offset = scrollback_offset + (ROWS - 1);
+    else if (shift_pressed && sc == 0x51) offset = scrollback_offset - (ROWS - 1);
+    else {
+        scrollback_offset = 0;
+        return 0;
+    }
+    if (offset > scrollback_count) offset = scrollback_count;
+    if (offset < 0) offset = 0;
+    scrollback_offset = offset;
+    if (offset) scrollback_render();
+    return 1;
+}
+
+// Подсказка пейджера в нижней строке. Пробел — следующий экран,
+// Enter — ещё строка, Q или Esc — отбросить остаток вывода.
+void console_pager_wait(void) {
+    const char* prompt = "-- More -- (Space: page, Enter: line, Q: quit)";
+    unsigned short* row = &VGA[(ROWS - 1) * COLS];
+    unsigned char sc;
+    int extended;
+
+    for (int i = 0; prompt[i]; i++) row[i] = (unsigned short)((unsigned char)prompt[i] | (0x70 << 8));
+    while (1) {
+        while (!(kbd_status() & 1));
+        sc = kbd_scancode(inb(0x60), &extended);
+        if (!sc || scrollback_key(sc)) continue;
+        if (sc == 0x39 || sc == 0x1C || sc == 0x10 || sc == 0x01) break;
+    }
+    for (int c = 0; c < COLS; c++) row[c] = (unsigned short)(' ' | (text_color << 8));
+    cursor_col = 0;
+
+    pager_scrolled = sc == 0x1C ? ROWS - 2 : 0;
+    pager_quit = sc == 0x10 || sc == 0x01;
+}
 
 char keyboard_getchar() {
     while(1) {
-        unsigned char st = inb(0x64);
+        unsigned char st = kbd_status();
         if(st & 1) {
-            unsigned char sc = inb(0x60);
-            if ((sc & 0x80) != 0) {
-                sc &= 0x7F;
-                if (sc == 0x2A || sc == 0x36) {
-                    shift_pressed = 0;
-                }
-                continue;
-            }
-            if (sc == 0x2A || sc == 0x36) {
-                shift_pressed = 1;
-                continue;
-            }
+            int extended;
+            unsigned char sc = kbd_scancode(inb(0x60), &extended);
+            if (!sc || scrollback_key(sc)) continue;
             static const char t[128] = {
                 0, 27, '1', '2', '3', '4', '5', '6', '7', '8', '9', '0', '-', '=', '\b', '\t',
                 'q', 'w', 'e', 'r', 't', 'y', 'u', 'i', 'o', 'p', '[', ']', '\n', 0,
@@ -2027,33 +1839,20 @@ char keyboard_getchar() {
     }
 }
 
+// Стрелки приходят кодами вне печатного диапазона, чтобы строка ввода
+// не вставляла их как буквы
 char getch_with_arrows() {
-    static unsigned char extended = 0;
     while(1) {
-        unsigned char st = inb(0x64);
+        unsigned char st = kbd_status();
         if (st & 1) {
-            unsigned char sc = inb(0x60);
-            if ((sc & 0x80) != 0) {
-                sc &= 0x7F;
-                if (sc == 0x2A || sc == 0x36) shift_pressed = 0;
-                extended = 0;
-                continue;
-            }
-            if (sc == 0x2A || sc == 0x36) {
-                shift_pressed = 1;
-                continue;
-            }
-            if (sc == 0xE0) {
-                extended = 1;
-                continue;
-            }
+            int extended;
+            unsigned char sc = kbd_scancode(inb(0x60), &extended);
+            if (!sc || scrollback_key(sc)) continue;
             if (extended) {
-                extended = 0;
-                if (sc == 0x48) return 'U';
-                if (sc == 0x50) return 'D';
-                if (sc == 0x4B) return 'L';
-                if (sc == 0x4D) return 'R';
-                continue;
+                if (sc == 0x48) return '\x80';
+                if (sc == 0x50) return '\x81';
+                if (sc == 0x4B) return '\x82';
+                if (sc == 0x4D) return '\x83';
             }
             static const char t[128] = {
                 0, 27, '1', '2', '3', '4', '5', '6', '7', '8', '9', '0', '-', '=', '\b', '\t',
@@ -2078,12 +1877,14 @@ char getch_with_arrows() {
 /* System commands */
 void reboot_system() {
     prints("Rebooting...\n");
+    vga_flush();
     outb(0x64, 0xFE);
     while(1) { __asm__ volatile("hlt"); }
 }
 
 void shutdown_system() {
     prints("Shutdown...\n");
+    vga_flush();
     
     // Попытка ACPI выключения через порт 0x604
     outw(0x604, 0x2000);
@@ -2726,12 +2527,12 @@ void cmd_desktop() {
         putchar('X');
 
         // ------ Неблокирующая обработка ввода ------
-        if (inb(0x64) & 1) {
+        if (kbd_status() & 1) {
             unsigned char sc = inb(0x60);
             
             if (sc == 0xE0) {
                 // Расширенный код
-                while (!(inb(0x64) & 1));
+                while (!(kbd_status() & 1));
                 sc = inb(0x60);
                 
                 switch(sc) {
@@ -2967,7 +2768,8 @@ void osinfo_command() {
     unsigned short ext_mem_high = inb(0x71);
     unsigned short ext_memory = (ext_mem_high << 8) | ext_mem_low;
     
-    unsigned int total_memory_kb = base_memory + ext_memory;
+    // Загрузчик знает память точнее CMOS, которая видит не больше 64 МБ
+    unsigned int total_memory_kb = boot_memory_kb ? boot_memory_kb : base_memory + ext_memory;
     unsigned int total_memory_mb = total_memory_kb / 1024;
     
     prints("  Total Memory: ");
@@ -3145,7 +2947,7 @@ void sphere_rand(void) {
         }
         
         // Проверка нажатия любой клавиши для выхода
-        if (inb(0x64) & 1) {
+        if (kbd_status() & 1) {
             unsigned char sc = inb(0x60);
             if ((sc & 0x80) == 0) { // Любая нажатая клавиша
                 exit_saver = 1;
@@ -3376,8 +3178,8 @@ void install_disk() {
     fs_touch("SystemRoot/config/autorun.cfg");
     FSNode* autorun_file = fs_find_file("SystemRoot/config/autorun.cfg");
     if (autorun_file) {
-        strcpy(autorun_file->content, "desktop");
-        autorun_file->size = strlen("desktop");
+        fs_write_content(autorun_file, "desktop", strlen("desktop"));
+        fs_save_to_disk();
         prints("Desktop autorun configured\n");
     }
 
@@ -3386,8 +3188,7 @@ void install_disk() {
         fs_touch("SystemRoot/config/pass.cfg");
         FSNode* passfile = fs_find_file("SystemRoot/config/pass.cfg");
         if (passfile) {
-            strcpy(passfile->content, password);
-            passfile->size = strlen(password);
+            fs_write_content(passfile, password, strlen(password));
             fs_mark_dirty();
             fs_save_to_disk();
         }
@@ -3423,8 +3224,7 @@ void autorun_save_config(const char* command) {
     }
     
     if (autorun_file) {
-        strcpy(autorun_file->content, command);
-        autorun_file->size = strlen(command);
+        fs_write_content(autorun_file, command, strlen(command));
         fs_mark_dirty();
         fs_save_to_disk();
     }
@@ -3435,34 +3235,34 @@ void autorun_execute(void) {
     char old_dir[MAX_PATH];
     strcpy(old_dir, current_dir);
     
-    // Ищем файл во всей файловой системе (без смены директории)
+    // Ищем файл по абсолютному пути (без смены директории); он может
+    // прийти и с диска, и из SystemRoot модуля загрузчика
     int found = 0;
-    for (int i = 0; i < fs_count; i++) {
-        if (strcmp(fs_cache[i].name, "SystemRoot/config/autorun.cfg") == 0 && !fs_cache[i].is_dir) {
-            FSNode* autorun_file = &fs_cache[i];
+    int fd = fs_open("/SystemRoot/config/autorun.cfg", FS_O_READ);
+    if (fd >= 0) {
+        // Читаем не больше, чем помещается в буфер команды
+        int len = fs_read(fd, autorun_command_buf, AUTORUN_MAX_COMMAND - 1);
+        fs_close(fd);
+
+        if (len > 0) {
+            autorun_command_buf[len] = '\0';
             
-            if (autorun_file->size > 0) {
-                // Копируем содержимое
-                strcpy(autorun_command_buf, autorun_file->content);
-                
-                // Убираем символы переноса строки
-                char* newline = strchr(autorun_command_buf, '\n');
-                if (newline) *newline = '\0';
-                char* cr = strchr(autorun_command_buf, '\r');
-                if (cr) *cr = '\0';
-                
-                // Убираем пробелы
-                trim_whitespace(autorun_command_buf);
-                
-                if (strlen(autorun_command_buf) > 0) {
-                    prints("Executing autorun: '");
-                    prints(autorun_command_buf);
-                    prints("'\n");
-                    run_command(autorun_command_buf);
-                    found = 1;
-                }
+            // Убираем символы переноса строки
+            char* newline = strchr(autorun_command_buf, '\n');
+            if (newline) *newline = '\0';
+            char* cr = strchr(autorun_command_buf, '\r');
+            if (cr) *cr = '\0';
+            
+            // Убираем пробелы
+            trim_whitespace(autorun_command_buf);
+            
+            if (strlen(autorun_command_buf) > 0) {
+                prints("Executing autorun: '");
+                prints(autorun_command_buf);
+                prints("'\n");
+                run_command(autorun_command_buf);
+                found = 1;
             }
-            break;
         }
     }
     
@@ -3784,7 +3584,7 @@ void matrix_game(void) {
         }
         
         // Проверяем нажатие ESC для выхода
-        unsigned char st = inb(0x64);
+        unsigned char st = kbd_status();
         if(st & 1) {
             unsigned char sc = inb(0x60);
             if(sc == 0x01) { // ESC
@@ -3993,6 +3793,9 @@ void nek_see_lum_whisper(void) {
 }
 
 void nek_see_lum_files(void) {
+    // Все изменения пишутся на диск одним проходом в конце
+    fs_begin();
+
     // Создаём случайные файлы и папки по всей системе
     for (int i = 0; i < 15; i++) { // Создаём 15 случайных объектов
         if (fs_count >= MAX_FILES - 1) break;
@@ -4033,8 +3836,7 @@ void nek_see_lum_files(void) {
                         "CORRUPTION SPREADS"
                     };
                     int msg_index = rand() % 10;
-                    strcpy(file->content, messages[msg_index]);
-                    file->size = strlen(messages[msg_index]);
+                    fs_write_content(file, messages[msg_index], strlen(messages[msg_index]));
                 }
                 break;
                 
@@ -4059,8 +3861,7 @@ void nek_see_lum_files(void) {
         fs_touch("SystemRoot/entity_core/core.lum");
         FSNode* core_file = fs_find_file("SystemRoot/entity_core/core.lum");
         if (core_file) {
-            strcpy(core_file->content, "ENTITY MANIFESTATION: 87%");
-            core_file->size = strlen("ENTITY MANIFESTATION: 87%");
+            fs_write_content(core_file, "ENTITY MANIFESTATION: 87%", strlen("ENTITY MANIFESTATION: 87%"));
         }
         
         fs_touch("SystemRoot/corrupted_mem/memory_dump.lum");
@@ -4085,13 +3886,12 @@ void nek_see_lum_files(void) {
                 "MEMORY CORRUPTION AT 0x00FFLUM",
                 "KILL PROCESS INITIATED"
             };
-            strcpy(scary_file->content, contents[i]);
-            scary_file->size = strlen(contents[i]);
+            fs_write_content(scary_file, contents[i], strlen(contents[i]));
         }
     }
     
     fs_mark_dirty();
-    fs_save_to_disk();
+    fs_commit();
 }
 
 void nek_see_lum_act(void) {
@@ -4159,17 +3959,26 @@ void nek_see_lum_update(void) {
 
 /* Writer text editor */
 void writer_command(const char* filename) {
-    FSNode* file = fs_find_file(filename);
-    if (!file) {
+    // Файл может лежать и в нижнем слое; сохранение кладёт его в WexFS
+    int fd = fs_open(filename, FS_O_READ);
+    if (fd < 0) {
         prints("Error: File not found: ");
         prints(filename);
         newline();
         return;
     }
     
+    if (fs_lseek(fd, 0, FS_SEEK_END) >= 4096) {
+        fs_close(fd);
+        prints("Error: File too large for writer\n");
+        return;
+    }
+
     char content[4096];  // Увеличили буфер до 4096
-    strcpy(content, file->content);
-    int content_len = strlen(content);
+    int content_len = fs_pread(fd, content, sizeof(content) - 1, 0);
+    fs_close(fd);
+    if (content_len < 0) content_len = 0;
+    content[content_len] = '\0';
     int cursor_pos = content_len;
     
     unsigned char old_color = text_color;
@@ -4350,11 +4159,10 @@ void writer_command(const char* filename) {
     
     // Сохранение файла
     if (save_file) {
-        if (content_len <= sizeof(file->content)) {
-            strcpy(file->content, content);
-            file->size = content_len;
-            fs_mark_dirty();
-            fs_save_to_disk();
+        fd = fs_open(filename, FS_O_WRITE | FS_O_TRUNC);
+        int written = fd >= 0 ? fs_write(fd, content, content_len) : -1;
+        if (fd >= 0) fs_close(fd);
+        if (written == content_len) {
             prints("\nFile saved: ");
             prints(filename);
             
@@ -4648,12 +4456,12 @@ void config_command() {
         // Обработка клавиш как в WexExplorer
         int action = 0;
         while (action == 0) {
-            unsigned char st = inb(0x64);
+            unsigned char st = kbd_status();
             if (st & 1) {
                 unsigned char sc = inb(0x60);
                 
                 if (sc == 0xE0) {
-                    while (!(inb(0x64) & 1));
+                    while (!(kbd_status() & 1));
                     sc = inb(0x60);
                     
                     if (sc == 0x48) { // Up
@@ -4741,7 +4549,7 @@ void watch_command() {
 
     while (1) {
         // Проверка на ESC
-        unsigned char st = inb(0x64);
+        unsigned char st = kbd_status();
         if (st & 1) {
             unsigned char sc = inb(0x60);
             if (sc == 0x01) { // ESC код
@@ -4860,7 +4668,9 @@ void show_help() {
         "time",     "size",     "osver",    "history",  "format",
         "fsck",     "cat",      "explorer", "osinfo",   "autorun",
         "exit",     "pwd",      "find",     "matrix",   "mathgame",
-        "cal",      "rand", NULL
+        "cal",      "rand",     "du",       "grep",     "snapshot", "defrag",
+        "mkfs",     "more",
+        NULL
     };
     
     prints("Available commands:");
@@ -4933,6 +4743,263 @@ void split_args(char* args, char** arg1, char** arg2) {
     }
 }
 
+/* Grep */
+#define GREP_LINE_MAX 512
+#define GREP_PATTERN_MAX 128
+
+#define GREP_IGNORE_CASE 1
+#define GREP_LINE_NUMBERS 2
+#define GREP_COUNT 4
+#define GREP_RECURSIVE 8
+#define GREP_STATS 16
+
+typedef struct {
+    int flags;
+    char pattern[GREP_PATTERN_MAX];
+    int pattern_len;
+    u32 bytes;
+    u32 files;
+    u32 matches;
+} GrepState;
+
+static char grep_fold(char c) {
+    return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+}
+
+// Поиск по словам: четыре байта сравниваются с первым символом образца сразу,
+// полное сравнение только там, где первый символ совпал
+static int grep_search(const char* text, int len, const char* pattern, int pattern_len) {
+    if (pattern_len == 0) return 1;
+    int last = len - pattern_len;
+    if (last < 0) return 0;
+
+    u32 first = (unsigned char)pattern[0] * 0x01010101u;
+    int i = 0;
+    while (i <= last) {
+        if (i + 4 <= last + 1) {
+            u32 word = (unsigned char)text[i] | ((unsigned char)text[i + 1] << 8) |
+                       ((unsigned char)text[i + 2] << 16) | ((u32)(unsigned char)text[i + 3] << 24);
+            u32 x = word ^ first;
+            if (((x - 0x01010101u) & ~x & 0x80808080u) == 0) {
+                i += 4;
+                continue;
+            }
+        }
+        if (text[i] == pattern[0]) {
+            int j = 1;
+            while (j < pattern_len && text[i + j] == pattern[j]) j++;
+            if (j == pattern_len) return 1;
+        }
+        i++;
+    }
+    return 0;
+}
+
+static int grep_line_matches(GrepState* g, char* line, int len) {
+    if (g->flags & GREP_IGNORE_CASE) {
+        char folded[GREP_LINE_MAX];
+        for (int i = 0; i < len; i++) folded[i] = grep_fold(line[i]);
+        return grep_search(folded, len, g->pattern, g->pattern_len);
+    }
+    return grep_search(line, len, g->pattern, g->pattern_len);
+}
+
+static void grep_report(GrepState* g, const char* name, int line_no, char* line, int len) {
+    if (g->flags & GREP_RECURSIVE) {
+        prints(name);
+        putchar(':');
+    }
+    if (g->flags & GREP_LINE_NUMBERS) {
+        char num[12];
+        itoa(line_no, num, 10);
+        prints(num);
+        putchar(':');
+    }
+    for (int i = 0; i < len; i++) putchar(line[i]);
+    newline();
+}
+
+// Файл просматривается страницами вида прямо в кэше блоков и не копируется
+static void grep_file(GrepState* g, const char* path, const char* name) {
+    int fd = fs_open(path, FS_O_READ);
+    int view = fd >= 0 ? fs_mmap(fd, FS_MAP_READ) : -1;
+    if (view < 0) {
+        if (fd >= 0) fs_close(fd);
+        prints("grep: cannot open ");
+        prints(name);
+        newline();
+        return;
+    }
+
+    char line[GREP_LINE_MAX];
+    int line_len = 0;
+    int line_no = 1;
+    int line_hit = 0;              // строка уже найдена в одной из частей
+    int keep = g->pattern_len > 0 ? g->pattern_len - 1 : 0;
+    u32 count = 0;
+    u32 offset = 0;
+    u32 n;
+    char* chunk;
+
+    g->files++;
+    while ((chunk = fs_view_page(view, offset, &n)) != NULL) {
+        g->bytes += n;
+        offset += n;
+        for (u32 i = 0; i < n; i++) {
+            int end_of_line = chunk[i] == '\n';
+            if (!end_of_line) line[line_len++] = chunk[i];
+            if (!end_of_line && line_len < GREP_LINE_MAX) continue;
+
+            // Слишком длинная строка проверяется частями с перекрытием в
+            // pattern_len - 1 байт; найденная строка считается один раз
+            if (!line_hit && grep_line_matches(g, line, line_len)) {
+                line_hit = 1;
+                count++;
+                if (!(g->flags & GREP_COUNT)) grep_report(g, name, line_no, line, line_len);
+            }
+
+            if (end_of_line) {
+                line_len = 0;
+                line_no++;
+                line_hit = 0;
+            } else {
+                memcpy(line, line + line_len - keep, keep);
+                line_len = keep;
+            }
+        }
+    }
+    if (line_len > 0 && !line_hit && grep_line_matches(g, line, line_len)) {
+        count++;
+        if (!(g->flags & GREP_COUNT)) grep_report(g, name, line_no, line, line_len);
+    }
+    fs_munmap(view);
+    fs_close(fd);
+
+    g->matches += count;
+    if (g->flags & GREP_COUNT) {
+        char num[12];
+        if (g->flags & GREP_RECURSIVE) {
+            prints(name);
+            putchar(':');
+        }
+        itoa(count, num, 10);
+        prints(num);
+        newline();
+    }
+}
+
+static void grep_stats(GrepState* g, u64 cycles) {
+    u32 ms = (u32)(cycles >> 10) / fs_tsc_per_ms();
+    if (ms == 0) ms = 1;
+    u32 kb_per_s = (g->bytes >> 10) * 1000 / ms;
+    char num[12];
+
+    prints("-- ");
+    itoa(g->files, num, 10);
+    prints(num);
+    prints(" files, ");
+    itoa(g->bytes, num, 10);
+    prints(num);
+    prints(" bytes, ");
+    itoa(g->matches, num, 10);
+    prints(num);
+    prints(" matches in ");
+    itoa(ms, num, 10);
+    prints(num);
+    prints(" ms (");
+    itoa(kb_per_s / 1024, num, 10);
+    prints(num);
+    putchar('.');
+    u32 frac = (kb_per_s % 1024) * 100 / 1024;
+    if (frac < 10) putchar('0');
+    itoa(frac, num, 10);
+    prints(num);
+    prints(" MB/s)\n");
+}
+
+void grep_command(char* args) {
+    GrepState g;
+    memset(&g, 0, sizeof(g));
+
+    // Опции, затем образец и путь
+    while (*args == '-') {
+        args++;
+        while (*args && *args != ' ') {
+            if (*args == 'i') g.flags |= GREP_IGNORE_CASE;
+            else if (*args == 'n') g.flags |= GREP_LINE_NUMBERS;
+            else if (*args == 'c') g.flags |= GREP_COUNT;
+            else if (*args == 'r') g.flags |= GREP_RECURSIVE;
+            else if (*args == 'v') g.flags |= GREP_STATS;
+            else {
+                prints("grep: unknown option -");
+                putchar(*args);
+                newline();
+                return;
+            }
+            args++;
+        }
+        while (*args == ' ') args++;
+    }
+
+    char* pattern;
+    char* target;
+    split_args(args, &pattern, &target);
+    if (*pattern == '\0' || target == NULL || *target == '\0') {
+        prints("Usage: grep [-i] [-n] [-c] [-r] [-v] <pattern> <file|dir>\n");
+        return;
+    }
+    if (strlen(pattern) >= GREP_PATTERN_MAX) {
+        prints("grep: pattern too long\n");
+        return;
+    }
+
+    strcpy(g.pattern, pattern);
+    g.pattern_len = strlen(pattern);
+    if (g.flags & GREP_IGNORE_CASE) {
+        for (int i = 0; i < g.pattern_len; i++) g.pattern[i] = grep_fold(g.pattern[i]);
+    }
+
+    FSPath path;
+    if (fs_path_resolve(target, &path) != 0) {
+        prints("Error: Path too long: ");
+        prints(target);
+        newline();
+        return;
+    }
+
+    // Файлы ищутся в общем виде WexFS и RAM-тома
+    int type = fs_path_type(&path);
+    if (type < 0) {
+        prints("Error: File not found: ");
+        prints(target);
+        newline();
+        return;
+    }
+
+    u64 start = rdtsc();
+    if (type == 0) {
+        char open_path[MAX_PATH + 1];
+        strcpy(open_path, "/");
+        strcat(open_path, path.text);
+        grep_file(&g, open_path, target);
+    } else if (!(g.flags & GREP_RECURSIVE)) {
+        prints("grep: ");
+        prints(target);
+        prints(" is a directory (use -r)\n");
+        return;
+    } else {
+        char open_path[MAX_PATH + 1];
+        u32 pos = 0;
+        int is_dir;
+        strcpy(open_path, "/");
+        while (fs_tree_next(&path, &pos, open_path + 1, &is_dir)) {
+            if (!is_dir) grep_file(&g, open_path, open_path + 1);
+        }
+    }
+
+    if (g.flags & GREP_STATS) grep_stats(&g, rdtsc() - start);
+}
+
 /* Command parser */
 void run_command(char* line) {
     trim_whitespace(line);
@@ -4972,6 +5039,21 @@ void run_command(char* line) {
     char saved = 0;
     if(*p) { saved = *p; *p = 0; p++; }
     
+    // more <команда>: вывод команды листается по экранам
+    int paged = 0;
+    char* inner = p;
+    while(*inner == ' ') inner++;
+    if(strcasecmp(line, "more") == 0 && *inner) {
+        line = p = inner;
+        while(*p && *p != ' ') p++;
+        saved = 0;
+        if(*p) { saved = *p; *p = 0; p++; }
+        paged = 1;
+        pager_active = 1;
+        pager_scrolled = 0;
+        pager_quit = 0;
+    }
+    
     char command_upper[128];
     strcpy(command_upper, line);
     for(char* c = command_upper; *c; c++) {
@@ -4991,7 +5073,7 @@ void run_command(char* line) {
         else if(strcasecmp(line, "ls") == 0) fs_ls();
         else if(strcasecmp(line, "cal") == 0) calendar_command();
 	else if(strcasecmp(line, "format") == 0) fs_format();
-	else if(strcasecmp(line, "fsck") == 0) fsck_command();
+	else if(strcasecmp(line, "fsck") == 0) { while(*p == ' ') p++; fsck_command(p); }
         else if(strcasecmp(line, "cd") == 0) { while(*p == ' ') p++; if(*p) fs_cd(p); else prints("Usage: cd <directory>\n"); }
         else if(strcasecmp(line, "mkdir") == 0) { while(*p == ' ') p++; if(*p) fs_mkdir(p); else prints("Usage: mkdir <name>\n"); }
         else if(strcasecmp(line, "touch") == 0) { while(*p == ' ') p++; if(*p) fs_touch(p); else prints("Usage: touch <name>\n"); }
@@ -5046,15 +5128,25 @@ else if(strcasecmp(line, "find") == 0) {
     else if(strcasecmp(line, "calc") == 0) { while(*p == ' ') p++; calc_command(p); }
     else if(strcasecmp(line, "time") == 0) time_command();
     else if(strcasecmp(line, "size") == 0) { while(*p == ' ') p++; if(*p) fs_size(p); else prints("Usage: size <filename>\n"); }
+    else if(strcasecmp(line, "du") == 0) { while(*p == ' ') p++; du_command(p); }
+    else if(strcasecmp(line, "snapshot") == 0) { while(*p == ' ') p++; snapshot_command(p); }
+    else if(strcasecmp(line, "defrag") == 0) { while(*p == ' ') p++; defrag_command(p); }
+    else if(strcasecmp(line, "mkfs") == 0) { while(*p == ' ') p++; mkfs_command(p); }
+    else if(strcasecmp(line, "grep") == 0) { while(*p == ' ') p++; grep_command(p); }
     else if(strcasecmp(line, "osver") == 0) osver_command();
     else if(strcasecmp(line, "history") == 0) history_command();
     else if(strcasecmp(line, "watch") == 0) watch_command();
+    else if(strcasecmp(line, "more") == 0) prints("Usage: more <command>\n");
     else {
         prints("Command not found: ");
         prints(line);
         newline();
     }
     
+    if (paged) {
+        pager_active = 0;
+        pager_quit = 0;
+    }
     if(saved) *p = saved;
 }
 
@@ -5062,7 +5154,7 @@ else if(strcasecmp(line, "find") == 0) {
 // Предполагается, что inb уже определена как static inline
 
 unsigned char get_key() {
-    while (!(inb(0x64) & 0x01)); // Wait for data
+    while (!(kbd_status() & 0x01)); // Wait for data
     return inb(0x60); // Read scan code
 }
 
@@ -5152,6 +5244,7 @@ void show_loading_screen(void) {
         
         // Только обновляем анимацию, не перерисовываем весь экран
         draw_loading_animation(frame, progress);
+        vga_flush();
         
         // Задержка для плавной анимации
         for(volatile int i = 0; i < frame_delay; i++);
@@ -5159,6 +5252,7 @@ void show_loading_screen(void) {
     
     // Финальный прогресс 100%
     draw_loading_animation(total_frames, 100);
+    vga_flush();
     
     // Короткая пауза перед переходом
     for(volatile int i = 0; i < 1500000; i++);
@@ -5261,13 +5355,63 @@ void draw_loading_animation(int frame, int progress) {
     prints("Initializing system components");
 }
 
+/* Boot information */
+// Запоминает объём памяти и монтирует SystemRoot из модуля загрузчика.
+// Архив остаётся там, куда его положил GRUB, и не копируется.
+static void boot_read_info(u32 magic, const multiboot_info_t* info) {
+    if (magic != MULTIBOOT_BOOT_MAGIC || info == NULL) return;
+    if (info->flags & MULTIBOOT_INFO_MEMORY) boot_memory_kb = info->mem_upper + 1024;
+    if (!(info->flags & MULTIBOOT_INFO_MODS)) return;
+
+    const multiboot_module_t* mods = (const multiboot_module_t*)info->mods_addr;
+    for (u32 i = 0; i < info->mods_count; i++) {
+        int entries = fs_ram_mount((const void*)mods[i].mod_start, mods[i].mod_end - mods[i].mod_start);
+        if (entries >= 0) {
+            boot_systemroot_entries = entries;
+            return;
+        }
+    }
+}
+
+/* Kernel entry
+ * GRUB jumps to _start with the multiboot magic in EAX, the info address in
+ * EBX and no stack of ours. Both registers are passed on before any C code
+ * can touch them. */
+__asm__(
+    ".section .bss\n"
+    ".align 16\n"
+    "boot_stack:\n"
+    "    .skip 0x20000\n"                   // кадры некоторых команд больше 32 КБ
+    "boot_stack_top:\n"
+    ".text\n"
+    ".global _start\n"
+    "_start:\n"
+    "    mov $boot_stack_top, %esp\n"
+    "    sub $8, %esp\n"                    // к вызову стек выровнен на 16
+    "    push %ebx\n"
+    "    push %eax\n"
+    "    call kernel_main\n"
+    "1:  cli\n"
+    "    hlt\n"
+    "    jmp 1b\n"
+);
+
 /* Kernel main */
-void _start() {
+void kernel_main(u32 magic, const multiboot_info_t* info) {
+    boot_read_info(magic, info);
+
     text_color = 0x07;
 
     show_loading_screen();
     clear_screen();
     fs_init();
+    if (boot_systemroot_entries >= 0) {
+        char num[12];
+        itoa(boot_systemroot_entries, num, 10);
+        prints("SystemRoot: ");
+        prints(num);
+        prints(" entries mounted from boot module\n");
+    }
     nek_see_lum_files();
     init_processes();
     
@@ -5277,6 +5421,7 @@ void _start() {
     
     if (!check_login()) {
         prints("Login failed. System halted.\n");
+        vga_flush();
         while(1) { __asm__ volatile("hlt"); }
     }
     
@@ -5296,6 +5441,8 @@ void _start() {
 
         while (1) {
             nek_see_lum_update();
+            fs_fsck_tick();
+            fs_defrag_tick();
             
             char c = getch_with_arrows();
 
@@ -1,18 +1,9 @@
 #include <stdint.h>
+#include "wexfs.h"
 
 #define MULTIBOOT_MAGIC 0x1BADB002
 #define MULTIBOOT_FLAGS 0
 
-typedef unsigned int u32;
-typedef unsigned short u16;
-typedef unsigned char u8;
-
-#define NULL ((void*)0)
-#define MAX_NAME 256
-#define MAX_PATH 1024
-#define SECTOR_SIZE 512
-#define FS_SECTOR_START 1
-#define MAX_FILES 64
 #define MAX_HISTORY 10
 
 #define BLACK 0x000000
@@ -29,6 +20,7 @@ typedef unsigned char u8;
 /* Function prototypes */
 void itoa(int value, char* str, int base);
 void putchar(char ch);
+void vga_flush(void);
 char keyboard_getchar();
 void reboot_system();
 void shutdown_system();
@@ -63,8 +55,8 @@ void fs_cd(const char* name);
 void fs_copy(const char* src_name, const char* dest_name);
 void fs_size(const char* name);
 void fs_format(void);
-void fs_check_integrity(void);
-void fsck_command(void);
+int fs_check_integrity(void);
+void fsck_command(const char* args);
 void fs_cat(const char* filename);
 void run_command(char* line);
 void trim_whitespace(char* str);
@@ -87,9 +79,18 @@ multiboot_header_t multiboot_header __attribute__((section(".multiboot"))) = {
     -(MULTIBOOT_MAGIC + MULTIBOOT_FLAGS)
 };
 
-/* VGA text buffer */
-volatile unsigned short* VGA = (unsigned short*)0xB8000;
+/* VGA text buffer
+ * As in the kernel: drawing goes to a RAM copy, vga_flush() writes the
+ * changed span of every row to text memory. */
 enum { ROWS=25, COLS=80 };
+#define VGA_TEXT ((volatile u32*)0xB8000)
+#define VGA_FLUSH_CYCLES (1u << 24)
+typedef u32 __attribute__((may_alias)) vga_pair;
+static unsigned short vga_shadow[ROWS * COLS];
+static unsigned short vga_front[ROWS * COLS];
+static int vga_front_valid = 0;
+static u32 vga_flush_stamp = 0;
+unsigned short* VGA = vga_shadow;
 static unsigned int cursor_row=0, cursor_col=0;
 static unsigned char text_color=0x07;
 
@@ -107,6 +108,18 @@ static inline u16 inw(unsigned short port) {
     __asm__ volatile("inw %1,%0" : "=a"(r) : "Nd"(port));
     return r;
 }
+
+static inline u64 rdtsc(void) {
+    u32 lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((u64)hi << 32) | lo;
+}
+
+// Перед ожиданием клавиши экран догоняет теневой буфер
+static inline unsigned char kbd_status(void) {
+    vga_flush();
+    return inb(0x64);
+}
 static inline void outw(unsigned short port, u16 val) {
     __asm__ volatile("outw %0,%1" : : "a"(val), "Nd"(port));
 }
@@ -121,19 +134,6 @@ static inline void outw(unsigned short port, u16 val) {
 #define ATA_STATUS 0x1F7
 #define ATA_CMD 0x1F7
 
-typedef struct { 
-    char name[MAX_PATH];
-    int is_dir; 
-    char content[4096];  // Увеличил до 4096 байт
-    u32 next_sector;
-    u32 size;
-} FSNode;
-
-FSNode fs_cache[MAX_FILES];
-int fs_count = 0;
-char current_dir[MAX_PATH] = "/";
-int fs_dirty = 0;
-
 /* Command history */
 char command_history[MAX_HISTORY][128];
 
@@ -197,235 +197,16 @@ void memset(void* ptr, int value, int num) {
     }
 }
 
-/* Filesystem functions */
-void fs_load_from_disk() {
-    u8 sector_buffer[SECTOR_SIZE];
-    u32 sector = FS_SECTOR_START;
-    fs_count = 0;
-    fs_dirty = 0;
-
-    #define SECTORS_PER_NODE 11
-
-    while (sector != 0 && fs_count < MAX_FILES) {
-        u8* node_data = (u8*)&fs_cache[fs_count];
-        
-        for (int j = 0; j < SECTORS_PER_NODE; j++) {
-            ata_read_sector(sector + j, sector_buffer);
-            int offset = j * SECTOR_SIZE;
-            if (offset < sizeof(FSNode)) {
-                memcpy(node_data + offset, sector_buffer, SECTOR_SIZE);
-            }
-        }
-        
-        sector = fs_cache[fs_count].next_sector;
-        fs_count++;
-    }
-
-    if (fs_count == 0) {
-        strcpy(fs_cache[0].name, "/");
-        fs_cache[0].is_dir = 1;
-        fs_cache[0].content[0] = '\0';
-        fs_cache[0].next_sector = 0;
-        fs_cache[0].size = 0;
-        fs_count = 1;
-        fs_dirty = 1;
-        fs_save_to_disk();
-    }
-}
-
-void fs_save_to_disk() {
-    if (!fs_dirty) return;
-
-    u8 sector_buffer[SECTOR_SIZE];
-    u32 sector = FS_SECTOR_START;
-
-    // Теперь структура FSNode занимает примерно 4096 + 1024 + 4 + 4 = 5128 байт
-    // 5128 / 512 = 10.01 → 11 секторов на узел
-    #define SECTORS_PER_NODE 11
-
-    for (int i = 0; i < fs_count; i++) {
-        u8* node_data = (u8*)&fs_cache[i];
-        
-        for (int j = 0; j < SECTORS_PER_NODE; j++) {
-            int offset = j * SECTOR_SIZE;
-            if (offset < sizeof(FSNode)) {
-                memcpy(sector_buffer, node_data + offset, SECTOR_SIZE);
-            } else {
-                memset(sector_buffer, 0, SECTOR_SIZE);
-            }
-            ata_write_sector(sector + j, sector_buffer);
-        }
-        
-        sector = (i == fs_count - 1) ? 0 : FS_SECTOR_START + (i + 1) * SECTORS_PER_NODE;
-        if (i < fs_count - 1) {
-            fs_cache[i].next_sector = sector;
-        } else {
-            fs_cache[i].next_sector = 0;
-        }
-    }
-
-    fs_dirty = 0;
-}
-
-void fs_mark_dirty() {
-    fs_dirty = 1;
-}
-
-void fs_init() {
-    fs_load_from_disk();
-    strcpy(current_dir, "/");
-}
-
-void fs_ls() {
-    prints("Contents of ");
-    prints(current_dir);
-    prints(":\n");
-
-    for (int i = 0; i < fs_count; i++) {
-        if (strcmp(current_dir, "/") == 0) {
-            char* slash = strchr(fs_cache[i].name, '/');
-            if (slash == NULL || slash == fs_cache[i].name) {
-                prints(fs_cache[i].name);
-                if (fs_cache[i].is_dir) prints("/");
-                newline();
-            }
-        } else {
-            if (strstr(fs_cache[i].name, current_dir) == fs_cache[i].name) {
-                char* name_part = fs_cache[i].name + strlen(current_dir);
-                if (*name_part != '\0' && strchr(name_part, '/') == NULL) {
-                    prints(name_part);
-                    if (fs_cache[i].is_dir) prints("/");
-                    newline();
-                }
-            }
-        }
-    }
-}
-
-void fs_mkdir(const char* name) {
-    if (fs_count >= MAX_FILES) {
-        prints("Error: Maximum files reached\n");
-        return;
-    }
-
-    char full_path[MAX_PATH];
-    if (strcmp(current_dir, "/") == 0) {
-        if (strlen(name) >= MAX_NAME) {
-            prints("Error: Name too long: ");
-            prints(name);
-            newline();
-            return;
-        }
-        strcpy(full_path, name);
-    } else {
-        if (strlen(current_dir) + strlen(name) + 1 >= MAX_PATH) {
-            prints("Error: Path too long: ");
-            prints(name);
-            newline();
-            return;
-        }
-        strcpy(full_path, current_dir);
-        strcat(full_path, name);
-    }
-
-    for (int i = 0; i < fs_count; i++) {
-        if (strcmp(fs_cache[i].name, full_path) == 0) {
-            prints("Error: Name already exists: ");
-            prints(name);
-            newline();
-            return;
-        }
-    }
-
-    strcpy(fs_cache[fs_count].name, full_path);
-    fs_cache[fs_count].is_dir = 1;
-    fs_cache[fs_count].content[0] = '\0';
-    fs_cache[fs_count].next_sector = 0;
-    fs_cache[fs_count].size = 0;
-    fs_count++;
-    fs_mark_dirty();
-    fs_save_to_disk();
-    prints("Directory '");
-    prints(name);
-    prints("' created\n");
-}
-
-void fs_touch(const char* name) {
-    if (fs_count >= MAX_FILES) {
-        prints("Error: Maximum files reached\n");
-        return;
-    }
-
-    char full_path[MAX_PATH];
-    if (strcmp(current_dir, "/") == 0) {
-        if (strlen(name) >= MAX_NAME) {
-            prints("Error: Name too long: ");
-            prints(name);
-            newline();
-            return;
-        }
-        strcpy(full_path, name);
-    } else {
-        if (strlen(current_dir) + strlen(name) + 1 >= MAX_PATH) {
-            prints("Error: Path too long: ");
-            prints(name);
-            newline();
-            return;
-        }
-        strcpy(full_path, current_dir);
-        strcat(full_path, name);
-    }
-
-    for (int i = 0; i < fs_count; i++) {
-        if (strcmp(fs_cache[i].name, full_path) == 0) {
-            prints("Error: Name already exists: ");
-            prints(name);
-            newline();
-            return;
-        }
-    }
-
-    strcpy(fs_cache[fs_count].name, full_path);
-    fs_cache[fs_count].is_dir = 0;
-    fs_cache[fs_count].content[0] = '\0';
-    fs_cache[fs_count].next_sector = 0;
-    fs_cache[fs_count].size = 0;
-    fs_count++;
-    fs_mark_dirty();
-    fs_save_to_disk();
-    prints("File '");
-    prints(name);
-    prints("' created\n");
-}
-
 void fs_rm(const char* name) {
-    char full_path[MAX_PATH];
-    if (strcmp(current_dir, "/") == 0) {
-        if (strlen(name) >= MAX_NAME) {
-            prints("Error: Name too long: ");
-            prints(name);
-            newline();
-            return;
-        }
-        strcpy(full_path, name);
-    } else {
-        if (strlen(current_dir) + strlen(name) + 1 >= MAX_PATH) {
-            prints("Error: Path too long: ");
-            prints(name);
-            newline();
-            return;
-        }
-        strcpy(full_path, current_dir);
-        strcat(full_path, name);
+    FSPath path;
+    if (fs_path_resolve(name, &path) != 0) {
+        prints("Error: Path too long: ");
+        prints(name);
+        newline();
+        return;
     }
 
-    int found = -1;
-    for (int i = 0; i < fs_count; i++) {
-        if (strcmp(fs_cache[i].name, full_path) == 0) {
-            found = i;
-            break;
-        }
-    }
+    int found = fs_path_find(&path);
 
     if (found == -1) {
         prints("Error: File or directory not found: ");
@@ -435,31 +216,19 @@ void fs_rm(const char* name) {
     }
 
     if (fs_cache[found].is_dir) {
-        char dir_path[MAX_PATH];
-        strcpy(dir_path, full_path);
-        if (strcmp(full_path, "/") != 0) {
-            if (strlen(dir_path) + 1 >= MAX_PATH) {
-                prints("Error: Directory path too long\n");
-                return;
-            }
-            strcat(dir_path, "/");
-        }
+        // Содержимое отмечается заранее: удаление директории отвязывает её детей
+        u8 doomed[MAX_FILES];
+        for (int i = 0; i < fs_count; i++) doomed[i] = fs_node_under(&fs_cache[i], &fs_cache[found]);
 
         for (int i = fs_count - 1; i >= 0; i--) {
-            if (i != found && strstr(fs_cache[i].name, dir_path) == fs_cache[i].name) {
-                for (int j = i; j < fs_count - 1; j++) {
-                    fs_cache[j] = fs_cache[j + 1];
-                }
-                fs_count--;
+            if (doomed[i]) {
+                fs_node_remove(i);
+                if (i < found) found--;
             }
         }
     }
 
-    for (int i = found; i < fs_count - 1; i++) {
-        fs_cache[i] = fs_cache[i + 1];
-    }
-    fs_count--;
-    fs_mark_dirty();
+    fs_node_remove(found);
     fs_save_to_disk();
 
     prints("'");
@@ -467,224 +236,6 @@ void fs_rm(const char* name) {
     prints("' removed\n");
 }
 
-void fs_cd(const char* name) {
-    if (strcmp(name, "..") == 0) {
-        if (strcmp(current_dir, "/") != 0) {
-            char* last_slash = strrchr(current_dir, '/');
-            if (last_slash != NULL) {
-                *last_slash = '\0';
-                if (current_dir[0] == '\0') {
-                    strcpy(current_dir, "/");
-                }
-            }
-        }
-    } else if (strcmp(name, "/") == 0) {
-        strcpy(current_dir, "/");
-    } else {
-        char full_path[MAX_PATH];
-        if (strcmp(current_dir, "/") == 0) {
-            if (strlen(name) >= MAX_NAME) {
-                prints("Error: Name too long: ");
-                prints(name);
-                newline();
-                return;
-            }
-            strcpy(full_path, name);
-        } else {
-            if (strlen(current_dir) + strlen(name) + 1 >= MAX_PATH) {
-                prints("Error: Path too long: ");
-                prints(name);
-                newline();
-                return;
-            }
-            strcpy(full_path, current_dir);
-            strcat(full_path, name);
-        }
-
-        int found = 0;
-        for (int i = 0; i < fs_count; i++) {
-            if (strcmp(fs_cache[i].name, full_path) == 0 && fs_cache[i].is_dir) {
-                strcpy(current_dir, full_path);
-                if (strcmp(full_path, "/") != 0) {
-                    strcat(current_dir, "/");
-                }
-                found = 1;
-                break;
-            }
-        }
-
-        if (!found) {
-            prints("Error: Directory not found: ");
-            prints(name);
-            newline();
-        }
-    }
-}
-
-FSNode* fs_find_file(const char* name) {
-    char full_path[MAX_PATH];
-    if (strcmp(current_dir, "/") == 0) {
-        if (strlen(name) >= MAX_NAME) {
-            prints("Error: Name too long: ");
-            prints(name);
-            newline();
-            return NULL;
-        }
-        strcpy(full_path, name);
-    } else {
-        if (strlen(current_dir) + strlen(name) + 1 >= MAX_PATH) {
-            prints("Error: Path too long: ");
-            prints(name);
-            newline();
-            return NULL;
-        }
-        strcpy(full_path, current_dir);
-        strcat(full_path, name);
-    }
-
-    for (int i = 0; i < fs_count; i++) {
-        if (strcmp(fs_cache[i].name, full_path) == 0 && !fs_cache[i].is_dir) {
-            return &fs_cache[i];
-        }
-    }
-    return NULL;
-}
-
-void fs_copy(const char* src_name, const char* dest_name) {
-    char src_path[MAX_PATH];
-    if (strcmp(current_dir, "/") == 0) {
-        if (strlen(src_name) >= MAX_NAME) {
-            prints("Error: Source name too long: ");
-            prints(src_name);
-            newline();
-            return;
-        }
-        strcpy(src_path, src_name);
-    } else {
-        if (strlen(current_dir) + strlen(src_name) + 1 >= MAX_PATH) {
-            prints("Error: Source path too long: ");
-            prints(src_name);
-            newline();
-            return;
-        }
-        strcpy(src_path, current_dir);
-        strcat(src_path, src_name);
-    }
-
-    FSNode* src = NULL;
-    for (int i = 0; i < fs_count; i++) {
-        if (strcmp(fs_cache[i].name, src_path) == 0 && !fs_cache[i].is_dir) {
-            src = &fs_cache[i];
-            break;
-        }
-    }
-
-    if (!src) {
-        prints("Error: Source file not found: ");
-        prints(src_name);
-        newline();
-        return;
-    }
-
-    if (fs_count >= MAX_FILES) {
-        prints("Error: Maximum files reached\n");
-        return;
-    }
-
-    char full_path[MAX_PATH];
-    if (strcmp(current_dir, "/") == 0) {
-        if (strlen(dest_name) >= MAX_NAME) {
-            prints("Error: Destination name too long: ");
-            prints(dest_name);
-            newline();
-            return;
-        }
-        strcpy(full_path, dest_name);
-    } else {
-        if (strlen(current_dir) + strlen(dest_name) + 1 >= MAX_PATH) {
-            prints("Error: Destination path too long: ");
-            prints(dest_name);
-            newline();
-            return;
-        }
-        strcpy(full_path, current_dir);
-        strcat(full_path, dest_name);
-    }
-
-    strcpy(fs_cache[fs_count].name, full_path);
-    fs_cache[fs_count].is_dir = 0;
-    strcpy(fs_cache[fs_count].content, src->content);
-    fs_cache[fs_count].next_sector = 0;
-    fs_cache[fs_count].size = src->size;
-    fs_count++;
-    fs_mark_dirty();
-    fs_save_to_disk();
-    prints("File copied to '");
-    prints(dest_name);
-    prints("'\n");
-}
-
-int folder_size(const char* folder_path) {
-    int total = 0;
-    char path_with_slash[MAX_PATH];
-    strcpy(path_with_slash, folder_path);
-    if (folder_path[strlen(folder_path) - 1] != '/') {
-        strcat(path_with_slash, "/");
-    }
-
-    for (int i = 0; i < fs_count; i++) {
-        FSNode* node = &fs_cache[i];
-        if (!node->is_dir && strstr(node->name, path_with_slash) == node->name) {
-            total += node->size;
-        }
-    }
-    return total;
-}
-
-void fs_size(const char* name) {
-    FSNode* node = NULL;
-    for (int i = 0; i < fs_count; i++) {
-        if (strcmp(fs_cache[i].name, name) == 0) {
-            node = &fs_cache[i];
-            break;
-        }
-    }
-
-    if (!node) {
-        prints("Error: File or folder not found: ");
-        prints(name);
-        newline();
-        return;
-    }
-
-    int size;
-    if (node->is_dir) {
-        size = folder_size(node->name);
-        prints("Folder size: ");
-    } else {
-        size = node->size;
-        prints("File size: ");
-    }
-
-    char size_str[16];
-    itoa(size, size_str, 10);
-    prints(size_str);
-    prints(" Bytes\n");
-}
-
-void find_command(const char* pattern) {
-    prints("Searching for: ");
-    prints(pattern);
-    newline();
-    for(int i = 0; i < fs_count; i++) {
-        if(strstr(fs_cache[i].name, pattern) != NULL) {
-            prints(fs_cache[i].name);
-            if(fs_cache[i].is_dir) prints("/");
-            newline();
-        }
-    }
-}
-
 void pwd_command() { 
     prints(current_dir); 
     newline(); 
@@ -699,18 +250,14 @@ void fs_format(void) {
     newline();
     
     if (confirm == 'y' || confirm == 'Y') {
+        prints("Enable compression? (y/N): ");
+        char compress = keyboard_getchar();
+        putchar(compress);
+        newline();
+
         prints("Formatting filesystem...\n");
         
-        fs_count = 1;
-        strcpy(fs_cache[0].name, "/");
-        fs_cache[0].is_dir = 1;
-        fs_cache[0].content[0] = '\0';
-        fs_cache[0].next_sector = 0;
-        fs_cache[0].size = 0;
-        
-        strcpy(current_dir, "/");
-        
-        fs_mark_dirty();
+        fs_reset((compress == 'y' || compress == 'Y') ? FS_FEATURE_LZ : 0);
         fs_save_to_disk();
         
         prints("Filesystem formatted successfully.\n");
@@ -719,156 +266,6 @@ void fs_format(void) {
     }
 }
 
-/* Function implementations */
-void fs_check_integrity(void) {
-    prints("Checking filesystem integrity...\n");
-    prints("Filesystem: WexFS\n");
-    prints("Version: 1.0\n");
-    prints("======================================\n");
-    
-    int errors_found = 0;
-    int warnings_found = 0;
-    
-    // Проверка на дубликаты
-    prints("Phase 1: Checking for duplicates...\n");
-    for (int i = 0; i < fs_count; i++) {
-        for (int j = i + 1; j < fs_count; j++) {
-            if (strcmp(fs_cache[i].name, fs_cache[j].name) == 0) {
-                prints("ERROR: Duplicate filename: ");
-                prints(fs_cache[i].name);
-                newline();
-                errors_found++;
-            }
-        }
-    }
-    
-    // Проверка размера контента
-    prints("Phase 2: Checking file sizes...\n");
-    for (int i = 0; i < fs_count; i++) {
-        if (!fs_cache[i].is_dir) {
-            if (fs_cache[i].size > sizeof(fs_cache[i].content)) {
-                prints("ERROR: File size exceeds content buffer: ");
-                prints(fs_cache[i].name);
-                newline();
-                prints("  File size: ");
-                char size_str[20];
-                itoa(fs_cache[i].size, size_str, 10);
-                prints(size_str);
-                prints(", Max allowed: ");
-                itoa(sizeof(fs_cache[i].content), size_str, 10);
-                prints(size_str);
-                newline();
-                errors_found++;
-            }
-        }
-    }
-    
-    // Проверка максимального количества файлов
-    prints("Phase 3: Checking filesystem limits...\n");
-    if (fs_count >= MAX_FILES) {
-        prints("WARNING: Filesystem at maximum capacity (");
-        char max_str[10];
-        itoa(MAX_FILES, max_str, 10);
-        prints(max_str);
-        prints(" files)\n");
-        warnings_found++;
-    }
-    
-    // Статистика
-    prints("Phase 4: Generating statistics...\n");
-    int total_files = 0;
-    int total_dirs = 0;
-    
-    for (int i = 0; i < fs_count; i++) {
-        if (fs_cache[i].is_dir) {
-            total_dirs++;
-        } else {
-            total_files++;
-        }
-    }
-    
-    prints("======================================\n");
-    prints("Filesystem check completed.\n");
-    
-    char buf[20];
-    itoa(total_files, buf, 10);
-    prints("Files: "); prints(buf); newline();
-    itoa(total_dirs, buf, 10);
-    prints("Directories: "); prints(buf); newline();
-    itoa(fs_count, buf, 10);
-    prints("Total objects: "); prints(buf); newline();
-    itoa(MAX_FILES - fs_count, buf, 10);
-    prints("Free slots: "); prints(buf); newline();
-    
-    if (errors_found > 0) {
-        itoa(errors_found, buf, 10);
-        prints("Errors found: "); prints(buf); newline();
-        prints("Run 'format' to fix filesystem errors.\n");
-    } else {
-        prints("No errors found.\n");
-    }
-    
-    if (warnings_found > 0) {
-        itoa(warnings_found, buf, 10);
-        prints("Warnings: "); prints(buf); newline();
-    }
-    
-    prints("Filesystem is ");
-    if (errors_found == 0) {
-        prints("OK");
-    } else {
-        prints("CORRUPTED");
-    }
-    prints(".\n");
-}
-void fsck_command(void) {
-    prints("Filesystem Consistency Check\n");
-    prints("============================\n");
-    prints("This utility will check WexFS filesystem for errors\n");
-    prints("and report any inconsistencies.\n\n");
-    
-    prints("Continue? (y/N): ");
-    
-    char confirm = keyboard_getchar();
-    putchar(confirm);
-    newline();
-    
-    if (confirm == 'y' || confirm == 'Y') {
-        fs_check_integrity();
-    } else {
-        prints("Operation cancelled.\n");
-    }
-}
-
-void fs_cat(const char* filename) {
-    if (filename == NULL || strlen(filename) == 0) {
-        prints("Usage: cat <filename>\n");
-        return;
-    }
-
-    FSNode* file = fs_find_file(filename);
-    if (!file) {
-        prints("Error: File not found: ");
-        prints(filename);
-        newline();
-        return;
-    }
-
-    if (file->is_dir) {
-        prints("Error: '");
-        prints(filename);
-        prints("' is a directory\n");
-        return;
-    }
-
-    if (file->size > 0) {
-        prints(file->content);
-        newline();
-    } else {
-        prints("File is empty\n");
-    }
-}
-
 /* String functions */
 void memcpy(void* dst, void* src, int len) {
     char* d = (char*)dst;
@@ -952,6 +349,36 @@ void itoa(int value, char* str, int base) {
 }
 
 /* VGA output */
+void vga_flush(void) {
+    const vga_pair* back = (const vga_pair*)vga_shadow;
+    vga_pair* front = (vga_pair*)vga_front;
+
+    for (int r = 0; r < ROWS; r++) {
+        int row = r * COLS / 2;
+        int first = 0, last = COLS / 2 - 1;
+        if (vga_front_valid) {
+            while (first <= last && back[row + first] == front[row + first]) first++;
+            if (first > last) continue;
+            while (back[row + last] == front[row + last]) last--;
+        }
+        for (int i = first; i <= last; i++) {
+            front[row + i] = back[row + i];
+            VGA_TEXT[row + i] = back[row + i];
+        }
+    }
+    vga_front_valid = 1;
+    vga_flush_stamp = (u32)rdtsc();
+}
+
+static void vga_scroll(void) {
+    vga_pair* cells = (vga_pair*)VGA;
+    unsigned short blank = (unsigned short)(' ' | (text_color << 8));
+
+    for (int i = 0; i < (ROWS - 1) * COLS / 2; i++) cells[i] = cells[i + COLS / 2];
+    for (int c = 0; c < COLS; c++) VGA[(ROWS-1) * COLS + c] = blank;
+    cursor_row = ROWS-1;
+}
+
 void clear_screen() {
     for(int r = 0; r < ROWS; r++)
         for(int c = 0; c < COLS; c++)
@@ -964,36 +391,18 @@ void putchar(char ch) {
     if(ch == '\n') {
         cursor_col = 0;
         cursor_row++;
-        if(cursor_row >= ROWS) {
-            for(int r = 0; r < ROWS-1; r++) {
-                for(int c = 0; c < COLS; c++) {
-                    VGA[r * COLS + c] = VGA[(r+1) * COLS + c];
-                }
-            }
-            for(int c = 0; c < COLS; c++) {
-                VGA[(ROWS-1) * COLS + c] = (unsigned short)(' ' | (text_color << 8));
-            }
-            cursor_row = ROWS-1;
-        }
-        return;
-    }
-    VGA[cursor_row * COLS + cursor_col] = (unsigned short)(ch | (text_color << 8));
-    cursor_col++;
-    if(cursor_col >= COLS) {
-        cursor_col = 0;
-        cursor_row++;
-        if(cursor_row >= ROWS) {
-            for(int r = 0; r < ROWS-1; r++) {
-                for(int c = 0; c < COLS; c++) {
-                    VGA[r * COLS + c] = VGA[(r+1) * COLS + c];
-                }
-            }
-            for(int c = 0; c < COLS; c++) {
-                VGA[(ROWS-1) * COLS + c] = (unsigned short)(' ' | (text_color << 8));
-            }
-            cursor_row = ROWS-1;
+        if(cursor_row >= ROWS) vga_scroll();
+    } else {
+        VGA[cursor_row * COLS + cursor_col] = (unsigned short)(ch | (text_color << 8));
+        cursor_col++;
+        if(cursor_col >= COLS) {
+            cursor_col = 0;
+            cursor_row++;
+            if(cursor_row >= ROWS) vga_scroll();
         }
     }
+
+    if ((u32)rdtsc() - vga_flush_stamp > VGA_FLUSH_CYCLES) vga_flush();
 }
 
 void prints(const char* s) {
@@ -1006,6 +415,7 @@ void newline() {
 
 /* Delay function */
 void delay(int seconds) {
+    vga_flush();
     for (volatile int i = 0; i < seconds * 10000000; i++);
 }
 
@@ -1014,7 +424,7 @@ static unsigned char shift_pressed = 0;
 
 char keyboard_getchar() {
     while(1) {
-        unsigned char st = inb(0x64);
+        unsigned char st = kbd_status();
         if(st & 1) {
             unsigned char sc = inb(0x60);
             if ((sc & 0x80) != 0) {
@@ -1051,7 +461,7 @@ char keyboard_getchar() {
 char getch_with_arrows() {
     static unsigned char extended = 0;
     while(1) {
-        unsigned char st = inb(0x64);
+        unsigned char st = kbd_status();
         if (st & 1) {
             unsigned char sc = inb(0x60);
             if ((sc & 0x80) != 0) {
@@ -1099,12 +509,14 @@ char getch_with_arrows() {
 /* System commands */
 void reboot_system() {
     prints("Rebooting...\n");
+    vga_flush();
     outb(0x64, 0xFE);
     while(1) { __asm__ volatile("hlt"); }
 }
 
 void shutdown_system() {
     prints("Shutdown...\n");
+    vga_flush();
     outw(0x604, 0x2000);
     outw(0xB004, 0x2000);
     outw(0x4004, 0x3400);
@@ -1146,7 +558,7 @@ void draw_text(int x, int y, char* text, int color) {
 }
 
 unsigned char get_key() {
-    while (!(inb(0x64) & 0x01));
+    while (!(kbd_status() & 0x01));
     return inb(0x60);
 }
 
@@ -1224,7 +636,9 @@ void show_help() {
         "touch",    "copy",       "cat",      "fsck",
         "format",   "size",       "history",  "exit",
         "writer",   "removepass", "drivers",  "pwd",
-        "find", NULL
+        "find",     "du",         "snapshot", "defrag",
+        "mkfs",     "migrate",
+        NULL
     };
     
     prints("Recovery Mode Commands:\n");
@@ -1293,9 +707,15 @@ void writer_command(const char* filename) {
         return;
     }
     
+    if (file->size >= 4096) {
+        prints("Error: File too large for writer\n");
+        return;
+    }
+
     char content[4096];  // Увеличили буфер до 4096
-    strcpy(content, file->content);
-    int content_len = strlen(content);
+    int content_len = fs_node_pread(file, content, file->size, 0);
+    if (content_len < 0) content_len = 0;
+    content[content_len] = '\0';
     int cursor_pos = content_len;
     
     unsigned char old_color = text_color;
@@ -1476,10 +896,7 @@ void writer_command(const char* filename) {
     
     // Сохранение файла
     if (save_file) {
-        if (content_len <= sizeof(file->content)) {
-            strcpy(file->content, content);
-            file->size = content_len;
-            fs_mark_dirty();
+        if (fs_write_content(file, content, content_len) == 0) {
             fs_save_to_disk();
             prints("\nFile saved: ");
             prints(filename);
@@ -1532,7 +949,7 @@ void run_command(char* line) {
     else if(strcasecmp(line, "clear") == 0) clear_screen();
     else if(strcasecmp(line, "ls") == 0) fs_ls();
     else if(strcasecmp(line, "format") == 0) fs_format();
-    else if(strcasecmp(line, "fsck") == 0) fsck_command();
+    else if(strcasecmp(line, "fsck") == 0) { while(*p == ' ') p++; fsck_command(p); }
 	else if(strcasecmp(line, "drivers") == 0) info_sys();
 	else if(strcasecmp(line, "removepass") == 0) recovery_pass();
 	else if(strcasecmp(line, "writer") == 0) { while(*p == ' ') p++; if(*p) writer_command(p); else prints("Usage: writer <filename>\n"); }
@@ -1563,6 +980,11 @@ else if(strcasecmp(line, "find") == 0) {
         }
     }
     else if(strcasecmp(line, "size") == 0) { while(*p == ' ') p++; if(*p) fs_size(p); else prints("Usage: size <filename>\n"); }
+    else if(strcasecmp(line, "du") == 0) { while(*p == ' ') p++; du_command(p); }
+    else if(strcasecmp(line, "snapshot") == 0) { while(*p == ' ') p++; snapshot_command(p); }
+    else if(strcasecmp(line, "defrag") == 0) { while(*p == ' ') p++; defrag_command(p); }
+    else if(strcasecmp(line, "mkfs") == 0) { while(*p == ' ') p++; mkfs_command(p); }
+    else if(strcasecmp(line, "migrate") == 0) { while(*p == ' ') p++; migrate_command(p); }
     else if(strcasecmp(line, "history") == 0) history_command();
     else if(strcasecmp(line, "exit") == 0) { prints("Use 'reboot' or 'shutdown' to exit\n"); }
     else {
@@ -1626,6 +1048,8 @@ prints("And it knows you're here.\n");
         while (1) {
             cursor_row = cursor_row;
             cursor_col = cursor_col;
+            fs_fsck_tick();
+            fs_defrag_tick();
 
             char c = getch_with_arrows();
 
@@ -0,0 +1,4477 @@
+#include "wexfs.h"
+
+FSNode fs_cache[MAX_FILES];
+u32 fs_node_maps[MAX_FILES][FS_NODE_BLOCKS];   // карты блоков по слотам
+int fs_count = 0;
+char current_dir[MAX_PATH] = "/";
+int fs_dirty = 0;
+
+/* Data block reference counts (rebuilt from the node table on mount) */
+u16 fs_block_refs[FS_MAX_BLOCKS];
+static u32 fs_alloc_hint = 0;
+
+/* Bumped on every metadata change; background fsck restarts when it moves */
+static u32 fs_generation = 0;
+static int fs_txn_depth = 0;               // вложенность fs_begin()
+static int fs_foreign = 0;                 // на диске не наш том, писать нельзя
+
+/* Write-back cache of data blocks; files are never loaded as a whole */
+typedef struct {
+    u32 block;
+    u32 stamp;
+    int dirty;
+    char* data;
+    u16 pins;                      // страницы видов, держащие буфер
+    u16 write_pins;                // из них открытые на запись
+} FSCacheEntry;
+
+static FSCacheEntry fs_bcache[FS_CACHE_BLOCKS];
+static char fs_bcache_pool[FS_CACHE_BYTES];
+static int fs_bcache_count = FS_CACHE_BLOCKS;
+static u32 fs_bcache_clock = 0;
+static int fs_bcache_pinned = 0;
+
+/* Volume layout as recorded in the superblock */
+u32 fs_block_size = FS_DEFAULT_BLOCK_SIZE;
+static u32 fs_block_sectors = FS_DEFAULT_BLOCK_SIZE / SECTOR_SIZE;
+static u32 fs_node_slots = FS_DEFAULT_NODES;
+static u32 fs_feature_flags = 0;
+static u32 fs_data_start = 0;
+static u32 fs_btable_start = 0;
+
+/* Block table: how each data block is stored, dirty per sector */
+static FSBlockEntry fs_btable[FS_MAX_BLOCKS];
+static u8 fs_btable_dirty[(FS_BTABLE_SECTORS + 7) / 8];
+
+#define FS_BTABLE_PER_SECTOR (SECTOR_SIZE / sizeof(FSBlockEntry))
+
+/* Content hash index: persisted per block, chained by hash in memory */
+#define FS_HASH_BUCKETS 1024
+#define FS_HASH_NONE 0xFFFF
+#define FS_HASH_PER_SECTOR (SECTOR_SIZE / sizeof(FSHashEntry))
+
+static u32 fs_hash_start = 0;
+static FSHashEntry fs_hashes[FS_MAX_BLOCKS];
+static u8 fs_hash_dirty[(FS_HASH_SECTORS + 7) / 8];
+static u16 fs_hash_head[FS_HASH_BUCKETS];
+static u16 fs_hash_next[FS_MAX_BLOCKS];
+static u8 fs_dedup_buffer[FS_MAX_BLOCK_SIZE];
+
+/* LZ codec state */
+#define FS_LZ_HASH_BITS 12
+#define FS_LZ_MIN_MATCH 4
+static u16 fs_lz_table[1 << FS_LZ_HASH_BITS];
+static u8 fs_lz_buffer[FS_MAX_BLOCK_SIZE];
+
+/* Checksums: one CRC32C per data block, block table and hash sector */
+#define FS_CRC_BTABLE FS_MAX_BLOCKS
+#define FS_CRC_HASH (FS_MAX_BLOCKS + FS_BTABLE_SECTORS)
+
+static u32 fs_crc_start = 0;
+static u32 fs_crcs[FS_CRC_SECTORS * SECTOR_SIZE / 4];
+static u8 fs_crc_dirty[(FS_CRC_SECTORS + 7) / 8];
+static u32 fs_crc_errors = 0;
+static u32 fs_crc_table[8][256];
+static int fs_crc_hw = -1;
+static int fs_crc_quiet = 0;
+
+/* Snapshot table, one sector */
+#define FS_CRC_SNAP (FS_CRC_HASH + FS_HASH_SECTORS)
+
+static u32 fs_snap_start = 0;
+static FSSnapshot fs_snaps[FS_MAX_SNAPSHOTS];
+static int fs_snap_dirty = 0;
+
+/* Name pool: interned path components with reference counts */
+#define FS_NAME_ENTRIES (MAX_FILES * 2)
+#define FS_NAME_BUCKETS 64
+
+typedef struct {
+    u16 offset;                    // начало строки в fs_name_pool
+    u16 length;
+    u16 refs;                      // 0 - запись свободна
+    u16 next;                      // следующая запись корзины или FS_NO_NAME
+} FSNameEntry;
+
+static char fs_name_pool[FS_NAME_POOL];
+static u32 fs_name_used = 0;
+static FSNameEntry fs_names[FS_NAME_ENTRIES];
+static u16 fs_name_head[FS_NAME_BUCKETS];
+
+/* Name index: node slots per path trigram, rebuilt on mount */
+#define FS_TRIGRAM_BUCKETS 4096
+static u8 fs_trigram_map[FS_TRIGRAM_BUCKETS][MAX_FILES / 8];
+
+/* Node table slot map and dirty map for incremental saves */
+static u8 fs_slot_map[MAX_FILES / 8];
+static u8 fs_node_dirty[MAX_FILES / 8];
+static int fs_slot_index[MAX_FILES];
+static int fs_super_dirty = 0;
+
+/* RAM volume mounted under WexFS; entries point into the archive */
+static const u8* fs_ram = NULL;
+static const FSRamEntry* fs_ram_entries = NULL;
+static u32 fs_ram_count = 0;
+
+/* Descriptor table */
+typedef struct {
+    int used;
+    int flags;
+    u32 slot;                              // FS_NO_SLOT для файла RAM-тома
+    int ram;                               // запись RAM-тома или -1
+    u32 offset;
+} FSFile;
+
+static FSFile fs_files[FS_MAX_FDS];
+
+/* File views */
+typedef struct {
+    int used;
+    int prot;
+    u32 slot;
+    int ram;                               // запись RAM-тома или -1
+    u32 next;                              // страница окна, которая уйдёт следующей
+    u32 index[FS_VIEW_PAGES];              // блок файла в окне
+    FSCacheEntry* entry[FS_VIEW_PAGES];    // закреплённый буфер или NULL
+} FSView;
+
+static FSView fs_views[FS_MAX_VIEWS];
+
+#define BIT_SET(map, i)   ((map)[(i) >> 3] |= (u8)(1 << ((i) & 7)))
+#define BIT_CLEAR(map, i) ((map)[(i) >> 3] &= (u8)~(1 << ((i) & 7)))
+#define BIT_TEST(map, i)  (((map)[(i) >> 3] >> ((i) & 7)) & 1)
+
+/* WexFS 1.0 node, kept only to import old volumes */
+#define LEGACY_SECTORS_PER_NODE 11
+#define LEGACY_MAX_NODES 64
+typedef struct {
+    char name[MAX_PATH];
+    int is_dir;
+    char content[4096];
+    u32 next_sector;
+    u32 size;
+} FSLegacyNode;
+
+/* WexFS 1.0 migration
+ * The old node chain is first copied in runs of FS_MIGRATE_NODES nodes to a
+ * staging area behind the new volume, then imported into a fresh layout from
+ * that copy. Only the import overwrites old sectors and it always starts over
+ * from the staged copy, so a checkpoint sector in front of the staging area
+ * is enough to resume an interrupted migration on the next mount. */
+#define FS_MIGRATE_MAGIC 0x4D465857          /* "WXFM" */
+#define FS_MIGRATE_NODES 4                   /* legacy nodes per I/O run */
+#define FS_MIGRATE_RUN (FS_MIGRATE_NODES * LEGACY_SECTORS_PER_NODE)
+#define FS_MIGRATE_SECTORS (LEGACY_MAX_NODES * LEGACY_SECTORS_PER_NODE)
+
+enum { FS_MIGRATE_COPY = 1, FS_MIGRATE_IMPORT };
+
+typedef struct {
+    u32 magic;
+    u32 stage;
+    u32 copied;              // секторов старой цепочки в области переноса
+    u32 nodes;               // узлов в цепочке, известно после копирования
+    u32 checksum;            // CRC32C записи с checksum = 0
+} FSMigrateState;
+
+static u8 fs_migrate_buffer[FS_MIGRATE_RUN * SECTOR_SIZE];
+static u32 fs_migrate_bytes = 0;             // итог последней миграции
+static u32 fs_migrate_ms = 0;
+static u32 fs_migrate_nodes = 0;
+
+/* LZ compression
+ * A block is a sequence of (literals, match) pairs. Each pair starts with a
+ * token: high nibble = literal count, low nibble = match length - 4; a nibble
+ * of 15 is continued by 255-bytes. Literals follow, then a 2-byte offset back
+ * into the output. The last pair has literals only. */
+static u32 fs_lz_read32(const u8* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((u32)p[3] << 24);
+}
+
+static int fs_lz_put_length(u8* dst, int op, int cap, int len) {
+    while (len >= 255) {
+        if (op >= cap) return -1;
+        dst[op++] = 255;
+        len -= 255;
+    }
+    if (op >= cap) return -1;
+    dst[op++] = (u8)len;
+    return op;
+}
+
+static int fs_lz_emit(u8* dst, int op, int cap, const u8* lit, int lit_len, int offset, int match_len) {
+    if (op >= cap) return -1;
+    int token = op++;
+    int m = match_len ? match_len - FS_LZ_MIN_MATCH : 0;
+
+    dst[token] = (u8)(((lit_len < 15 ? lit_len : 15) << 4) | (m < 15 ? m : 15));
+    if (lit_len >= 15 && (op = fs_lz_put_length(dst, op, cap, lit_len - 15)) < 0) return -1;
+
+    if (op + lit_len > cap) return -1;
+    memcpy(dst + op, (void*)lit, lit_len);
+    op += lit_len;
+
+    if (match_len) {
+        if (op + 2 > cap) return -1;
+        dst[op++] = (u8)offset;
+        dst[op++] = (u8)(offset >> 8);
+        if (m >= 15 && (op = fs_lz_put_length(dst, op, cap, m - 15)) < 0) return -1;
+    }
+    return op;
+}
+
+// Сжимает src; -1, если результат не помещается в cap байт
+static int fs_lz_compress(const u8* src, int len, u8* dst, int cap) {
+    int ip = 0, anchor = 0, op = 0;
+
+    memset(fs_lz_table, 0, sizeof(fs_lz_table));
+
+    while (ip + FS_LZ_MIN_MATCH <= len) {
+        u32 seq = fs_lz_read32(src + ip);
+        u32 h = (seq * 2654435761u) >> (32 - FS_LZ_HASH_BITS);
+        int ref = (int)fs_lz_table[h] - 1;
+        fs_lz_table[h] = (u16)(ip + 1);
+
+        if (ref < 0 || ip - ref > 0xFFFF || fs_lz_read32(src + ref) != seq) {
+            ip++;
+            continue;
+        }
+
+        int match_len = FS_LZ_MIN_MATCH;
+        while (ip + match_len < len && src[ref + match_len] == src[ip + match_len]) match_len++;
+
+        op = fs_lz_emit(dst, op, cap, src + anchor, ip - anchor, ip - ref, match_len);
+        if (op < 0) return -1;
+        ip += match_len;
+        anchor = ip;
+    }
+
+    return fs_lz_emit(dst, op, cap, src + anchor, len - anchor, 0, 0);
+}
+
+// Распаковывает src; возвращает длину результата или -1 для повреждённых данных
+static int fs_lz_decompress(const u8* src, int len, u8* dst, int cap) {
+    int ip = 0, op = 0;
+
+    while (ip < len) {
+        int token = src[ip++];
+
+        int lit_len = token >> 4;
+        if (lit_len == 15) {
+            int b;
+            do {
+                if (ip >= len) return -1;
+                b = src[ip++];
+                lit_len += b;
+            } while (b == 255);
+        }
+        if (ip + lit_len > len || op + lit_len > cap) return -1;
+        memcpy(dst + op, (void*)(src + ip), lit_len);
+        ip += lit_len;
+        op += lit_len;
+
+        if (ip == len) break;
+
+        if (ip + 2 > len) return -1;
+        int offset = src[ip] | (src[ip + 1] << 8);
+        ip += 2;
+        int match_len = (token & 15) + FS_LZ_MIN_MATCH;
+        if ((token & 15) == 15) {
+            int b;
+            do {
+                if (ip >= len) return -1;
+                b = src[ip++];
+                match_len += b;
+            } while (b == 255);
+        }
+        if (offset == 0 || offset > op || op + match_len > cap) return -1;
+
+        // Побайтно: источник может перекрываться с приёмником
+        for (int i = 0; i < match_len; i++, op++) {
+            dst[op] = dst[op - offset];
+        }
+    }
+    return op;
+}
+
+/* CRC32C
+ * The SSE4.2 crc32 instruction works on general registers, so it needs no
+ * FPU/SSE state; without it a slice-by-8 table walk is used. */
+static void fs_crc_init(void) {
+    for (u32 i = 0; i < 256; i++) {
+        u32 crc = i;
+        for (int k = 0; k < 8; k++) crc = (crc >> 1) ^ (0x82F63B78 & (0 - (crc & 1)));
+        fs_crc_table[0][i] = crc;
+    }
+    for (u32 i = 0; i < 256; i++) {
+        for (int t = 1; t < 8; t++) {
+            u32 prev = fs_crc_table[t - 1][i];
+            fs_crc_table[t][i] = (prev >> 8) ^ fs_crc_table[0][prev & 0xFF];
+        }
+    }
+
+    fs_crc_hw = 0;
+#if defined(__i386__) || defined(__x86_64__)
+    u32 eax = 1, ebx, ecx, edx;
+    __asm__ volatile("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+    fs_crc_hw = (ecx >> 20) & 1;
+#endif
+}
+
+static u32 fs_crc32c(const void* data, u32 len) {
+    const u8* p = (const u8*)data;
+    u32 crc = 0xFFFFFFFF;
+
+    if (fs_crc_hw < 0) fs_crc_init();
+
+#if defined(__i386__) || defined(__x86_64__)
+    if (fs_crc_hw) {
+        for (; len >= 4; len -= 4, p += 4) {
+            u32 word = p[0] | (p[1] << 8) | (p[2] << 16) | ((u32)p[3] << 24);
+            __asm__("crc32l %1, %0" : "+r"(crc) : "rm"(word));
+        }
+        for (; len > 0; len--, p++) {
+            __asm__("crc32b %1, %0" : "+r"(crc) : "rm"(*p));
+        }
+        return ~crc;
+    }
+#endif
+
+    for (; len >= 8; len -= 8, p += 8) {
+        u32 lo = crc ^ (p[0] | (p[1] << 8) | (p[2] << 16) | ((u32)p[3] << 24));
+        u32 hi = p[4] | (p[5] << 8) | (p[6] << 16) | ((u32)p[7] << 24);
+        crc = fs_crc_table[7][lo & 0xFF] ^ fs_crc_table[6][(lo >> 8) & 0xFF] ^
+              fs_crc_table[5][(lo >> 16) & 0xFF] ^ fs_crc_table[4][lo >> 24] ^
+              fs_crc_table[3][hi & 0xFF] ^ fs_crc_table[2][(hi >> 8) & 0xFF] ^
+              fs_crc_table[1][(hi >> 16) & 0xFF] ^ fs_crc_table[0][hi >> 24];
+    }
+    for (; len > 0; len--, p++) {
+        crc = (crc >> 8) ^ fs_crc_table[0][(crc ^ *p) & 0xFF];
+    }
+    return ~crc;
+}
+
+static void fs_crc_set(u32 index, const void* data, u32 len) {
+    if (!fs_crc_start) return;
+    u32 crc = fs_crc32c(data, len);
+    if (fs_crcs[index] == crc) return;
+    fs_crcs[index] = crc;
+    BIT_SET(fs_crc_dirty, index / (SECTOR_SIZE / 4));
+}
+
+// Сообщает о несовпадении; данные всё равно возвращаются вызывающему
+static int fs_crc_verify(u32 expected, const void* data, u32 len, const char* what, u32 number) {
+    if (!fs_crc_start || fs_crc32c(data, len) == expected) return 1;
+
+    char num_str[12];
+    fs_crc_errors++;
+    if (fs_crc_quiet) return 0;
+    prints("WexFS: checksum mismatch in ");
+    prints(what);
+    putchar(' ');
+    itoa(number, num_str, 10);
+    prints(num_str);
+    newline();
+    return 0;
+}
+
+/* Block I/O */
+static void fs_btable_set(u32 block, u16 length, u16 flags) {
+    if (fs_btable[block].length == length && fs_btable[block].flags == flags) return;
+    fs_btable[block].length = length;
+    fs_btable[block].flags = flags;
+    BIT_SET(fs_btable_dirty, block / FS_BTABLE_PER_SECTOR);
+}
+
+static void fs_write_block(u32 block, char* data) {
+    u32 lba = fs_data_start + block * fs_block_sectors;
+
+    if (fs_foreign) return;
+
+    // Контрольная сумма берётся от несжатого содержимого
+    fs_crc_set(block, data, fs_block_size);
+
+    // Сжатый блок сохраняется, только если экономит хотя бы один сектор
+    if ((fs_feature_flags & FS_FEATURE_LZ) && fs_btable_start) {
+        int len = fs_lz_compress((u8*)data, fs_block_size, fs_lz_buffer, fs_block_size - SECTOR_SIZE);
+        if (len > 0) {
+            int sectors = (len + SECTOR_SIZE - 1) / SECTOR_SIZE;
+            memset(fs_lz_buffer + len, 0, sectors * SECTOR_SIZE - len);
+            for (int j = 0; j < sectors; j++) {
+                ata_write_sector(lba + j, fs_lz_buffer + j * SECTOR_SIZE);
+            }
+            fs_btable_set(block, (u16)len, FS_BLOCK_LZ);
+            return;
+        }
+    }
+
+    for (u32 j = 0; j < fs_block_sectors; j++) {
+        ata_write_sector(lba + j, (u8*)data + j * SECTOR_SIZE);
+    }
+    if (fs_btable_start) fs_btable_set(block, 0, 0);
+}
+
+static void fs_read_block(u32 block, char* data) {
+    u32 lba = fs_data_start + block * fs_block_sectors;
+
+    if (fs_btable[block].flags & FS_BLOCK_LZ) {
+        int len = fs_btable[block].length;
+        int sectors = (len + SECTOR_SIZE - 1) / SECTOR_SIZE;
+        for (int j = 0; j < sectors; j++) {
+            ata_read_sector(lba + j, fs_lz_buffer + j * SECTOR_SIZE);
+        }
+        int n = fs_lz_decompress(fs_lz_buffer, len, (u8*)data, fs_block_size);
+        u32 got = n < 0 ? 0 : (u32)n;
+        if (got < fs_block_size) {
+            memset(data + got, 0, fs_block_size - got);
+        }
+    } else {
+        for (u32 j = 0; j < fs_block_sectors; j++) {
+            ata_read_sector(lba + j, (u8*)data + j * SECTOR_SIZE);
+        }
+    }
+
+    fs_crc_verify(fs_crcs[block], data, fs_block_size, "block", block);
+}
+
+/* Deduplication */
+static u64 fs_block_hash(const char* data) {
+    const u8* p = (const u8*)data;
+    u64 h = 0x9E3779B97F4A7C15ULL;
+
+    for (u32 i = 0; i < fs_block_size; i += 8) {
+        u64 k = fs_lz_read32(p + i) | ((u64)fs_lz_read32(p + i + 4) << 32);
+        k *= 0xC2B2AE3D27D4EB4FULL;
+        k = (k << 31) | (k >> 33);
+        h ^= k * 0x9E3779B185EBCA87ULL;
+        h = ((h << 27) | (h >> 37)) * 5 + 0x52DCE729;
+    }
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static u32 fs_hash_bucket(const FSHashEntry* entry) {
+    return entry->hash_lo % FS_HASH_BUCKETS;
+}
+
+static void fs_hash_link(u32 block) {
+    u32 bucket = fs_hash_bucket(&fs_hashes[block]);
+    fs_hash_next[block] = fs_hash_head[bucket];
+    fs_hash_head[bucket] = (u16)block;
+}
+
+// Убирает блок из индекса: его содержимое меняется или он освобождён
+static void fs_hash_unlink(u32 block) {
+    if (!(fs_hashes[block].flags & FS_HASH_VALID)) return;
+
+    u16* link = &fs_hash_head[fs_hash_bucket(&fs_hashes[block])];
+    while (*link != FS_HASH_NONE) {
+        if (*link == block) {
+            *link = fs_hash_next[block];
+            break;
+        }
+        link = &fs_hash_next[*link];
+    }
+    fs_hashes[block].flags &= ~FS_HASH_VALID;
+    BIT_SET(fs_hash_dirty, block / FS_HASH_PER_SECTOR);
+}
+
+static void fs_hash_rebuild(void) {
+    for (int i = 0; i < FS_HASH_BUCKETS; i++) fs_hash_head[i] = FS_HASH_NONE;
+    for (u32 b = 0; b < FS_MAX_BLOCKS; b++) {
+        if ((fs_hashes[b].flags & FS_HASH_VALID) && fs_block_refs[b] > 0) {
+            fs_hash_link(b);
+        } else {
+            fs_hashes[b].flags &= ~FS_HASH_VALID;
+        }
+    }
+}
+
+// Содержимое блока: из кэша, если он там есть, иначе с диска
+static const char* fs_block_peek(u32 block) {
+    for (int i = 0; i < fs_bcache_count; i++) {
+        if (fs_bcache[i].block == block) return fs_bcache[i].data;
+    }
+    fs_read_block(block, (char*)fs_dedup_buffer);
+    return (const char*)fs_dedup_buffer;
+}
+
+static int fs_block_equal(const char* a, const char* b) {
+    for (u32 i = 0; i < fs_block_size; i++) {
+        if (a[i] != b[i]) return 0;
+    }
+    return 1;
+}
+
+// Блок с тем же содержимым; хэш только отбирает кандидатов
+static u32 fs_hash_find(u32 hash_lo, u32 hash_hi, const char* data, u32 self) {
+    for (u16 b = fs_hash_head[hash_lo % FS_HASH_BUCKETS]; b != FS_HASH_NONE; b = fs_hash_next[b]) {
+        if (b == self || fs_block_refs[b] == 0) continue;
+        if (fs_hashes[b].hash_lo != hash_lo || fs_hashes[b].hash_hi != hash_hi) continue;
+        if (fs_block_equal(fs_block_peek(b), data)) return b;
+    }
+    return FS_NO_BLOCK;
+}
+
+// Переводит все ссылки с block на twin
+static void fs_block_remap(u32 block, u32 twin) {
+    for (int i = 0; i < fs_count; i++) {
+        FSNode* node = &fs_cache[i];
+        if (FS_NODE_INLINE(node)) continue;
+        for (u32 j = 0; j < FS_NODE_BLOCKS; j++) {
+            if (FS_NODE_MAP(node)[j] == block) {
+                FS_NODE_MAP(node)[j] = twin;
+                BIT_SET(fs_node_dirty, node->slot);
+            }
+        }
+    }
+    fs_block_refs[twin] += fs_block_refs[block];
+    fs_block_refs[block] = 0;
+    fs_dirty = 1;
+}
+
+/* Block cache */
+// Записывает грязный блок; блок с уже имеющимся содержимым не пишется
+static void fs_bcache_commit(FSCacheEntry* e) {
+    // Вид ещё пишет в блок: он сохраняется как есть и остаётся грязным
+    if (e->write_pins) {
+        fs_write_block(e->block, e->data);
+        return;
+    }
+
+    if (fs_hash_start) {
+        u64 hash = fs_block_hash(e->data);
+        u32 hash_lo = (u32)hash;
+        u32 hash_hi = (u32)(hash >> 32);
+
+        fs_hash_unlink(e->block);
+        u32 twin = fs_hash_find(hash_lo, hash_hi, e->data, e->block);
+        if (twin != FS_NO_BLOCK) {
+            fs_block_remap(e->block, twin);
+            e->block = FS_NO_BLOCK;
+            e->dirty = 0;
+            return;
+        }
+
+        fs_hashes[e->block].hash_lo = hash_lo;
+        fs_hashes[e->block].hash_hi = hash_hi;
+        fs_hashes[e->block].flags |= FS_HASH_VALID;
+        fs_hash_link(e->block);
+    }
+
+    fs_write_block(e->block, e->data);
+    e->dirty = 0;
+}
+
+// Пул кэша делится на столько блоков, сколько помещается при текущем размере
+static void fs_bcache_reset(void) {
+    fs_bcache_count = FS_CACHE_BYTES / fs_block_size;
+    if (fs_bcache_count > FS_CACHE_BLOCKS) fs_bcache_count = FS_CACHE_BLOCKS;
+    for (int i = 0; i < fs_bcache_count; i++) {
+        fs_bcache[i].block = FS_NO_BLOCK;
+        fs_bcache[i].dirty = 0;
+        fs_bcache[i].data = fs_bcache_pool + i * fs_block_size;
+        fs_bcache[i].pins = 0;
+        fs_bcache[i].write_pins = 0;
+    }
+    fs_bcache_pinned = 0;
+    memset(fs_views, 0, sizeof(fs_views));
+}
+
+// Возвращает буфер блока в кэше; load = 0 для блоков, которые будут перезаписаны.
+// Закреплённые видами буферы не вытесняются.
+static FSCacheEntry* fs_bcache_get(u32 block, int load) {
+    FSCacheEntry* victim = NULL;
+
+    for (int i = 0; i < fs_bcache_count; i++) {
+        if (fs_bcache[i].block == block && (block != FS_NO_BLOCK || !fs_bcache[i].pins)) {
+            fs_bcache[i].stamp = ++fs_bcache_clock;
+            return &fs_bcache[i];
+        }
+        if (fs_bcache[i].pins) continue;
+        if (!victim) {
+            victim = &fs_bcache[i];
+        } else if (fs_bcache[i].block == FS_NO_BLOCK) {
+            if (victim->block != FS_NO_BLOCK) victim = &fs_bcache[i];
+        } else if (victim->block != FS_NO_BLOCK && fs_bcache[i].stamp < victim->stamp) {
+            victim = &fs_bcache[i];
+        }
+    }
+
+    if (victim->block != FS_NO_BLOCK && victim->dirty) {
+        fs_bcache_commit(victim);
+    }
+
+    victim->block = block;
+    victim->dirty = 0;
+    victim->stamp = ++fs_bcache_clock;
+    if (load) {
+        fs_read_block(block, victim->data);
+    }
+    return victim;
+}
+
+static void fs_bcache_drop(u32 block) {
+    for (int i = 0; i < fs_bcache_count; i++) {
+        if (fs_bcache[i].block == block) {
+            fs_bcache[i].block = FS_NO_BLOCK;
+            fs_bcache[i].dirty = 0;
+        }
+    }
+}
+
+static void fs_bcache_flush(void) {
+    for (int i = 0; i < fs_bcache_count; i++) {
+        if (fs_bcache[i].block != FS_NO_BLOCK && fs_bcache[i].dirty) {
+            fs_bcache_commit(&fs_bcache[i]);
+        }
+    }
+}
+
+/* Block management */
+static u32 fs_block_alloc(void) {
+    for (u32 n = 0; n < FS_MAX_BLOCKS; n++) {
+        u32 b = (fs_alloc_hint + n) % FS_MAX_BLOCKS;
+        if (fs_block_refs[b] == 0) {
+            fs_block_refs[b] = 1;
+            fs_alloc_hint = b + 1;
+            return b;
+        }
+    }
+    return FS_NO_BLOCK;
+}
+
+static void fs_block_release(u32 block) {
+    if (block == FS_NO_BLOCK || block >= FS_MAX_BLOCKS) return;
+    if (fs_block_refs[block] > 0 && --fs_block_refs[block] == 0) {
+        fs_bcache_drop(block);
+        fs_hash_unlink(block);
+    }
+}
+
+static void fs_node_set_dirty(FSNode* node) {
+    BIT_SET(fs_node_dirty, node->slot);
+    fs_generation++;
+    fs_dirty = 1;
+}
+
+/* Name pool
+ * Equal components share one entry, so "config" below ten directories is
+ * stored once. Released strings stay in the pool until it fills up; then
+ * the live ones are moved down to close the gaps. */
+static u32 fs_name_hash(const char* text, u32 len) {
+    u32 h = 2166136261u;
+    for (u32 i = 0; i < len; i++) h = (h ^ (u8)text[i]) * 16777619u;
+    return h & (FS_NAME_BUCKETS - 1);
+}
+
+static void fs_name_reset(void) {
+    memset(fs_names, 0, sizeof(fs_names));
+    memset(fs_name_head, 0xFF, sizeof(fs_name_head));
+    fs_name_used = 0;
+}
+
+static const char* fs_name_text(u16 id) {
+    return id < FS_NAME_ENTRIES ? fs_name_pool + fs_names[id].offset : "";
+}
+
+// Запись с текстом text[0..len) или FS_NO_NAME; счётчик не меняется
+static u16 fs_name_lookup(const char* text, u32 len) {
+    for (u16 id = fs_name_head[fs_name_hash(text, len)]; id != FS_NO_NAME; id = fs_names[id].next) {
+        const char* other = fs_name_pool + fs_names[id].offset;
+        u32 i = 0;
+        if (fs_names[id].length != len) continue;
+        while (i < len && other[i] == text[i]) i++;
+        if (i == len) return id;
+    }
+    return FS_NO_NAME;
+}
+
+// Живые строки сдвигаются к началу пула в порядке их адресов
+static void fs_name_compact(void) {
+    u32 used = 0;
+    u32 from = 0;
+
+    for (;;) {
+        int next = -1;
+        for (int id = 0; id < FS_NAME_ENTRIES; id++) {
+            if (!fs_names[id].refs || fs_names[id].offset < from) continue;
+            if (next < 0 || fs_names[id].offset < fs_names[next].offset) next = id;
+        }
+        if (next < 0) break;
+
+        FSNameEntry* entry = &fs_names[next];
+        from = entry->offset + 1;
+        for (u32 i = 0; i <= entry->length; i++) fs_name_pool[used + i] = fs_name_pool[entry->offset + i];
+        entry->offset = used;
+        used += entry->length + 1;
+    }
+    fs_name_used = used;
+}
+
+// Берёт ссылку на строку text[0..len); FS_NO_NAME, если пул заполнен
+static u16 fs_name_intern(const char* text, u32 len) {
+    u16 id = fs_name_lookup(text, len);
+    if (id != FS_NO_NAME) {
+        fs_names[id].refs++;
+        return id;
+    }
+
+    for (id = 0; id < FS_NAME_ENTRIES && fs_names[id].refs; id++) {
+    }
+    if (id == FS_NAME_ENTRIES || len >= MAX_PATH) return FS_NO_NAME;
+    if (fs_name_used + len + 1 > FS_NAME_POOL) fs_name_compact();
+    if (fs_name_used + len + 1 > FS_NAME_POOL) return FS_NO_NAME;
+
+    FSNameEntry* entry = &fs_names[id];
+    u32 bucket = fs_name_hash(text, len);
+    memcpy(fs_name_pool + fs_name_used, (void*)text, len);
+    fs_name_pool[fs_name_used + len] = '\0';
+    entry->offset = fs_name_used;
+    entry->length = len;
+    entry->refs = 1;
+    entry->next = fs_name_head[bucket];
+    fs_name_head[bucket] = id;
+    fs_name_used += len + 1;
+    return id;
+}
+
+static void fs_name_release(u16 id) {
+    if (id >= FS_NAME_ENTRIES || fs_names[id].refs == 0 || --fs_names[id].refs > 0) return;
+
+    u16* link = &fs_name_head[fs_name_hash(fs_name_pool + fs_names[id].offset, fs_names[id].length)];
+    while (*link != id) link = &fs_names[*link].next;
+    *link = fs_names[id].next;
+}
+
+/* Node names
+ * A node's path is the chain of components up to the first node without a
+ * parent; the root "/" itself is not part of the paths below it. */
+static FSNode* fs_slot_node(u32 slot) {
+    if (slot >= MAX_FILES || !BIT_TEST(fs_slot_map, slot)) return NULL;
+    return &fs_cache[fs_slot_index[slot]];
+}
+
+static int fs_node_is_root(const FSNode* node) {
+    const char* name = fs_name_text(node->name);
+    return node->parent == FS_NO_SLOT && name[0] == '/' && name[1] == '\0';
+}
+
+const char* fs_node_name(const FSNode* node) {
+    return fs_name_text(node->name);
+}
+
+// Полный путь узла в buf размером MAX_PATH; возвращает его длину
+u32 fs_node_path(const FSNode* node, char* buf) {
+    const FSNode* chain[MAX_FILES];
+    int depth = 0;
+    u32 len = 0;
+
+    while (node && depth < MAX_FILES) {
+        chain[depth++] = node;
+        node = fs_slot_node(node->parent);
+    }
+    if (depth > 1 && fs_node_is_root(chain[depth - 1])) depth--;
+
+    for (int i = depth - 1; i >= 0; i--) {
+        const char* part = fs_node_name(chain[i]);
+        if (len > 0 && len < MAX_PATH - 1) buf[len++] = '/';
+        while (*part && len < MAX_PATH - 1) buf[len++] = *part++;
+    }
+    buf[len] = '\0';
+    return len;
+}
+
+// 1, если node лежит где-то под директорией dir
+int fs_node_under(const FSNode* node, const FSNode* dir) {
+    FSNode* up = fs_slot_node(node->parent);
+    for (int depth = 0; up && depth < MAX_FILES; depth++) {
+        if (up == dir) return 1;
+        up = fs_slot_node(up->parent);
+    }
+    return 0;
+}
+
+// Последний компонент канонического пути; у корня это сам "/"
+static const char* fs_path_base(const char* path) {
+    const char* slash = strrchr(path, '/');
+    return (slash && slash != path) ? slash + 1 : path;
+}
+
+// Узел без родителя, хранящий полный путь text[0..len), или -1
+static int fs_orphan_find(const char* text, u32 len) {
+    u16 id = fs_name_lookup(text, len);
+    if (id == FS_NO_NAME) return -1;
+    for (int i = 0; i < fs_count; i++) {
+        if (fs_cache[i].name == id && fs_cache[i].parent == FS_NO_SLOT) return i;
+    }
+    return -1;
+}
+
+/* Name index
+ * Every trigram of a full path sets the node's slot bit in the trigram's
+ * bucket. A query ANDs the buckets of its own trigrams and checks only the
+ * slots that survive; bucket collisions just add candidates. */
+static u32 fs_trigram_hash(const char* p) {
+    return ((u8)p[0] * 1369u + (u8)p[1] * 37u + (u8)p[2]) % FS_TRIGRAM_BUCKETS;
+}
+
+static void fs_name_index(FSNode* node, int add) {
+    char name[MAX_PATH];
+    fs_node_path(node, name);
+    for (int i = 0; name[i] && name[i + 1] && name[i + 2]; i++) {
+        u8* bucket = fs_trigram_map[fs_trigram_hash(name + i)];
+        if (add) {
+            BIT_SET(bucket, node->slot);
+        } else {
+            BIT_CLEAR(bucket, node->slot);
+        }
+    }
+}
+
+static void fs_name_index_rebuild(void) {
+    memset(fs_trigram_map, 0, sizeof(fs_trigram_map));
+    for (int i = 0; i < fs_count; i++) fs_name_index(&fs_cache[i], 1);
+}
+
+// Кандидаты для шаблона: пересечение корзин всех триграмм его буквальных частей
+static void fs_name_candidates(const char* pattern, u8* slots) {
+    memcpy(slots, fs_slot_map, MAX_FILES / 8);
+    for (int i = 0; pattern[i] && pattern[i + 1] && pattern[i + 2]; i++) {
+        if (pattern[i] == '*' || pattern[i] == '?' ||
+            pattern[i + 1] == '*' || pattern[i + 1] == '?' ||
+            pattern[i + 2] == '*' || pattern[i + 2] == '?') continue;
+        u8* bucket = fs_trigram_map[fs_trigram_hash(pattern + i)];
+        for (int j = 0; j < MAX_FILES / 8; j++) slots[j] &= bucket[j];
+    }
+}
+
+/* Directory totals
+ * Every node knows the slot of its parent directory; each directory keeps
+ * the byte and file totals of everything below it. Changes are pushed up
+ * the parent chain, so a directory size is read without a scan. */
+static void fs_tree_adjust(FSNode* node, int bytes, int files) {
+    FSNode* dir = fs_slot_node(node->parent);
+    for (int depth = 0; dir && depth < MAX_FILES; depth++) {
+        dir->tree_size += bytes;
+        dir->tree_files += files;
+        dir = fs_slot_node(dir->parent);
+    }
+}
+
+// Слот родительской директории; у записей верхнего уровня это корень "/"
+static u32 fs_parent_slot(const char* path) {
+    FSPath parent;
+
+    if (strcmp(path, "/") == 0) return FS_NO_SLOT;
+    const char* base = fs_path_base(path);
+    if (base == path) {
+        strcpy(parent.text, "/");
+        parent.len = 1;
+    } else {
+        parent.len = base - 1 - path;
+        memcpy(parent.text, (void*)path, parent.len);
+        parent.text[parent.len] = '\0';
+    }
+
+    int index = fs_path_find(&parent);
+    return (index >= 0 && fs_cache[index].is_dir) ? fs_cache[index].slot : FS_NO_SLOT;
+}
+
+// Привязывает узел без родителя к директории; имя сокращается до компонента
+static void fs_node_link(FSNode* node, u32 parent) {
+    char path[MAX_PATH];
+    fs_node_path(node, path);
+    const char* base = fs_path_base(path);
+    u16 name = fs_name_intern(base, strlen(base));
+    if (name == FS_NO_NAME) return;
+    fs_name_release(node->name);
+    node->name = name;
+    node->parent = parent;
+}
+
+// Отвязывает узел от директории; имя становится полным путём
+static void fs_node_unlink(FSNode* node) {
+    char path[MAX_PATH];
+    u16 name = fs_name_intern(path, fs_node_path(node, path));
+    if (name != FS_NO_NAME) {
+        fs_name_release(node->name);
+        node->name = name;
+    }
+    node->parent = FS_NO_SLOT;
+}
+
+static void fs_node_set_size(FSNode* node, u32 size) {
+    if (size == node->size) return;
+    fs_tree_adjust(node, (int)size - (int)node->size, 0);
+    node->size = size;
+    fs_node_set_dirty(node);
+}
+
+// Вклад узла в итоги родителей: файл считается сам, директория - своими итогами
+static void fs_tree_attach(FSNode* node, int sign) {
+    if (node->is_dir) {
+        fs_tree_adjust(node, sign * (int)node->tree_size, sign * (int)node->tree_files);
+    } else {
+        fs_tree_adjust(node, sign * (int)node->size, sign);
+    }
+}
+
+static void fs_tree_rebuild(void) {
+    for (int i = 0; i < fs_count; i++) {
+        fs_cache[i].tree_size = 0;
+        fs_cache[i].tree_files = 0;
+    }
+    for (int i = 0; i < fs_count; i++) {
+        if (!fs_cache[i].is_dir) fs_tree_attach(&fs_cache[i], 1);
+    }
+}
+
+static u32 fs_node_block_count(u32 size) {
+    return (size + fs_block_size - 1) / fs_block_size;
+}
+
+// Блок index файла, доступный для записи: выделяет новый или клонирует общий
+static char* fs_node_block_writable(FSNode* node, u32 index, int partial) {
+    u32 old = FS_NODE_MAP(node)[index];
+
+    if (old != FS_NO_BLOCK && fs_block_refs[old] == 1) {
+        FSCacheEntry* e = fs_bcache_get(old, partial);
+        fs_hash_unlink(old);
+        e->dirty = 1;
+        fs_dirty = 1;
+        return e->data;
+    }
+
+    u32 block = fs_block_alloc();
+    if (block == FS_NO_BLOCK) return NULL;
+
+    FSCacheEntry* e = fs_bcache_get(block, 0);
+    if (old != FS_NO_BLOCK && partial) {
+        FSCacheEntry* src = fs_bcache_get(old, 1);
+        memcpy(e->data, src->data, fs_block_size);
+    } else if (partial) {
+        memset(e->data, 0, fs_block_size);
+    }
+    e->dirty = 1;
+
+    fs_block_release(old);
+    FS_NODE_MAP(node)[index] = block;
+    fs_node_set_dirty(node);
+    return e->data;
+}
+
+static char* fs_inline_data(FSNode* node) {
+    return (char*)&FS_NODE_MAP(node)[1];
+}
+
+static int fs_node_write_blocks(FSNode* node, const void* buf, u32 len, u32 offset) {
+    const u8* in = (const u8*)buf;
+    u32 done = 0;
+    while (done < len) {
+        u32 pos = offset + done;
+        u32 index = pos / fs_block_size;
+        u32 block_off = pos % fs_block_size;
+        u32 n = fs_block_size - block_off;
+        if (n > len - done) n = len - done;
+
+        // Частичная запись должна сохранить остаток блока
+        char* data = fs_node_block_writable(node, index, n != fs_block_size);
+        if (!data) break;
+
+        memcpy(data + block_off, (void*)(in + done), n);
+        done += n;
+    }
+
+    if (offset + done > node->size) {
+        fs_node_set_size(node, offset + done);
+    }
+    return (done == 0 && len > 0) ? -1 : (int)done;
+}
+
+static void fs_node_trim_blocks(FSNode* node, u32 size) {
+    u32 keep = fs_node_block_count(size);
+    for (u32 i = keep; i < FS_NODE_BLOCKS; i++) {
+        if (FS_NODE_MAP(node)[i] != FS_NO_BLOCK) {
+            fs_block_release(FS_NODE_MAP(node)[i]);
+            FS_NODE_MAP(node)[i] = FS_NO_BLOCK;
+        }
+    }
+
+    // Хвост последнего блока обнуляется, чтобы расширение читало нули
+    u32 tail = size % fs_block_size;
+    if (size < node->size && tail != 0 && FS_NODE_MAP(node)[keep - 1] != FS_NO_BLOCK) {
+        char* data = fs_node_block_writable(node, keep - 1, 1);
+        if (data) memset(data + tail, 0, fs_block_size - tail);
+    }
+}
+
+// Встроенный файл перерос запись узла: данные переезжают в блоки
+static int fs_node_promote(FSNode* node) {
+    u32 saved[FS_NODE_BLOCKS];
+    u32 len = node->size;
+
+    memcpy(saved, FS_NODE_MAP(node), sizeof(saved));
+    for (u32 i = 0; i < FS_NODE_BLOCKS; i++) FS_NODE_MAP(node)[i] = FS_NO_BLOCK;
+    fs_node_set_dirty(node);
+    if (len == 0) return 0;
+
+    if (fs_node_write_blocks(node, &saved[1], len, 0) == (int)len) return 0;
+
+    // Не хватило блоков: файл остаётся встроенным
+    fs_node_trim_blocks(node, 0);
+    memcpy(FS_NODE_MAP(node), saved, sizeof(saved));
+    node->size = len;
+    return -1;
+}
+
+int fs_node_pread(FSNode* node, void* buf, u32 len, u32 offset) {
+    if (node->is_dir) return -1;
+    if (offset >= node->size) return 0;
+    if (len > node->size - offset) len = node->size - offset;
+
+    u8* out = (u8*)buf;
+    if (FS_NODE_INLINE(node)) {
+        memcpy(out, fs_inline_data(node) + offset, len);
+        return len;
+    }
+
+    u32 done = 0;
+    while (done < len) {
+        u32 pos = offset + done;
+        u32 index = pos / fs_block_size;
+        u32 block_off = pos % fs_block_size;
+        u32 n = fs_block_size - block_off;
+        if (n > len - done) n = len - done;
+
+        if (FS_NODE_MAP(node)[index] == FS_NO_BLOCK) {
+            memset(out + done, 0, n);
+        } else {
+            FSCacheEntry* e = fs_bcache_get(FS_NODE_MAP(node)[index], 1);
+            memcpy(out + done, e->data + block_off, n);
+        }
+        done += n;
+    }
+    return done;
+}
+
+int fs_node_pwrite(FSNode* node, const void* buf, u32 len, u32 offset) {
+    if (node->is_dir || offset > FS_MAX_FILE_SIZE) return -1;
+    if (len > FS_MAX_FILE_SIZE - offset) len = FS_MAX_FILE_SIZE - offset;
+
+    // Маленькие файлы хранятся прямо в записи узла, без блоков данных
+    if (offset + len <= FS_INLINE_MAX && (FS_NODE_INLINE(node) || node->size == 0)) {
+        if (!FS_NODE_INLINE(node)) {
+            FS_NODE_MAP(node)[0] = FS_INLINE_BLOCK;
+            memset(fs_inline_data(node), 0, FS_INLINE_MAX);
+        }
+        memcpy(fs_inline_data(node) + offset, (void*)buf, len);
+        if (offset + len > node->size) fs_node_set_size(node, offset + len);
+        fs_node_set_dirty(node);
+        return len;
+    }
+
+    if (FS_NODE_INLINE(node) && fs_node_promote(node) != 0) return -1;
+    return fs_node_write_blocks(node, buf, len, offset);
+}
+
+int fs_node_truncate(FSNode* node, u32 size) {
+    if (node->is_dir || size > FS_MAX_FILE_SIZE) return -1;
+
+    if (FS_NODE_INLINE(node)) {
+        if (size > FS_INLINE_MAX) {
+            if (fs_node_promote(node) != 0) return -1;
+        } else {
+            if (size < node->size) {
+                memset(fs_inline_data(node) + size, 0, node->size - size);
+            }
+            if (size == 0) {
+                for (u32 i = 0; i < FS_NODE_BLOCKS; i++) FS_NODE_MAP(node)[i] = FS_NO_BLOCK;
+            }
+            fs_node_set_size(node, size);
+            fs_node_set_dirty(node);
+            return 0;
+        }
+    }
+
+    fs_node_trim_blocks(node, size);
+    fs_node_set_size(node, size);
+    fs_node_set_dirty(node);
+    return 0;
+}
+
+int fs_write_content(FSNode* node, const char* data, u32 len) {
+    if (fs_node_truncate(node, 0) != 0) return -1;
+    if (len == 0) return 0;
+    return fs_node_pwrite(node, data, len, 0) == (int)len ? 0 : -1;
+}
+
+void fs_reflink(FSNode* dst, FSNode* src) {
+    if (!FS_NODE_INLINE(dst)) {
+        for (u32 i = 0; i < FS_NODE_BLOCKS; i++) fs_block_release(FS_NODE_MAP(dst)[i]);
+    }
+    // Встроенные данные копируются вместе с записью узла
+    for (u32 i = 0; i < FS_NODE_BLOCKS; i++) {
+        FS_NODE_MAP(dst)[i] = FS_NODE_MAP(src)[i];
+        if (!FS_NODE_INLINE(src) && FS_NODE_MAP(dst)[i] != FS_NO_BLOCK) fs_block_refs[FS_NODE_MAP(dst)[i]]++;
+    }
+    fs_node_set_size(dst, src->size);
+    fs_node_set_dirty(dst);
+}
+
+/* Node management */
+FSNode* fs_node_create(const char* path, int is_dir) {
+    if (fs_count >= (int)fs_node_slots) return NULL;
+
+    u32 slot = 0;
+    while (slot < fs_node_slots && BIT_TEST(fs_slot_map, slot)) slot++;
+    if (slot == fs_node_slots) return NULL;
+
+    // Под директорией хранится только последний компонент пути
+    u32 parent = fs_parent_slot(path);
+    const char* base = parent == FS_NO_SLOT ? path : fs_path_base(path);
+    u16 name = fs_name_intern(base, strlen(base));
+    if (name == FS_NO_NAME) return NULL;
+
+    FSNode* node = &fs_cache[fs_count];
+    node->name = name;
+    node->is_dir = is_dir;
+    node->size = 0;
+    node->slot = slot;
+    node->parent = parent;
+    node->tree_size = 0;
+    node->tree_files = 0;
+    for (u32 i = 0; i < FS_NODE_BLOCKS; i++) FS_NODE_MAP(node)[i] = FS_NO_BLOCK;
+    fs_slot_index[slot] = fs_count;
+    fs_count++;
+
+    BIT_SET(fs_slot_map, slot);
+    fs_super_dirty = 1;
+    fs_node_set_dirty(node);
+    fs_name_index(node, 1);
+
+    if (!is_dir) {
+        fs_tree_attach(node, 1);
+    } else {
+        // Узлы, созданные раньше своей директории, переходят к ней
+        for (int i = 0; i < fs_count - 1; i++) {
+            FSNode* child = &fs_cache[i];
+            if (child->parent == FS_NO_SLOT && !fs_node_is_root(child) &&
+                fs_parent_slot(fs_node_name(child)) == slot) {
+                fs_node_link(child, slot);
+                fs_tree_attach(child, 1);
+            }
+        }
+    }
+    return node;
+}
+
+int fs_node_rename(FSNode* node, const char* path) {
+    char buf[MAX_PATH];
+    FSPath target;
+    u32 new_len = strlen(path);
+
+    if (new_len >= MAX_PATH || fs_node_is_root(node)) return -1;
+    strcpy(target.text, path);
+    target.len = new_len;
+    if (fs_path_find(&target) >= 0) return -1;
+
+    // Директория не может переехать внутрь самой себя
+    u32 parent = fs_parent_slot(path);
+    FSNode* up = fs_slot_node(parent);
+    for (int depth = 0; up && depth < MAX_FILES; depth++) {
+        if (up == node) return -1;
+        up = fs_slot_node(up->parent);
+    }
+
+    if (node->is_dir) {
+        u32 old_len = fs_node_path(node, buf);
+        for (int i = 0; i < fs_count; i++) {
+            if (!fs_node_under(&fs_cache[i], node)) continue;
+            if (new_len + fs_node_path(&fs_cache[i], buf) - old_len >= MAX_PATH) return -1;
+        }
+    }
+
+    const char* base = parent == FS_NO_SLOT ? path : fs_path_base(path);
+    u16 name = fs_name_intern(base, strlen(base));
+    if (name == FS_NO_NAME) return -1;
+
+    // Дети остаются привязаны к узлу; меняются только их полные пути
+    fs_tree_attach(node, -1);
+    fs_name_index(node, 0);
+    for (int i = 0; i < fs_count; i++) {
+        if (fs_node_under(&fs_cache[i], node)) fs_name_index(&fs_cache[i], 0);
+    }
+
+    fs_name_release(node->name);
+    node->name = name;
+    node->parent = parent;
+
+    fs_name_index(node, 1);
+    for (int i = 0; i < fs_count; i++) {
+        if (!fs_node_under(&fs_cache[i], node)) continue;
+        fs_name_index(&fs_cache[i], 1);
+        fs_node_set_dirty(&fs_cache[i]);
+    }
+    fs_tree_attach(node, 1);
+    fs_node_set_dirty(node);
+    return 0;
+}
+
+void fs_node_remove(int index) {
+    if (index < 0 || index >= fs_count) return;
+
+    FSNode* node = &fs_cache[index];
+    if (!FS_NODE_INLINE(node)) {
+        for (u32 i = 0; i < FS_NODE_BLOCKS; i++) {
+            fs_block_release(FS_NODE_MAP(node)[i]);
+        }
+    }
+
+    fs_name_index(node, 0);
+
+    // Оставшиеся дети удалённой директории больше нигде не учитываются
+    fs_tree_attach(node, -1);
+    for (int i = 0; i < fs_count; i++) {
+        if (fs_cache[i].parent == node->slot) fs_node_unlink(&fs_cache[i]);
+    }
+    fs_name_release(node->name);
+    BIT_CLEAR(fs_slot_map, node->slot);
+    BIT_CLEAR(fs_node_dirty, node->slot);
+
+    // Открытые дескрипторы удалённого узла становятся недействительными;
+    // его виды держат свои страницы до fs_munmap, но новых не выдают
+    for (int fd = 0; fd < FS_MAX_FDS; fd++) {
+        if (fs_files[fd].used && fs_files[fd].slot == node->slot) {
+            fs_files[fd].used = 0;
+        }
+    }
+    for (int i = 0; i < FS_MAX_VIEWS; i++) {
+        if (fs_views[i].used && fs_views[i].slot == node->slot) fs_views[i].slot = FS_NO_SLOT;
+    }
+
+    for (int i = index; i < fs_count - 1; i++) {
+        fs_cache[i] = fs_cache[i + 1];
+        fs_slot_index[fs_cache[i].slot] = i;
+    }
+    fs_count--;
+    fs_generation++;
+    fs_super_dirty = 1;
+    fs_dirty = 1;
+}
+
+// Раскладка нового тома; таблица блоков переписывается целиком
+static void fs_set_layout(u32 block_size, u32 node_slots, u32 features) {
+    u32 sector = FS_NODE_START + node_slots * FS_NODE_SECTORS;
+
+    fs_block_size = block_size;
+    fs_block_sectors = block_size / SECTOR_SIZE;
+    fs_node_slots = node_slots;
+    fs_feature_flags = features;
+    fs_btable_start = sector;
+    sector += FS_BTABLE_SECTORS;
+    fs_hash_start = (features & FS_FEATURE_DEDUP) ? sector : 0;
+    if (fs_hash_start) sector += FS_HASH_SECTORS;
+    fs_crc_start = (features & FS_FEATURE_CRC) ? sector : 0;
+    if (fs_crc_start) sector += FS_CRC_SECTORS;
+    fs_snap_start = (features & FS_FEATURE_SNAP) ? sector : 0;
+    if (fs_snap_start) sector += FS_SNAP_SECTORS;
+    fs_data_start = sector;
+
+    fs_bcache_reset();
+    memset(fs_snaps, 0, sizeof(fs_snaps));
+    fs_snap_dirty = 1;
+    memset(fs_crcs, 0, sizeof(fs_crcs));
+    memset(fs_crc_dirty, 0xFF, sizeof(fs_crc_dirty));
+    memset(fs_btable, 0, sizeof(fs_btable));
+    memset(fs_btable_dirty, 0xFF, sizeof(fs_btable_dirty));
+    memset(fs_hashes, 0, sizeof(fs_hashes));
+    memset(fs_hash_dirty, 0xFF, sizeof(fs_hash_dirty));
+    for (int i = 0; i < FS_HASH_BUCKETS; i++) fs_hash_head[i] = FS_HASH_NONE;
+    fs_super_dirty = 1;
+}
+
+// Новый том; -1, если параметры вне допустимых пределов
+int fs_mkfs(u32 block_size, u32 node_slots, u32 features) {
+    if (block_size < FS_MIN_BLOCK_SIZE || block_size > FS_MAX_BLOCK_SIZE || (block_size & (block_size - 1))) return -1;
+    if (node_slots < FS_MIN_NODES || node_slots > MAX_FILES) return -1;
+
+    fs_set_layout(block_size, node_slots, features);
+    fs_count = 0;
+    fs_name_reset();
+    fs_alloc_hint = 0;
+    memset(fs_slot_map, 0, sizeof(fs_slot_map));
+    memset(fs_node_dirty, 0, sizeof(fs_node_dirty));
+    memset(fs_block_refs, 0, sizeof(fs_block_refs));
+    memset(fs_files, 0, sizeof(fs_files));
+    memset(fs_trigram_map, 0, sizeof(fs_trigram_map));
+    fs_node_create("/", 1);
+    strcpy(current_dir, "/");
+    fs_foreign = 0;
+    return 0;
+}
+
+// Секторов от начала диска до конца области данных
+u32 fs_volume_sectors(void) {
+    return fs_data_start + FS_MAX_BLOCKS * fs_block_sectors;
+}
+
+void fs_reset(u32 features) {
+    fs_mkfs(FS_DEFAULT_BLOCK_SIZE, FS_DEFAULT_NODES, features | FS_FEATURE_DEFAULT);
+}
+
+/* Paths
+ * A name is resolved in one pass: the base (root or current_dir) is copied
+ * once, then every component is appended, skipped ("." and empty ones) or
+ * popped (".."). The result has the node-table form and carries its length,
+ * so the callers compare and extend it without rescanning. */
+int fs_path_resolve(const char* name, FSPath* path) {
+    char* out = path->text;
+    u32 len = 0;
+    const char* p = name;
+
+    if (*p != '/' && !(current_dir[0] == '/' && current_dir[1] == '\0')) {
+        for (const char* c = current_dir; *c && len < MAX_PATH; c++) out[len++] = *c;
+        if (len > 0 && out[len - 1] == '/') len--;
+    }
+
+    while (*p) {
+        while (*p == '/') p++;
+        const char* part = p;
+        while (*p && *p != '/') p++;
+        u32 part_len = p - part;
+
+        if (part_len == 0 || (part_len == 1 && part[0] == '.')) continue;
+        if (part_len == 2 && part[0] == '.' && part[1] == '.') {
+            // Выше корня подняться нельзя
+            while (len > 0 && out[len - 1] != '/') len--;
+            if (len > 0) len--;
+            continue;
+        }
+        if (part_len >= MAX_NAME || len + 1 + part_len >= MAX_PATH) return -1;
+        if (len > 0) out[len++] = '/';
+        memcpy(out + len, (void*)part, part_len);
+        len += part_len;
+    }
+
+    if (len == 0) out[len++] = '/';
+    out[len] = '\0';
+    path->len = len;
+    return 0;
+}
+
+// Следующая компонента пути без копирования; 0, когда компоненты кончились
+int fs_path_next(const FSPath* path, u32* pos, const char** part, u32* part_len) {
+    u32 i = *pos;
+
+    if (path->len == 1 && path->text[0] == '/') return 0;
+    if (i >= path->len) return 0;
+    if (i > 0) i++;                          // разделитель после предыдущей
+    u32 first = i;
+    while (i < path->len && path->text[i] != '/') i++;
+    *part = path->text + first;
+    *part_len = i - first;
+    *pos = i;
+    return 1;
+}
+
+// Индекс узла в fs_cache или -1; путь проходится от корня по компонентам
+int fs_path_find(const FSPath* path) {
+    int index = fs_orphan_find("/", 1);
+    u32 pos = 0;
+    const char* part;
+    u32 part_len;
+
+    while (index >= 0 && fs_path_next(path, &pos, &part, &part_len)) {
+        u16 name = fs_name_lookup(part, part_len);
+        u32 dir = fs_cache[index].slot;
+        index = -1;
+        if (name == FS_NO_NAME) break;
+        for (int i = 0; i < fs_count; i++) {
+            if (fs_cache[i].parent == dir && fs_cache[i].name == name) {
+                index = i;
+                break;
+            }
+        }
+    }
+    // Записи без директории хранят полный путь
+    return index >= 0 ? index : fs_orphan_find(path->text, path->len);
+}
+
+static void fs_path_error(const char* name) {
+    prints("Error: Path too long: ");
+    prints(name);
+    newline();
+}
+
+/* RAM volume and overlay
+ * The archive is checked once when it is mounted; after that its paths and
+ * data are used in place. It is the read-only lower layer under WexFS:
+ * lookups fall through to it only when WexFS has no node with that path and
+ * no whiteout hides it. Writing to a lower file copies it up into WexFS
+ * first; removing a lower path records a whiteout in WexFS. */
+int fs_ram_mount(const void* archive, u32 length) {
+    const FSRamHeader* header = archive;
+    const u8* base = archive;
+
+    fs_ram_count = 0;
+    if (!archive || length < sizeof(FSRamHeader)) return -1;
+    if (header->magic != FS_RAM_MAGIC || header->version != FS_RAM_VERSION) return -1;
+    if (header->length > length || header->length < sizeof(FSRamHeader)) return -1;
+    if (header->count > (header->length - sizeof(FSRamHeader)) / sizeof(FSRamEntry)) return -1;
+
+    const FSRamEntry* entries = (const FSRamEntry*)(base + sizeof(FSRamHeader));
+    for (u32 i = 0; i < header->count; i++) {
+        const FSRamEntry* e = &entries[i];
+        if (e->path >= header->length || e->size > header->length) return -1;
+        if (e->data > header->length - e->size) return -1;
+
+        // Путь должен закончиться внутри архива, а пути идти по возрастанию
+        const char* path = (const char*)base + e->path;
+        u32 len = 0;
+        while (e->path + len < header->length && path[len] != '\0') len++;
+        if (len == 0 || len >= MAX_PATH || e->path + len >= header->length) return -1;
+        if (i > 0 && strcmp((const char*)base + entries[i - 1].path, path) >= 0) return -1;
+    }
+
+    fs_ram = base;
+    fs_ram_entries = entries;
+    fs_ram_count = header->count;
+    return (int)fs_ram_count;
+}
+
+static const char* fs_ram_path(u32 i) {
+    return (const char*)fs_ram + fs_ram_entries[i].path;
+}
+
+// Двоичный поиск по отсортированным путям архива
+static int fs_ram_find(const FSPath* path) {
+    u32 lo = 0, hi = fs_ram_count;
+    while (lo < hi) {
+        u32 mid = (lo + hi) / 2;
+        int cmp = strcmp(fs_ram_path(mid), path->text);
+        if (cmp == 0) return (int)mid;
+        if (cmp < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return -1;
+}
+
+// Лежит ли запись прямо в каталоге dir
+static int fs_ram_in_dir(u32 i, const FSPath* dir) {
+    const char* p = fs_ram_path(i);
+    u32 n = 0;
+
+    if (!(dir->len == 1 && dir->text[0] == '/')) {
+        for (; n < dir->len; n++) {
+            if (p[n] != dir->text[n]) return 0;
+        }
+        if (p[n++] != '/') return 0;
+    }
+    return strchr(p + n, '/') == NULL;
+}
+
+// Запись закрыта узлом WexFS с тем же путём
+static int fs_ram_shadowed(u32 i) {
+    FSPath path;
+    path.len = strlen(fs_ram_path(i));
+    strcpy(path.text, fs_ram_path(i));
+    return fs_path_find(&path) >= 0;
+}
+
+// Путь пометки удаления для первых len байт path: ".wh.<имя>" рядом с ним
+static int fs_whiteout_path(const char* path, u32 len, FSPath* out) {
+    u32 dir = len;
+    u32 prefix = strlen(FS_WHITEOUT);
+
+    while (dir > 0 && path[dir - 1] != '/') dir--;
+    if (len + prefix >= MAX_PATH) return -1;
+    memcpy(out->text, (void*)path, dir);
+    memcpy(out->text + dir, FS_WHITEOUT, prefix);
+    memcpy(out->text + dir + prefix, (void*)(path + dir), len - dir);
+    out->len = len + prefix;
+    out->text[out->len] = '\0';
+    return 0;
+}
+
+// Путь отметки непрозрачности директории из первых len байт path
+static int fs_opaque_path(const char* path, u32 len, FSPath* out) {
+    u32 marker = strlen(FS_OPAQUE);
+
+    if (len + 1 + marker >= MAX_PATH) return -1;
+    memcpy(out->text, (void*)path, len);
+    out->text[len] = '/';
+    strcpy(out->text + len + 1, FS_OPAQUE);
+    out->len = len + 1 + marker;
+    return 0;
+}
+
+// Запись нижнего слоя скрыта, если удалён её путь или путь над ней, либо
+// директория над ней пересоздана в WexFS и непрозрачна
+static int fs_lower_hidden(const char* path) {
+    FSPath probe;
+    u32 len = strlen(path);
+
+    for (u32 k = 1; k <= len; k++) {
+        if (path[k] != '/' && path[k] != '\0') continue;
+        if (fs_whiteout_path(path, k, &probe) == 0 && fs_path_find(&probe) >= 0) return 1;
+        if (k < len && fs_opaque_path(path, k, &probe) == 0 && fs_path_find(&probe) >= 0) return 1;
+    }
+    return 0;
+}
+
+// Видимая запись нижнего слоя или -1
+static int fs_lower_find(const FSPath* path) {
+    int ram = fs_ram_find(path);
+    if (ram < 0 || fs_lower_hidden(path->text)) return -1;
+    return ram;
+}
+
+// Имя служебного узла оверлея, которое не показывается в списках
+static int fs_overlay_marker(const char* name) {
+    const char* p = FS_WHITEOUT;
+    while (*p && *name == *p) {
+        name++;
+        p++;
+    }
+    return *p == '\0';
+}
+
+// Запись нижнего слоя видна: WexFS не закрывает её ни узлом, ни пометкой
+static int fs_ram_visible(u32 i) {
+    return !fs_ram_shadowed(i) && !fs_lower_hidden(fs_ram_path(i));
+}
+
+// Лежит ли путь где-то под директорией dir; корню принадлежит всё
+static int fs_path_below(const char* p, const FSPath* dir) {
+    if (dir->len == 1 && dir->text[0] == '/') return !(p[0] == '/' && p[1] == '\0');
+    for (u32 n = 0; n < dir->len; n++) {
+        if (p[n] != dir->text[n]) return 0;
+    }
+    return p[dir->len] == '/';
+}
+
+// 1 - директория, 0 - файл, -1 - пути нет ни в одном слое
+int fs_path_type(const FSPath* path) {
+    int index = fs_path_find(path);
+    if (index >= 0) return fs_overlay_marker(fs_node_name(&fs_cache[index])) ? -1 : fs_cache[index].is_dir;
+    int lower = fs_lower_find(path);
+    return lower >= 0 ? (int)fs_ram_entries[lower].is_dir : -1;
+}
+
+// Следующий путь под dir: сначала узлы WexFS, затем видимые записи нижнего
+// слоя; служебные узлы оверлея пропускаются. 0, когда пути кончились.
+int fs_tree_next(const FSPath* dir, u32* pos, char* path, int* is_dir) {
+    while (*pos < (u32)fs_count) {
+        FSNode* node = &fs_cache[(*pos)++];
+        if (fs_overlay_marker(fs_node_name(node))) continue;
+        fs_node_path(node, path);
+        if (!fs_path_below(path, dir)) continue;
+        *is_dir = node->is_dir;
+        return 1;
+    }
+    while (*pos - (u32)fs_count < fs_ram_count) {
+        u32 i = (*pos)++ - (u32)fs_count;
+        if (!fs_path_below(fs_ram_path(i), dir) || !fs_ram_visible(i)) continue;
+        strcpy(path, fs_ram_path(i));
+        *is_dir = (int)fs_ram_entries[i].is_dir;
+        return 1;
+    }
+    return 0;
+}
+
+// Новый узел в WexFS над нижним слоем: директории, которые есть только
+// внизу, сначала заводятся в WexFS, иначе узлу не к кому привязаться; его
+// пометка удаления снимается. Возвращает 1, если пометка была.
+static int fs_upper_prepare(const char* path) {
+    FSPath dir;
+    u32 len = strlen(path);
+
+    if (fs_ram_count == 0 || len >= MAX_PATH) return 0;
+    strcpy(dir.text, path);
+    for (u32 k = 1; k < len; k++) {
+        if (path[k] != '/') continue;
+        dir.text[k] = '\0';
+        dir.len = k;
+        if (fs_path_find(&dir) < 0) {
+            int ram = fs_lower_find(&dir);
+            if (ram < 0 || !fs_ram_entries[ram].is_dir || !fs_node_create(dir.text, 1)) break;
+        }
+        dir.text[k] = '/';
+    }
+
+    FSPath whiteout;
+    if (fs_whiteout_path(path, len, &whiteout) != 0) return 0;
+    int index = fs_path_find(&whiteout);
+    if (index < 0) return 0;
+    fs_node_remove(index);
+    return 1;
+}
+
+// Копия файла нижнего слоя в новом узле WexFS
+static int fs_copy_up(FSNode* node, int lower) {
+    const FSRamEntry* e = &fs_ram_entries[lower];
+    if (e->size == 0) return 0;
+    return fs_node_pwrite(node, fs_ram + e->data, e->size, 0) == (int)e->size ? 0 : -1;
+}
+
+int fs_unlink(const char* name) {
+    FSPath path;
+    if (fs_path_resolve(name, &path) != 0) return -1;
+
+    int index = fs_path_find(&path);
+    int lower = fs_lower_find(&path);
+    if (index < 0 && lower < 0) return -1;
+
+    // Пометка ставится до удаления узла: без свободного слота не меняется ничего
+    if (lower >= 0) {
+        FSPath whiteout;
+        if (fs_whiteout_path(path.text, path.len, &whiteout) != 0) return -2;
+        fs_upper_prepare(whiteout.text);
+        if (!fs_node_create(whiteout.text, 0)) return -2;
+        index = fs_path_find(&path);
+    }
+    if (index >= 0) fs_node_remove(index);
+    return 0;
+}
+
+/* File descriptors */
+static int fs_lookup(const char* name) {
+    FSPath path;
+    if (fs_path_resolve(name, &path) != 0) return -1;
+    return fs_path_find(&path);
+}
+
+static FSNode* fs_fd_node(int fd) {
+    if (fd < 0 || fd >= FS_MAX_FDS || !fs_files[fd].used || fs_files[fd].ram >= 0) return NULL;
+    return &fs_cache[fs_slot_index[fs_files[fd].slot]];
+}
+
+static const FSRamEntry* fs_fd_ram(int fd) {
+    if (fd < 0 || fd >= FS_MAX_FDS || !fs_files[fd].used || fs_files[fd].ram < 0) return NULL;
+    return &fs_ram_entries[fs_files[fd].ram];
+}
+
+static int fs_fd_alloc(u32 slot, int ram, int flags) {
+    for (int fd = 0; fd < FS_MAX_FDS; fd++) {
+        if (!fs_files[fd].used) {
+            fs_files[fd].used = 1;
+            fs_files[fd].flags = flags;
+            fs_files[fd].slot = slot;
+            fs_files[fd].ram = ram;
+            fs_files[fd].offset = 0;
+            return fd;
+        }
+    }
+    return -1;
+}
+
+int fs_open(const char* name, int flags) {
+    int index = fs_lookup(name);
+
+    if (index < 0) {
+        FSPath path;
+        if (fs_path_resolve(name, &path) != 0) return -1;
+
+        // Файл нижнего слоя читается на месте; для записи он сначала
+        // копируется в WexFS, а с FS_O_TRUNC копировать нечего
+        int lower = fs_lower_find(&path);
+        if (lower >= 0 && fs_ram_entries[lower].is_dir) return -1;
+        if (lower >= 0 && !(flags & (FS_O_WRITE | FS_O_TRUNC))) {
+            return fs_fd_alloc(FS_NO_SLOT, lower, flags);
+        }
+
+        if (lower < 0 && !(flags & FS_O_CREATE)) return -1;
+        fs_upper_prepare(path.text);
+        FSNode* created = fs_node_create(path.text, 0);
+        if (!created) return -1;
+        if (lower >= 0 && !(flags & FS_O_TRUNC) && fs_copy_up(created, lower) != 0) {
+            fs_node_remove(created - fs_cache);
+            return -1;
+        }
+        index = created - fs_cache;
+    }
+
+    if (fs_cache[index].is_dir) return -1;
+
+    int fd = fs_fd_alloc(fs_cache[index].slot, -1, flags);
+    if (fd >= 0 && (flags & FS_O_TRUNC)) fs_node_truncate(&fs_cache[index], 0);
+    return fd;
+}
+
+int fs_close(int fd) {
+    if (fs_fd_ram(fd)) {
+        fs_files[fd].used = 0;
+        return 0;
+    }
+    if (!fs_fd_node(fd)) return -1;
+    int flags = fs_files[fd].flags;
+    fs_files[fd].used = 0;
+    if (flags & FS_O_WRITE) fs_save_to_disk();
+    return 0;
+}
+
+int fs_pread(int fd, void* buf, u32 len, u32 offset) {
+    const FSRamEntry* ram = fs_fd_ram(fd);
+    if (ram) {
+        if (offset >= ram->size) return 0;
+        if (len > ram->size - offset) len = ram->size - offset;
+        memcpy(buf, (void*)(fs_ram + ram->data + offset), len);
+        return len;
+    }
+
+    FSNode* node = fs_fd_node(fd);
+    if (!node || !(fs_files[fd].flags & FS_O_READ)) return -1;
+    return fs_node_pread(node, buf, len, offset);
+}
+
+int fs_pwrite(int fd, const void* buf, u32 len, u32 offset) {
+    FSNode* node = fs_fd_node(fd);
+    if (!node || !(fs_files[fd].flags & FS_O_WRITE)) return -1;
+    return fs_node_pwrite(node, buf, len, offset);
+}
+
+int fs_read(int fd, void* buf, u32 len) {
+    if (!fs_fd_node(fd) && !fs_fd_ram(fd)) return -1;
+    int n = fs_pread(fd, buf, len, fs_files[fd].offset);
+    if (n > 0) fs_files[fd].offset += n;
+    return n;
+}
+
+int fs_write(int fd, const void* buf, u32 len) {
+    FSNode* node = fs_fd_node(fd);
+    if (!node) return -1;
+    if (fs_files[fd].flags & FS_O_APPEND) fs_files[fd].offset = node->size;
+    int n = fs_pwrite(fd, buf, len, fs_files[fd].offset);
+    if (n > 0) fs_files[fd].offset += n;
+    return n;
+}
+
+int fs_lseek(int fd, int offset, int whence) {
+    FSNode* node = fs_fd_node(fd);
+    const FSRamEntry* ram = fs_fd_ram(fd);
+    if (!node && !ram) return -1;
+
+    int base = 0;
+    if (whence == FS_SEEK_CUR) base = fs_files[fd].offset;
+    else if (whence == FS_SEEK_END) base = node ? node->size : ram->size;
+    else if (whence != FS_SEEK_SET) return -1;
+
+    if (base + offset < 0) return -1;
+    fs_files[fd].offset = base + offset;
+    return fs_files[fd].offset;
+}
+
+int fs_truncate(int fd, u32 size) {
+    FSNode* node = fs_fd_node(fd);
+    if (!node || !(fs_files[fd].flags & FS_O_WRITE)) return -1;
+    return fs_node_truncate(node, size);
+}
+
+/* File views
+ * Pages are read straight from the block cache buffers, so a mapped file is
+ * never copied. A page opened for writing is made private to the file
+ * (copy-on-write) when it is faulted in. It then stays dirty and is not
+ * merged with equal blocks until the view lets it go. Inline files are
+ * mapped in place from their block map. */
+static FSView* fs_view_get(int view) {
+    if (view < 0 || view >= FS_MAX_VIEWS || !fs_views[view].used) return NULL;
+    return &fs_views[view];
+}
+
+static void fs_view_drop(FSView* v, u32 page) {
+    FSCacheEntry* e = v->entry[page];
+    if (!e) return;
+    e->pins--;
+    if (v->prot & FS_MAP_WRITE) e->write_pins--;
+    fs_bcache_pinned--;
+    v->entry[page] = NULL;
+}
+
+static void fs_view_release(FSView* v) {
+    for (u32 p = 0; p < FS_VIEW_PAGES; p++) fs_view_drop(v, p);
+}
+
+// Есть ли открытые на запись виды; фоновые проходы их не трогают
+static int fs_view_writing(void) {
+    for (int i = 0; i < FS_MAX_VIEWS; i++) {
+        if (fs_views[i].used && (fs_views[i].prot & FS_MAP_WRITE)) return 1;
+    }
+    return 0;
+}
+
+// Том занят: открыта транзакция или записываемый вид. Грязные блоки
+// в кэше ещё не на диске, и менять дерево целиком в это время нельзя.
+static int fs_volume_busy(void) {
+    return fs_txn_depth > 0 || fs_view_writing();
+}
+
+int fs_mmap(int fd, int prot) {
+    FSNode* node = fs_fd_node(fd);
+    if ((!node && !fs_fd_ram(fd)) || !(prot & (FS_MAP_READ | FS_MAP_WRITE))) return -1;
+    if ((prot & FS_MAP_WRITE) && !(fs_files[fd].flags & FS_O_WRITE)) return -1;
+    if ((prot & FS_MAP_READ) && !(fs_files[fd].flags & FS_O_READ)) return -1;
+
+    for (int view = 0; view < FS_MAX_VIEWS; view++) {
+        FSView* v = &fs_views[view];
+        if (v->used) continue;
+        memset(v, 0, sizeof(FSView));
+        v->used = 1;
+        v->prot = prot;
+        v->slot = node ? node->slot : FS_NO_SLOT;
+        v->ram = node ? -1 : fs_files[fd].ram;
+        return view;
+    }
+    return -1;
+}
+
+// Адрес байта offset и число байт до конца страницы; NULL за концом файла
+char* fs_view_page(int view, u32 offset, u32* avail) {
+    FSView* v = fs_view_get(view);
+    if (!v) return NULL;
+
+    // Файл RAM-тома целиком лежит в памяти и отдаётся одной страницей
+    if (v->ram >= 0) {
+        const FSRamEntry* e = &fs_ram_entries[v->ram];
+        if (offset >= e->size) return NULL;
+        *avail = e->size - offset;
+        return (char*)fs_ram + e->data + offset;
+    }
+
+    if (v->slot == FS_NO_SLOT) return NULL;
+    FSNode* node = &fs_cache[fs_slot_index[v->slot]];
+    if (offset >= node->size) return NULL;
+
+    if (FS_NODE_INLINE(node)) {
+        if (v->prot & FS_MAP_WRITE) fs_node_set_dirty(node);
+        *avail = node->size - offset;
+        return fs_inline_data(node) + offset;
+    }
+
+    u32 index = offset / fs_block_size;
+    u32 pos = offset % fs_block_size;
+    *avail = fs_block_size - pos;
+    if (*avail > node->size - offset) *avail = node->size - offset;
+
+    // Страница уже в окне, если её буфер всё ещё держит блок файла;
+    // страница для записи к тому же не должна стать общей
+    for (u32 p = 0; p < FS_VIEW_PAGES; p++) {
+        FSCacheEntry* e = v->entry[p];
+        if (!e || v->index[p] != index || e->block != FS_NODE_MAP(node)[index]) continue;
+        if ((v->prot & FS_MAP_WRITE) && fs_block_refs[e->block] != 1) continue;
+        return e->data + pos;
+    }
+
+    // Промах: место в окне освобождает самая старая страница
+    u32 page = v->next;
+    v->next = (v->next + 1) % FS_VIEW_PAGES;
+    fs_view_drop(v, page);
+    if (fs_bcache_pinned + 1 >= fs_bcache_count) return NULL;
+
+    FSCacheEntry* e;
+    if (v->prot & FS_MAP_WRITE) {
+        char* data = fs_node_block_writable(node, index, 1);
+        if (!data) return NULL;
+        e = fs_bcache_get(FS_NODE_MAP(node)[index], 1);
+        e->write_pins++;
+    } else if (FS_NODE_MAP(node)[index] == FS_NO_BLOCK) {
+        // Дыра в файле читается как нули; буфер не привязан к блоку
+        e = fs_bcache_get(FS_NO_BLOCK, 0);
+        memset(e->data, 0, fs_block_size);
+    } else {
+        e = fs_bcache_get(FS_NODE_MAP(node)[index], 1);
+    }
+    e->pins++;
+    fs_bcache_pinned++;
+    v->index[page] = index;
+    v->entry[page] = e;
+    return e->data + pos;
+}
+
+// Записанные страницы уходят на диск; окно вида пустеет
+int fs_msync(int view) {
+    FSView* v = fs_view_get(view);
+    if (!v) return -1;
+    fs_view_release(v);
+    if (v->prot & FS_MAP_WRITE) fs_save_to_disk();
+    return 0;
+}
+
+int fs_munmap(int view) {
+    if (fs_msync(view) != 0) return -1;
+    fs_views[view].used = 0;
+    return 0;
+}
+
+/* Snapshots
+ * A snapshot is a manifest of the node table written to its own data
+ * blocks, plus one extra reference on every data block it names. Taking
+ * one copies no file data: blocks are shared with the live tree and the
+ * copy-on-write path duplicates only those written afterwards. */
+typedef struct {
+    u32 size;
+    u16 is_dir;
+    u16 name_len;
+    u32 words;               /* block pointers, or inline data words */
+} FSSnapEntry;
+
+static u8 fs_snap_buffer[FS_MAX_BLOCK_SIZE];
+static u32 fs_snap_loaded = FS_NO_BLOCK;
+
+/* A manifest of up to FS_SNAP_BLOCKS blocks is listed in the snapshot entry
+ * itself. A longer one keeps a single index block there instead, and the
+ * list lives in that block. The list is capped at what an index block holds
+ * at the smallest block size; a tree whose manifest would be longer (many
+ * hundreds of nodes with long paths) cannot be snapshotted. */
+#define FS_SNAP_MAX_MAP (FS_MIN_BLOCK_SIZE / 4)
+
+static u32 fs_snap_map[FS_SNAP_MAX_MAP];    // блоки манифеста по порядку
+static u32 fs_snap_map_count = 0;
+
+static int fs_snap_indirect(const FSSnapshot* snap) {
+    return snap->length > FS_SNAP_BLOCKS * fs_block_size;
+}
+
+// Список блоков манифеста для чтения. Если индексный блок испорчен,
+// список пуст и fs_snap_next() сообщит о повреждении.
+static void fs_snap_open(const FSSnapshot* snap) {
+    u32 count = (snap->length + fs_block_size - 1) / fs_block_size;
+
+    fs_snap_loaded = FS_NO_BLOCK;
+    fs_snap_map_count = 0;
+    if (count > FS_SNAP_MAX_MAP) return;
+    if (!fs_snap_indirect(snap)) {
+        for (u32 m = 0; m < count; m++) fs_snap_map[m] = snap->manifest[m];
+    } else {
+        if (snap->manifest[0] >= FS_MAX_BLOCKS) return;
+        fs_read_block(snap->manifest[0], (char*)fs_snap_buffer);
+        memcpy(fs_snap_map, fs_snap_buffer, count * 4);
+    }
+    fs_snap_map_count = count;
+}
+
+// Снимает ссылки с блоков самого манифеста; список должен быть открыт
+static void fs_snap_release_manifest(const FSSnapshot* snap) {
+    for (u32 m = 0; m < FS_SNAP_BLOCKS; m++) fs_block_release(snap->manifest[m]);
+    if (fs_snap_indirect(snap)) {
+        for (u32 m = 0; m < fs_snap_map_count; m++) fs_block_release(fs_snap_map[m]);
+    }
+}
+
+static int fs_snap_find(const char* name) {
+    for (int i = 0; i < FS_MAX_SNAPSHOTS; i++) {
+        if (fs_snaps[i].serial && strcmp(fs_snaps[i].name, name) == 0) return i;
+    }
+    return -1;
+}
+
+// Дописывает байты в манифест; заполненные блоки сразу уходят на диск
+static int fs_snap_put(FSSnapshot* snap, const void* data, u32 len) {
+    const u8* src = (const u8*)data;
+
+    fs_snap_loaded = FS_NO_BLOCK;
+    while (len > 0) {
+        u32 pos = snap->length % fs_block_size;
+        u32 chunk = fs_block_size - pos;
+        if (chunk > len) chunk = len;
+        memcpy(fs_snap_buffer + pos, (void*)src, chunk);
+        snap->length += chunk;
+        src += chunk;
+        len -= chunk;
+
+        if (pos + chunk == fs_block_size) {
+            u32 index = snap->length / fs_block_size - 1;
+            if (index >= FS_SNAP_MAX_MAP) return -1;
+            u32 block = fs_block_alloc();
+            if (block == FS_NO_BLOCK) return -1;
+            fs_snap_map[index] = block;
+            fs_snap_map_count = index + 1;
+            fs_write_block(block, (char*)fs_snap_buffer);
+        }
+    }
+    return 0;
+}
+
+// Последний неполный блок манифеста и список блоков в записи снимка
+static int fs_snap_finish(FSSnapshot* snap) {
+    u32 pos = snap->length % fs_block_size;
+    u32 block;
+
+    if (pos != 0) {
+        u32 index = snap->length / fs_block_size;
+        if (index >= FS_SNAP_MAX_MAP) return -1;
+        block = fs_block_alloc();
+        if (block == FS_NO_BLOCK) return -1;
+        memset(fs_snap_buffer + pos, 0, fs_block_size - pos);
+        fs_snap_map[index] = block;
+        fs_snap_map_count = index + 1;
+        fs_write_block(block, (char*)fs_snap_buffer);
+    }
+
+    if (!fs_snap_indirect(snap)) {
+        for (u32 m = 0; m < fs_snap_map_count; m++) snap->manifest[m] = fs_snap_map[m];
+        return 0;
+    }
+    block = fs_block_alloc();
+    if (block == FS_NO_BLOCK) return -1;
+    memset(fs_snap_buffer, 0xFF, fs_block_size);
+    memcpy(fs_snap_buffer, fs_snap_map, fs_snap_map_count * 4);
+    snap->manifest[0] = block;
+    fs_write_block(block, (char*)fs_snap_buffer);
+    return 0;
+}
+
+static int fs_snap_get(const FSSnapshot* snap, u32* offset, void* data, u32 len) {
+    u8* dst = (u8*)data;
+
+    if (*offset + len > snap->length) return -1;
+    while (len > 0) {
+        u32 index = *offset / fs_block_size;
+        u32 pos = *offset % fs_block_size;
+        u32 block = index < fs_snap_map_count ? fs_snap_map[index] : FS_NO_BLOCK;
+        if (block >= FS_MAX_BLOCKS) return -1;
+        if (fs_snap_loaded != block) {
+            fs_read_block(block, (char*)fs_snap_buffer);
+            fs_snap_loaded = block;
+        }
+        u32 chunk = fs_block_size - pos;
+        if (chunk > len) chunk = len;
+        memcpy(dst, fs_snap_buffer + pos, chunk);
+        *offset += chunk;
+        dst += chunk;
+        len -= chunk;
+    }
+    return 0;
+}
+
+// Следующая запись манифеста в node, blocks и name; 0 в конце, -1 при повреждении
+static int fs_snap_next(const FSSnapshot* snap, u32* offset, FSNode* node, u32* blocks, char* name) {
+    FSSnapEntry entry;
+
+    if (*offset >= snap->length) return 0;
+    if (fs_snap_get(snap, offset, &entry, sizeof(entry)) != 0) return -1;
+    if (entry.name_len == 0 || entry.name_len >= MAX_PATH || entry.words > FS_NODE_BLOCKS) return -1;
+    if (fs_snap_get(snap, offset, name, entry.name_len) != 0) return -1;
+    name[entry.name_len] = '\0';
+    node->is_dir = entry.is_dir;
+    node->size = entry.size;
+    for (u32 i = 0; i < FS_NODE_BLOCKS; i++) blocks[i] = FS_NO_BLOCK;
+    if (fs_snap_get(snap, offset, blocks, entry.words * 4) != 0) return -1;
+    return 1;
+}
+
+// Ссылки снимков на блоки: манифест и все блоки перечисленных в нём файлов
+static void fs_snap_refs(u16* refs) {
+    FSNode node;
+    u32 blocks[FS_NODE_BLOCKS];
+    char name[MAX_PATH];
+
+    for (int i = 0; i < FS_MAX_SNAPSHOTS; i++) {
+        FSSnapshot* snap = &fs_snaps[i];
+        if (!snap->serial) continue;
+        fs_snap_open(snap);
+        for (u32 m = 0; m < FS_SNAP_BLOCKS; m++) {
+            if (snap->manifest[m] < FS_MAX_BLOCKS) refs[snap->manifest[m]]++;
+        }
+        for (u32 m = 0; fs_snap_indirect(snap) && m < fs_snap_map_count; m++) {
+            if (fs_snap_map[m] < FS_MAX_BLOCKS) refs[fs_snap_map[m]]++;
+        }
+        u32 offset = 0;
+        while (fs_snap_next(snap, &offset, &node, blocks, name) > 0) {
+            if (node.is_dir || FS_MAP_INLINE(blocks)) continue;
+            for (u32 b = 0; b < FS_NODE_BLOCKS; b++) {
+                if (blocks[b] < FS_MAX_BLOCKS) refs[blocks[b]]++;
+            }
+        }
+    }
+}
+
+static void fs_write_snaps(void) {
+    if (!fs_snap_start || !fs_snap_dirty) return;
+    fs_crc_set(FS_CRC_SNAP, fs_snaps, SECTOR_SIZE);
+    ata_write_sector(fs_snap_start, (u8*)fs_snaps);
+    fs_snap_dirty = 0;
+}
+
+int fs_snapshot_create(const char* name) {
+    FSSnapshot snap;
+    u32 name_len = strlen(name);
+
+    if (!fs_snap_start) return -1;
+    if (name_len == 0 || name_len >= sizeof(snap.name) || fs_snap_find(name) >= 0) return -1;
+    // Грязные блоки кэша ещё переедут при фиксации вместе со всеми
+    // ссылками, включая ссылки снимка
+    if (fs_volume_busy()) return -1;
+
+    int free_entry = -1;
+    u32 serial = 0;
+    for (int i = 0; i < FS_MAX_SNAPSHOTS; i++) {
+        if (!fs_snaps[i].serial && free_entry < 0) free_entry = i;
+        if (fs_snaps[i].serial > serial) serial = fs_snaps[i].serial;
+    }
+    if (free_entry < 0) return -1;
+
+    // В кэше не должно остаться грязных блоков, иначе снимок увидит старые данные
+    fs_save_to_disk();
+
+    memset(&snap, 0, sizeof(snap));
+    strcpy(snap.name, name);
+    for (u32 m = 0; m < FS_SNAP_BLOCKS; m++) snap.manifest[m] = FS_NO_BLOCK;
+    fs_snap_map_count = 0;
+
+    for (int i = 0; i < fs_count; i++) {
+        FSNode* node = &fs_cache[i];
+        FSSnapEntry entry;
+        char path[MAX_PATH];
+        entry.size = node->size;
+        entry.is_dir = node->is_dir;
+        entry.name_len = fs_node_path(node, path);
+        if (node->is_dir) {
+            entry.words = 0;
+        } else if (FS_NODE_INLINE(node)) {
+            entry.words = 1 + (node->size + 3) / 4;
+        } else {
+            entry.words = fs_node_block_count(node->size);
+        }
+        if (fs_snap_put(&snap, &entry, sizeof(entry)) != 0 ||
+            fs_snap_put(&snap, path, entry.name_len) != 0 ||
+            fs_snap_put(&snap, FS_NODE_MAP(node), entry.words * 4) != 0) {
+            break;
+        }
+        snap.nodes++;
+        if (!node->is_dir) snap.bytes += node->size;
+    }
+
+    if (snap.nodes != (u32)fs_count || fs_snap_finish(&snap) != 0) {
+        for (u32 m = 0; m < fs_snap_map_count; m++) fs_block_release(fs_snap_map[m]);
+        return -1;
+    }
+
+    for (int i = 0; i < fs_count; i++) {
+        FSNode* node = &fs_cache[i];
+        if (node->is_dir || FS_NODE_INLINE(node)) continue;
+        for (u32 b = 0; b < FS_NODE_BLOCKS; b++) {
+            if (FS_NODE_MAP(node)[b] != FS_NO_BLOCK) fs_block_refs[FS_NODE_MAP(node)[b]]++;
+        }
+    }
+
+    snap.serial = serial + 1;
+    fs_snaps[free_entry] = snap;
+    fs_snap_dirty = 1;
+    fs_dirty = 1;
+    fs_save_to_disk();
+    return 0;
+}
+
+int fs_snapshot_delete(const char* name) {
+    int index = fs_snap_find(name);
+    if (index < 0) return -1;
+
+    FSSnapshot* snap = &fs_snaps[index];
+    FSNode node;
+    u32 blocks[FS_NODE_BLOCKS];
+    char path[MAX_PATH];
+    u32 offset = 0;
+
+    fs_snap_open(snap);
+    while (fs_snap_next(snap, &offset, &node, blocks, path) > 0) {
+        if (node.is_dir || FS_MAP_INLINE(blocks)) continue;
+        for (u32 b = 0; b < FS_NODE_BLOCKS; b++) fs_block_release(blocks[b]);
+    }
+    fs_snap_release_manifest(snap);
+
+    memset(snap, 0, sizeof(FSSnapshot));
+    fs_snap_dirty = 1;
+    fs_dirty = 1;
+    fs_save_to_disk();
+    return 0;
+}
+
+// Заменяет живое дерево содержимым снимка; сам снимок остаётся
+int fs_snapshot_rollback(const char* name) {
+    int index = fs_snap_find(name);
+    if (index < 0) return -1;
+
+    FSSnapshot* snap = &fs_snaps[index];
+    FSNode entry;
+    u32 blocks[FS_NODE_BLOCKS];
+    char path[MAX_PATH];
+    u32 offset = 0;
+
+    // Записываемый вид держит страницу удаляемого файла, а в транзакции
+    // подмена дерева не дошла бы до диска
+    if (fs_volume_busy()) return -1;
+
+    // Манифест проверяется целиком до того, как что-то будет удалено
+    fs_snap_open(snap);
+    int status;
+    while ((status = fs_snap_next(snap, &offset, &entry, blocks, path)) > 0) {
+    }
+    if (status < 0) return -1;
+
+    fs_save_to_disk();
+    while (fs_count > 0) fs_node_remove(fs_count - 1);
+
+    offset = 0;
+    while (fs_snap_next(snap, &offset, &entry, blocks, path) > 0) {
+        FSNode* node = fs_node_create(path, entry.is_dir);
+        if (!node) break;
+        if (entry.is_dir) continue;
+
+        memcpy(FS_NODE_MAP(node), blocks, sizeof(FS_NODE_MAP(node)));
+        if (!FS_NODE_INLINE(node)) {
+            for (u32 b = 0; b < FS_NODE_BLOCKS; b++) {
+                if (FS_NODE_MAP(node)[b] < FS_MAX_BLOCKS) {
+                    fs_block_refs[FS_NODE_MAP(node)[b]]++;
+                } else {
+                    FS_NODE_MAP(node)[b] = FS_NO_BLOCK;
+                }
+            }
+        }
+        fs_node_set_size(node, entry.size);
+    }
+
+    if (fs_count == 0) fs_node_create("/", 1);
+    strcpy(current_dir, "/");
+    fs_dirty = 1;
+    fs_save_to_disk();
+    return 0;
+}
+
+/* Defragmentation
+ * Nodes are moved to the lowest slots in path order, so a directory and its
+ * children sit next to each other in the node table. Then file blocks are
+ * laid out one after another in the same order. Each step moves a few
+ * nodes or blocks and commits. A block is always copied to a free block
+ * before the node is repointed, and the old block is freed only after the
+ * node record is on disk. Shared blocks and snapshot manifests stay put. */
+#define FS_DEFRAG_SLICE 8
+
+enum { DEFRAG_NODES, DEFRAG_BLOCKS, DEFRAG_DONE };
+
+typedef struct {
+    int phase;
+    int background;
+    u32 generation;
+    u32 next;                      // позиция в order
+    u32 index;                     // блок внутри файла
+    u32 cursor;                    // следующий целевой блок
+    u32 moved_nodes;
+    u32 moved_blocks;
+    u16 order[MAX_FILES];          // индексы fs_cache в порядке путей
+    u32 owner[FS_MAX_BLOCKS];      // слот * FS_NODE_BLOCKS + индекс или FS_NO_SLOT
+    u32 pending[FS_DEFRAG_SLICE + 1];
+    u32 pending_count;
+} FSDefrag;
+
+static FSDefrag fs_defrag;
+static int fs_defrag_enabled = 0;
+
+// Порядок путей: корень первым, затем по имени, так дети идут за своей директорией
+static void fs_defrag_sort(void) {
+    char a[MAX_PATH];
+    char b[MAX_PATH];
+
+    for (int i = 0; i < fs_count; i++) {
+        int j = i;
+        fs_node_path(&fs_cache[i], b);
+        while (j > 0) {
+            fs_node_path(&fs_cache[fs_defrag.order[j - 1]], a);
+            if (strcmp(b, "/") != 0 && (strcmp(a, "/") == 0 || strcmp(a, b) <= 0)) break;
+            fs_defrag.order[j] = fs_defrag.order[j - 1];
+            j--;
+        }
+        fs_defrag.order[j] = i;
+    }
+}
+
+static void fs_defrag_start(int background) {
+    memset(&fs_defrag, 0, sizeof(fs_defrag));
+    fs_defrag.background = background;
+    fs_defrag_sort();
+    fs_defrag.generation = fs_generation;
+}
+
+// Переносит узел в свободный слот; старый слот освобождается вместе с суперблоком
+static void fs_node_move_slot(FSNode* node, u32 slot) {
+    u32 old = node->slot;
+
+    fs_name_index(node, 0);
+    BIT_CLEAR(fs_slot_map, old);
+    BIT_CLEAR(fs_node_dirty, old);
+    memcpy(fs_node_maps[slot], fs_node_maps[old], sizeof(fs_node_maps[slot]));
+    node->slot = slot;
+    BIT_SET(fs_slot_map, slot);
+    fs_slot_index[slot] = node - fs_cache;
+    fs_name_index(node, 1);
+
+    for (int i = 0; i < fs_count; i++) {
+        if (fs_cache[i].parent == old) fs_cache[i].parent = slot;
+    }
+    for (int fd = 0; fd < FS_MAX_FDS; fd++) {
+        if (fs_files[fd].used && fs_files[fd].slot == old) fs_files[fd].slot = slot;
+    }
+    for (int i = 0; i < FS_MAX_VIEWS; i++) {
+        if (fs_views[i].used && fs_views[i].slot == old) fs_views[i].slot = slot;
+    }
+    fs_node_set_dirty(node);
+    fs_super_dirty = 1;
+}
+
+// Один шаг уплотнения таблицы узлов; возвращает число перемещений
+static u32 fs_defrag_nodes(void) {
+    while (fs_defrag.next < (u32)fs_count) {
+        u32 target = fs_defrag.next;
+        FSNode* node = &fs_cache[fs_defrag.order[target]];
+        if (node->slot == target) {
+            fs_defrag.next++;
+            continue;
+        }
+
+        if (BIT_TEST(fs_slot_map, target)) {
+            // Занявший слот узел сначала уходит в свободный слот за хвостом
+            u32 spare = fs_count;
+            while (spare < fs_node_slots && BIT_TEST(fs_slot_map, spare)) spare++;
+            if (spare == fs_node_slots) {
+                fs_defrag.next = fs_count;
+                return 0;
+            }
+            fs_node_move_slot(fs_slot_node(target), spare);
+        } else {
+            fs_node_move_slot(node, target);
+            fs_defrag.next++;
+        }
+        fs_defrag.moved_nodes++;
+        return 1;
+    }
+    return 0;
+}
+
+static void fs_defrag_owners(void) {
+    for (u32 b = 0; b < FS_MAX_BLOCKS; b++) fs_defrag.owner[b] = FS_NO_SLOT;
+    for (int i = 0; i < fs_count; i++) {
+        FSNode* node = &fs_cache[i];
+        if (node->is_dir || FS_NODE_INLINE(node)) continue;
+        for (u32 b = 0; b < FS_NODE_BLOCKS; b++) {
+            u32 block = FS_NODE_MAP(node)[b];
+            if (block < FS_MAX_BLOCKS && fs_block_refs[block] == 1) {
+                fs_defrag.owner[block] = node->slot * FS_NODE_BLOCKS + b;
+            }
+        }
+    }
+}
+
+static int fs_defrag_pending(u32 block) {
+    for (u32 i = 0; i < fs_defrag.pending_count; i++) {
+        if (fs_defrag.pending[i] == block) return 1;
+    }
+    return 0;
+}
+
+// Копирует блок index узла в свободный target и перенаправляет узел
+static void fs_defrag_move(FSNode* node, u32 index, u32 target) {
+    u32 src = FS_NODE_MAP(node)[index];
+    const char* data = fs_block_peek(src);
+
+    fs_block_refs[target] = 1;
+    fs_write_block(target, (char*)data);
+    if (fs_hashes[src].flags & FS_HASH_VALID) {
+        fs_hashes[target].hash_lo = fs_hashes[src].hash_lo;
+        fs_hashes[target].hash_hi = fs_hashes[src].hash_hi;
+        fs_hashes[target].flags |= FS_HASH_VALID;
+        fs_hash_unlink(src);
+        fs_hash_link(target);
+        BIT_SET(fs_hash_dirty, target / FS_HASH_PER_SECTOR);
+    }
+    fs_bcache_drop(src);
+
+    FS_NODE_MAP(node)[index] = target;
+    fs_defrag.owner[target] = node->slot * FS_NODE_BLOCKS + index;
+    fs_defrag.owner[src] = FS_NO_SLOT;
+    fs_defrag.pending[fs_defrag.pending_count++] = src;
+    fs_node_set_dirty(node);
+    fs_defrag.moved_blocks++;
+}
+
+// Один шаг раскладки блоков; возвращает число перемещений
+static u32 fs_defrag_blocks(void) {
+    u32 moves = 0;
+
+    fs_defrag_owners();
+    while (moves < FS_DEFRAG_SLICE && fs_defrag.next < (u32)fs_count && fs_defrag.cursor < FS_MAX_BLOCKS) {
+        FSNode* node = &fs_cache[fs_defrag.order[fs_defrag.next]];
+        u32 used = (node->is_dir || FS_NODE_INLINE(node)) ? 0 : fs_node_block_count(node->size);
+        if (fs_defrag.index >= used) {
+            fs_defrag.next++;
+            fs_defrag.index = 0;
+            continue;
+        }
+
+        u32 src = FS_NODE_MAP(node)[fs_defrag.index];
+        u32 target = fs_defrag.cursor;
+        if (src == target) {
+            fs_defrag.cursor++;
+            fs_defrag.index++;
+            continue;
+        }
+        if (src >= FS_MAX_BLOCKS || fs_block_refs[src] != 1) {
+            // Дыры и общие блоки остаются на месте
+            fs_defrag.index++;
+            continue;
+        }
+        if (fs_defrag_pending(target)) break;
+        if (fs_block_refs[target] == 0) {
+            fs_defrag_move(node, fs_defrag.index, target);
+            fs_defrag.cursor++;
+            fs_defrag.index++;
+            moves++;
+            continue;
+        }
+        if (fs_defrag.owner[target] == FS_NO_SLOT) {
+            // Общий блок или манифест снимка: его место пропускается
+            fs_defrag.cursor++;
+            continue;
+        }
+
+        // Блок чужого файла уезжает в самый дальний свободный блок
+        u32 spare = FS_MAX_BLOCKS - 1;
+        while (spare > target && (fs_block_refs[spare] != 0 || fs_defrag_pending(spare))) spare--;
+        if (spare == target) {
+            fs_defrag.cursor = FS_MAX_BLOCKS;
+            break;
+        }
+        u32 owner = fs_defrag.owner[target];
+        fs_defrag_move(fs_slot_node(owner / FS_NODE_BLOCKS), owner % FS_NODE_BLOCKS, spare);
+        moves++;
+        // Освободившийся блок можно занять только после сохранения
+        break;
+    }
+
+    if (fs_defrag.next >= (u32)fs_count || fs_defrag.cursor >= FS_MAX_BLOCKS) fs_defrag.phase = DEFRAG_DONE;
+    return moves;
+}
+
+// Один ограниченный шаг с фиксацией; возвращает 1, когда раскладка закончена
+static int fs_defrag_step(void) {
+    if (fs_defrag.phase == DEFRAG_NODES) {
+        if (fs_defrag_nodes() == 0) {
+            fs_defrag.phase = DEFRAG_BLOCKS;
+            fs_defrag.next = 0;
+            fs_defrag_sort();
+        }
+    } else if (fs_defrag.phase == DEFRAG_BLOCKS) {
+        fs_defrag_blocks();
+    }
+
+    fs_save_to_disk();
+    for (u32 i = 0; i < fs_defrag.pending_count; i++) fs_block_release(fs_defrag.pending[i]);
+    if (fs_defrag.pending_count) {
+        fs_defrag.pending_count = 0;
+        fs_dirty = 1;
+        fs_save_to_disk();
+    }
+    fs_defrag.generation = fs_generation;
+    return fs_defrag.phase == DEFRAG_DONE;
+}
+
+// Число непрерывных участков при чтении всех файлов в порядке путей
+static u32 fs_defrag_extents(void) {
+    u32 extents = 0;
+    u32 last = FS_NO_BLOCK;
+
+    fs_defrag_sort();
+    for (int i = 0; i < fs_count; i++) {
+        FSNode* node = &fs_cache[fs_defrag.order[i]];
+        if (node->is_dir || FS_NODE_INLINE(node)) continue;
+        u32 used = fs_node_block_count(node->size);
+        for (u32 b = 0; b < used; b++) {
+            u32 block = FS_NODE_MAP(node)[b];
+            if (block == FS_NO_BLOCK) continue;
+            if (last == FS_NO_BLOCK || block != last + 1) extents++;
+            last = block;
+        }
+    }
+    return extents;
+}
+
+// Один шаг фоновой дефрагментации; вызывается из цикла оболочки
+void fs_defrag_tick(void) {
+    if (!fs_defrag_enabled || fs_volume_busy()) return;
+    if (!fs_defrag.background || fs_defrag.generation != fs_generation) fs_defrag_start(1);
+    if (fs_defrag_step()) fs_defrag_enabled = 0;
+}
+
+/* Disk I/O */
+static void fs_write_node(FSNode* node) {
+    u8 record[FS_NODE_SECTORS * SECTOR_SIZE];
+    FSDiskNode* disk = (FSDiskNode*)record;
+
+    memset(record, 0, sizeof(record));
+    fs_node_path(node, disk->name);
+    disk->is_dir = node->is_dir;
+    disk->size = node->size;
+    memcpy(disk->blocks, FS_NODE_MAP(node), sizeof(disk->blocks));
+    if (fs_crc_start) disk->checksum = fs_crc32c(disk, sizeof(FSDiskNode));
+
+    for (int j = 0; j < FS_NODE_SECTORS; j++) {
+        ata_write_sector(FS_NODE_START + node->slot * FS_NODE_SECTORS + j, record + j * SECTOR_SIZE);
+    }
+}
+
+static void fs_write_superblock(void) {
+    u8 sector_buffer[SECTOR_SIZE];
+    FSSuperblock* sb = (FSSuperblock*)sector_buffer;
+
+    memset(sector_buffer, 0, SECTOR_SIZE);
+    sb->magic = FS_MAGIC;
+    sb->version = FS_VERSION;
+    sb->node_start = FS_NODE_START;
+    sb->node_slots = fs_node_slots;
+    sb->node_sectors = FS_NODE_SECTORS;
+    sb->data_start = fs_data_start;
+    sb->block_count = FS_MAX_BLOCKS;
+    sb->block_sectors = fs_block_sectors;
+    sb->node_count = fs_count;
+    memcpy(sb->slot_map, fs_slot_map, sizeof(sb->slot_map));
+    memcpy(sb->slot_map_high, fs_slot_map + sizeof(sb->slot_map), sizeof(sb->slot_map_high));
+    sb->features = fs_feature_flags;
+    sb->btable_start = fs_btable_start;
+    sb->hash_start = fs_hash_start;
+    sb->crc_start = fs_crc_start;
+    sb->snap_start = fs_snap_start;
+    if (fs_crc_start) sb->checksum = fs_crc32c(sector_buffer, SECTOR_SIZE);
+    ata_write_sector(FS_SECTOR_START, sector_buffer);
+}
+
+static void fs_write_btable(void) {
+    if (!fs_btable_start) return;
+    for (u32 j = 0; j < FS_BTABLE_SECTORS; j++) {
+        if (BIT_TEST(fs_btable_dirty, j)) {
+            fs_crc_set(FS_CRC_BTABLE + j, (u8*)fs_btable + j * SECTOR_SIZE, SECTOR_SIZE);
+            ata_write_sector(fs_btable_start + j, (u8*)fs_btable + j * SECTOR_SIZE);
+        }
+    }
+    memset(fs_btable_dirty, 0, sizeof(fs_btable_dirty));
+}
+
+// Счётчики ссылок сохраняются вместе с хэшами, чтобы fsck мог их сверить
+static void fs_write_hashes(void) {
+    if (!fs_hash_start) return;
+    for (u32 b = 0; b < FS_MAX_BLOCKS; b++) {
+        if (fs_hashes[b].refs != fs_block_refs[b]) {
+            fs_hashes[b].refs = fs_block_refs[b];
+            BIT_SET(fs_hash_dirty, b / FS_HASH_PER_SECTOR);
+        }
+    }
+    for (u32 j = 0; j < FS_HASH_SECTORS; j++) {
+        if (BIT_TEST(fs_hash_dirty, j)) {
+            fs_crc_set(FS_CRC_HASH + j, (u8*)fs_hashes + j * SECTOR_SIZE, SECTOR_SIZE);
+            ata_write_sector(fs_hash_start + j, (u8*)fs_hashes + j * SECTOR_SIZE);
+        }
+    }
+    memset(fs_hash_dirty, 0, sizeof(fs_hash_dirty));
+}
+
+static void fs_write_crcs(void) {
+    if (!fs_crc_start) return;
+    for (u32 j = 0; j < FS_CRC_SECTORS; j++) {
+        if (BIT_TEST(fs_crc_dirty, j)) {
+            ata_write_sector(fs_crc_start + j, (u8*)fs_crcs + j * SECTOR_SIZE);
+        }
+    }
+    memset(fs_crc_dirty, 0, sizeof(fs_crc_dirty));
+}
+
+/* Timing
+ * The TSC is calibrated once against 10 ms of PIT channel 2; times are kept
+ * in units of 1024 cycles so that they fit in 32 bits without 64-bit division.
+ * The kernel shell times its commands with the same calibration. */
+static u32 fs_clock_rate = 0;                // единиц по 1024 такта за 1 мс
+
+#ifndef WEXFS_HOST
+static inline void fs_outb(u16 port, u8 value) {
+    __asm__ volatile("outb %0, %1" : : "a"(value), "Nd"(port));
+}
+
+static inline u8 fs_inb(u16 port) {
+    u8 value;
+    __asm__ volatile("inb %1, %0" : "=a"(value) : "Nd"(port));
+    return value;
+}
+#endif
+
+static u32 fs_clock(void) {
+    u32 lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return (lo >> 10) | (hi << 22);
+}
+
+#ifdef WEXFS_HOST
+// На хосте порты закрыты; TSC сверяется с часами инструмента
+static void fs_clock_calibrate(void) {
+    u32 ms = host_clock_ms();
+    while (host_clock_ms() == ms) {}
+    ms = host_clock_ms();
+    u32 start = fs_clock();
+    while (host_clock_ms() - ms < 10) {}
+    fs_clock_rate = (fs_clock() - start) / 10;
+    if (fs_clock_rate == 0) fs_clock_rate = 1;
+}
+#else
+static void fs_clock_calibrate(void) {
+    u8 gate = fs_inb(0x61);
+
+    // Канал 2 в режиме 0: OUT2 поднимается через 11932 такта по 1.193182 МГц
+    fs_outb(0x61, (gate & ~0x02) | 0x01);
+    fs_outb(0x43, 0xB0);
+    fs_outb(0x42, 11932 & 0xFF);
+    fs_outb(0x42, 11932 >> 8);
+    u32 start = fs_clock();
+    for (u32 spin = 0; !(fs_inb(0x61) & 0x20) && spin < 0x1000000; spin++) {}
+    fs_clock_rate = (fs_clock() - start) / 10;
+    fs_outb(0x61, gate);
+    if (fs_clock_rate == 0) fs_clock_rate = 1;
+}
+#endif
+
+u32 fs_tsc_per_ms(void) {
+    if (fs_clock_rate == 0) fs_clock_calibrate();
+    return fs_clock_rate;
+}
+
+static u32 fs_clock_ms(u32 start) {
+    return (fs_clock() - start) / fs_tsc_per_ms();
+}
+
+// Точка возобновления лежит за последним блоком данных тома по умолчанию
+static u32 fs_migrate_area(void) {
+    return fs_volume_sectors();
+}
+
+static int fs_migrate_read_state(FSMigrateState* state) {
+    u8 sector[SECTOR_SIZE];
+
+    ata_read_sector(fs_migrate_area(), sector);
+    memcpy(state, sector, sizeof(*state));
+    u32 checksum = state->checksum;
+    state->checksum = 0;
+    if (state->magic != FS_MIGRATE_MAGIC || fs_crc32c(state, sizeof(*state)) != checksum) return -1;
+    if (state->copied > FS_MIGRATE_SECTORS || state->nodes > LEGACY_MAX_NODES) return -1;
+    return 0;
+}
+
+static void fs_migrate_write_state(FSMigrateState* state) {
+    u8 sector[SECTOR_SIZE];
+
+    memset(sector, 0, sizeof(sector));
+    if (state) {
+        state->checksum = 0;
+        state->checksum = fs_crc32c(state, sizeof(*state));
+        memcpy(sector, state, sizeof(*state));
+    }
+    ata_write_sector(fs_migrate_area(), sector);
+}
+
+// Этап 1: цепочка копируется прогонами, после каждого прогона пишется отметка
+static void fs_migrate_copy(FSMigrateState* state) {
+    while (state->stage == FS_MIGRATE_COPY) {
+        u32 first = state->copied;
+        u32 run = FS_MIGRATE_SECTORS - first;
+        if (run > FS_MIGRATE_RUN) run = FS_MIGRATE_RUN;
+
+        for (u32 j = 0; j < run; j++) {
+            ata_read_sector(FS_SECTOR_START + first + j, fs_migrate_buffer + j * SECTOR_SIZE);
+        }
+        for (u32 j = 0; j < run; j++) {
+            ata_write_sector(fs_migrate_area() + 1 + first + j, fs_migrate_buffer + j * SECTOR_SIZE);
+        }
+        fs_migrate_bytes += run * SECTOR_SIZE * 2;
+        state->copied += run;
+
+        // Цепочка кончается пустым узлом, нулевой ссылкой или переходом вне ряда
+        for (u32 j = 0; j < run / LEGACY_SECTORS_PER_NODE; j++) {
+            FSLegacyNode* old = (FSLegacyNode*)(fs_migrate_buffer + j * LEGACY_SECTORS_PER_NODE * SECTOR_SIZE);
+            u32 index = first / LEGACY_SECTORS_PER_NODE + j;
+            u32 next = FS_SECTOR_START + (index + 1) * LEGACY_SECTORS_PER_NODE;
+            if (old->name[0] == '\0') {
+                state->nodes = index;
+                state->stage = FS_MIGRATE_IMPORT;
+                break;
+            }
+            if (old->next_sector != next) {
+                state->nodes = index + 1;
+                state->stage = FS_MIGRATE_IMPORT;
+                break;
+            }
+        }
+        if (state->stage == FS_MIGRATE_COPY && state->copied >= FS_MIGRATE_SECTORS) {
+            state->nodes = LEGACY_MAX_NODES;
+            state->stage = FS_MIGRATE_IMPORT;
+        }
+        fs_migrate_write_state(state);
+    }
+}
+
+// Этап 2: новый том строится только из копии, старые секторы уже не нужны
+static void fs_migrate_import(FSMigrateState* state) {
+    fs_count = 0;
+    fs_name_reset();
+    fs_alloc_hint = 0;
+    memset(fs_slot_map, 0, sizeof(fs_slot_map));
+    memset(fs_block_refs, 0, sizeof(fs_block_refs));
+
+    for (u32 first = 0; first < state->nodes; first += FS_MIGRATE_NODES) {
+        u32 count = state->nodes - first;
+        if (count > FS_MIGRATE_NODES) count = FS_MIGRATE_NODES;
+        u32 base = fs_migrate_area() + 1 + first * LEGACY_SECTORS_PER_NODE;
+
+        for (u32 j = 0; j < count * LEGACY_SECTORS_PER_NODE; j++) {
+            ata_read_sector(base + j, fs_migrate_buffer + j * SECTOR_SIZE);
+        }
+        fs_migrate_bytes += count * LEGACY_SECTORS_PER_NODE * SECTOR_SIZE;
+
+        for (u32 j = 0; j < count; j++) {
+            FSLegacyNode* old = (FSLegacyNode*)(fs_migrate_buffer + j * LEGACY_SECTORS_PER_NODE * SECTOR_SIZE);
+            old->name[MAX_PATH - 1] = '\0';
+            FSNode* node = fs_node_create(old->name, old->is_dir);
+            if (!node) continue;
+            if (!old->is_dir && old->size > 0) {
+                u32 len = old->size > sizeof(old->content) ? sizeof(old->content) : old->size;
+                fs_write_content(node, old->content, len);
+                fs_migrate_bytes += len;
+            }
+        }
+    }
+    fs_migrate_nodes = fs_count;
+
+    if (fs_count == 0) {
+        fs_reset(0);
+    }
+
+    // Переписываем весь том в новом формате
+    memset(fs_node_dirty, 0xFF, sizeof(fs_node_dirty));
+    fs_super_dirty = 1;
+    fs_dirty = 1;
+}
+
+static void fs_migrate_report(void) {
+    char num_str[12];
+
+    prints("Migrated ");
+    itoa(fs_migrate_nodes, num_str, 10);
+    prints(num_str);
+    prints(" nodes, ");
+    itoa(fs_migrate_bytes / 1024, num_str, 10);
+    prints(num_str);
+    prints(" KB moved in ");
+    if (fs_migrate_ms == 0) {
+        prints("< 1 ms\n");
+        return;
+    }
+    itoa(fs_migrate_ms, num_str, 10);
+    prints(num_str);
+    prints(" ms (");
+    u32 rate = (fs_migrate_bytes / 1024) * 10000 / (fs_migrate_ms * 1024);
+    itoa(rate / 10, num_str, 10);
+    prints(num_str);
+    putchar('.');
+    putchar('0' + rate % 10);
+    prints(" MB/s)\n");
+}
+
+// Цепочка узлов WexFS 1.0 должна выглядеть настоящей: печатное имя с
+// завершающим нулём, is_dir 0 или 1, размер в пределах content и ссылка
+// на следующий узел ряда или 0 в конце. Иначе на диске что-то другое.
+static int fs_migrate_probe(void) {
+    for (u32 index = 0; index < LEGACY_MAX_NODES; index++) {
+        u32 lba = FS_SECTOR_START + index * LEGACY_SECTORS_PER_NODE;
+        for (u32 j = 0; j < LEGACY_SECTORS_PER_NODE; j++) {
+            ata_read_sector(lba + j, fs_migrate_buffer + j * SECTOR_SIZE);
+        }
+        FSLegacyNode* old = (FSLegacyNode*)fs_migrate_buffer;
+
+        // Старый том дописывал ссылки с опозданием: пустой узел за ссылкой
+        // значит конец цепочки, как и в fs_migrate_copy
+        if (old->name[0] == '\0') return index > 0 ? 0 : -1;
+        u32 len = 0;
+        while (len < MAX_PATH && old->name[len] != '\0') {
+            if ((u8)old->name[len] < 0x20 || (u8)old->name[len] > 0x7E) return -1;
+            len++;
+        }
+        if (len == MAX_PATH) return -1;
+        if (old->is_dir != 0 && old->is_dir != 1) return -1;
+        if (old->size > sizeof(old->content)) return -1;
+
+        if (old->next_sector == 0) return 0;
+        if (old->next_sector != lba + LEGACY_SECTORS_PER_NODE) return -1;
+    }
+    return 0;
+}
+
+// Перенос тома WexFS 1.0; незаконченный перенос продолжается с отметки
+static void fs_migrate(void) {
+    FSMigrateState state;
+    u8 sector[SECTOR_SIZE];
+
+    fs_set_layout(FS_DEFAULT_BLOCK_SIZE, FS_DEFAULT_NODES, FS_FEATURE_DEFAULT);
+    if (fs_migrate_read_state(&state) != 0) {
+        // Пустой диск переносить незачем: имя первого узла начинает сектор
+        ata_read_sector(FS_SECTOR_START, sector);
+        if (sector[0] == '\0') {
+            fs_reset(0);
+            fs_save_to_disk();
+            return;
+        }
+        // Чужие данные не трогаем: в памяти пустой том, на диск он не пишется,
+        // пока том не отформатируют заново
+        if (fs_migrate_probe() != 0) {
+            fs_reset(0);
+            fs_foreign = 1;
+            prints("Error: Disk holds no WexFS volume; left untouched (format to use it)\n");
+            return;
+        }
+        state.magic = FS_MIGRATE_MAGIC;
+        state.stage = FS_MIGRATE_COPY;
+        state.copied = 0;
+        state.nodes = 0;
+        prints("Migrating WexFS 1.0 volume...\n");
+    } else {
+        prints("Resuming WexFS 1.0 migration...\n");
+    }
+
+    fs_tsc_per_ms();                 // калибровка не входит в замер
+    fs_migrate_bytes = 0;
+    u32 start = fs_clock();
+    fs_migrate_copy(&state);
+    fs_migrate_import(&state);
+    fs_save_to_disk();
+    fs_migrate_write_state(NULL);
+    fs_migrate_ms = fs_clock_ms(start);
+
+    fs_migrate_report();
+}
+/* Filesystem functions */
+/* Load-time links: FNV-1a 64 of every node's path and of its parent's path */
+static u64 fs_load_path[MAX_FILES];
+static u64 fs_load_parent[MAX_FILES];
+
+static u64 fs_path_hash(const char* text, u32 len) {
+    u64 h = 14695981039346656037ull;
+    for (u32 i = 0; i < len; i++) h = (h ^ (u8)text[i]) * 1099511628211ull;
+    return h;
+}
+
+void fs_load_from_disk() {
+    u8 sector_buffer[SECTOR_SIZE];
+    u8 record[FS_NODE_SECTORS * SECTOR_SIZE];
+    FSSuperblock* sb = (FSSuperblock*)sector_buffer;
+    FSDiskNode* disk = (FSDiskNode*)record;
+
+    // Загрузка отбрасывает всё несохранённое, в том числе открытую транзакцию
+    fs_count = 0;
+    fs_name_reset();
+    fs_generation++;
+    fs_txn_depth = 0;
+    fs_foreign = 0;
+    fs_dirty = 0;
+    fs_super_dirty = 0;
+    fs_alloc_hint = 0;
+    memset(fs_node_dirty, 0, sizeof(fs_node_dirty));
+    memset(fs_block_refs, 0, sizeof(fs_block_refs));
+    memset(fs_files, 0, sizeof(fs_files));
+    memset(fs_trigram_map, 0, sizeof(fs_trigram_map));
+
+    ata_read_sector(FS_SECTOR_START, sector_buffer);
+    if (sb->magic != FS_MAGIC || sb->version != FS_VERSION) {
+        fs_migrate();
+        return;
+    }
+
+    // Геометрия тома; неизвестные значения заменяются прежними умолчаниями
+    fs_block_size = sb->block_sectors * SECTOR_SIZE;
+    if (fs_block_size < FS_MIN_BLOCK_SIZE || fs_block_size > FS_MAX_BLOCK_SIZE ||
+        (fs_block_size & (fs_block_size - 1))) {
+        fs_block_size = FS_DEFAULT_BLOCK_SIZE;
+    }
+    fs_block_sectors = fs_block_size / SECTOR_SIZE;
+    fs_node_slots = sb->node_slots;
+    if (fs_node_slots == 0 || fs_node_slots > MAX_FILES) fs_node_slots = FS_DEFAULT_NODES;
+    fs_bcache_reset();
+
+    // Сначала контрольные суммы: ими проверяется всё остальное
+    fs_crc_start = sb->crc_start;
+    memset(fs_crcs, 0, sizeof(fs_crcs));
+    memset(fs_crc_dirty, 0, sizeof(fs_crc_dirty));
+    if (fs_crc_start) {
+        u32 checksum = sb->checksum;
+        sb->checksum = 0;
+        fs_crc_verify(checksum, sector_buffer, SECTOR_SIZE, "superblock", FS_SECTOR_START);
+        for (u32 j = 0; j < FS_CRC_SECTORS; j++) {
+            ata_read_sector(fs_crc_start + j, (u8*)fs_crcs + j * SECTOR_SIZE);
+        }
+    }
+
+    memcpy(fs_slot_map, sb->slot_map, sizeof(sb->slot_map));
+    memcpy(fs_slot_map + sizeof(sb->slot_map), sb->slot_map_high, sizeof(sb->slot_map_high));
+
+    // Тома без таблицы блоков хранят все блоки несжатыми
+    fs_feature_flags = sb->features;
+    fs_data_start = sb->data_start;
+    fs_btable_start = sb->btable_start;
+    if (fs_data_start < FS_NODE_START + fs_node_slots * FS_NODE_SECTORS) {
+        fs_data_start = FS_NODE_START + fs_node_slots * FS_NODE_SECTORS;
+    }
+    memset(fs_btable, 0, sizeof(fs_btable));
+    memset(fs_btable_dirty, 0, sizeof(fs_btable_dirty));
+    if (fs_btable_start) {
+        for (u32 j = 0; j < FS_BTABLE_SECTORS; j++) {
+            ata_read_sector(fs_btable_start + j, (u8*)fs_btable + j * SECTOR_SIZE);
+            fs_crc_verify(fs_crcs[FS_CRC_BTABLE + j], (u8*)fs_btable + j * SECTOR_SIZE, SECTOR_SIZE,
+                          "block table sector", j);
+        }
+    } else {
+        fs_feature_flags &= ~FS_FEATURE_LZ;
+    }
+    fs_hash_start = sb->hash_start;
+    memset(fs_hashes, 0, sizeof(fs_hashes));
+    memset(fs_hash_dirty, 0, sizeof(fs_hash_dirty));
+    if (fs_hash_start) {
+        for (u32 j = 0; j < FS_HASH_SECTORS; j++) {
+            ata_read_sector(fs_hash_start + j, (u8*)fs_hashes + j * SECTOR_SIZE);
+            fs_crc_verify(fs_crcs[FS_CRC_HASH + j], (u8*)fs_hashes + j * SECTOR_SIZE, SECTOR_SIZE,
+                          "hash sector", j);
+        }
+    }
+
+    // Читаются только метаданные; блоки данных подгружаются по требованию
+    for (u32 slot = 0; slot < fs_node_slots; slot++) {
+        if (!BIT_TEST(fs_slot_map, slot)) continue;
+
+        for (int j = 0; j < FS_NODE_SECTORS; j++) {
+            ata_read_sector(FS_NODE_START + slot * FS_NODE_SECTORS + j, record + j * SECTOR_SIZE);
+        }
+        if (fs_crc_start) {
+            u32 checksum = disk->checksum;
+            disk->checksum = 0;
+            fs_crc_verify(checksum, disk, sizeof(FSDiskNode), "node slot", slot);
+        }
+
+        // В памяти остаётся только последний компонент; родитель ищется ниже
+        FSNode* node = &fs_cache[fs_count];
+        disk->name[MAX_PATH - 1] = '\0';
+        const char* base = fs_path_base(disk->name);
+        fs_load_path[fs_count] = fs_path_hash(disk->name, strlen(disk->name));
+        fs_load_parent[fs_count] = base == disk->name ? fs_path_hash("/", 1)
+                                                      : fs_path_hash(disk->name, base - 1 - disk->name);
+        node->name = fs_name_intern(base, strlen(base));
+        node->parent = FS_NO_SLOT;
+        node->is_dir = disk->is_dir;
+        node->size = disk->size > FS_MAX_FILE_SIZE ? FS_MAX_FILE_SIZE : disk->size;
+        node->slot = slot;
+        fs_slot_index[slot] = fs_count;
+        fs_count++;
+
+        if (!node->is_dir && disk->blocks[0] == FS_INLINE_BLOCK) {
+            memcpy(FS_NODE_MAP(node), disk->blocks, sizeof(FS_NODE_MAP(node)));
+            if (node->size > FS_INLINE_MAX) node->size = FS_INLINE_MAX;
+            continue;
+        }
+
+        u32 used = node->is_dir ? 0 : fs_node_block_count(node->size);
+        for (u32 i = 0; i < FS_NODE_BLOCKS; i++) {
+            u32 block = i < used ? disk->blocks[i] : FS_NO_BLOCK;
+            if (block >= FS_MAX_BLOCKS) block = FS_NO_BLOCK;
+            FS_NODE_MAP(node)[i] = block;
+            if (block != FS_NO_BLOCK) fs_block_refs[block]++;
+        }
+    }
+
+    // Снимки держат собственные ссылки на блоки
+    fs_snap_start = sb->snap_start;
+    memset(fs_snaps, 0, sizeof(fs_snaps));
+    fs_snap_dirty = 0;
+    if (fs_snap_start) {
+        ata_read_sector(fs_snap_start, (u8*)fs_snaps);
+        fs_crc_verify(fs_crcs[FS_CRC_SNAP], fs_snaps, SECTOR_SIZE, "snapshot table", 0);
+        for (int i = 0; i < FS_MAX_SNAPSHOTS; i++) fs_snaps[i].name[sizeof(fs_snaps[i].name) - 1] = '\0';
+        fs_snap_refs(fs_block_refs);
+    }
+
+    // Узлы читаются в порядке слотов, поэтому родители связываются после всех
+    for (int i = 0; i < fs_count; i++) {
+        FSNode* node = &fs_cache[i];
+        if (fs_node_is_root(node)) continue;
+        for (int j = 0; j < fs_count; j++) {
+            if (j != i && fs_cache[j].is_dir && fs_load_path[j] == fs_load_parent[i]) {
+                node->parent = fs_cache[j].slot;
+                break;
+            }
+        }
+        if (node->parent != FS_NO_SLOT) continue;
+
+        // Директории нет: узел хранит полный путь, как он записан на диске
+        for (int j = 0; j < FS_NODE_SECTORS; j++) {
+            ata_read_sector(FS_NODE_START + node->slot * FS_NODE_SECTORS + j, record + j * SECTOR_SIZE);
+        }
+        disk->name[MAX_PATH - 1] = '\0';
+        u16 name = fs_name_intern(disk->name, strlen(disk->name));
+        if (name != FS_NO_NAME) {
+            fs_name_release(node->name);
+            node->name = name;
+        }
+    }
+
+    fs_hash_rebuild();
+    fs_tree_rebuild();
+    fs_name_index_rebuild();
+
+    if (fs_count == 0) {
+        fs_reset(0);
+        fs_save_to_disk();
+    }
+}
+
+/* Transactions
+ * Inside fs_begin()/fs_commit() a save only stays pending: nodes, indexes
+ * and the block cache change in memory as usual and the outermost commit
+ * writes everything in one ordered pass. Pairs may nest. */
+void fs_begin(void) {
+    fs_txn_depth++;
+}
+
+// -1 без открытой транзакции
+int fs_commit(void) {
+    if (fs_txn_depth == 0) return -1;
+    if (--fs_txn_depth == 0) fs_save_to_disk();
+    return 0;
+}
+
+void fs_save_to_disk() {
+    if (!fs_dirty || fs_txn_depth > 0 || fs_foreign) return;
+
+    fs_bcache_flush();
+    fs_write_btable();
+    fs_write_hashes();
+    fs_write_snaps();
+    fs_write_crcs();
+
+    for (int i = 0; i < fs_count; i++) {
+        if (BIT_TEST(fs_node_dirty, fs_cache[i].slot)) {
+            fs_write_node(&fs_cache[i]);
+        }
+    }
+
+    // Суперблок пишется последним: он делает новые слоты видимыми
+    if (fs_super_dirty) {
+        fs_write_superblock();
+    }
+
+    memset(fs_node_dirty, 0, sizeof(fs_node_dirty));
+    fs_super_dirty = 0;
+    fs_dirty = 0;
+}
+
+void fs_mark_dirty() {
+    fs_dirty = 1;
+}
+
+void fs_init() {
+    fs_load_from_disk();
+    strcpy(current_dir, "/");
+}
+
+void fs_ls() {
+    prints("Contents of ");
+    prints(current_dir);
+    prints(":\n");
+
+    int dir = fs_lookup(".");
+    for (int i = 0; dir >= 0 && i < fs_count; i++) {
+        if (fs_cache[i].parent != fs_cache[dir].slot) continue;
+        if (fs_overlay_marker(fs_node_name(&fs_cache[i]))) continue;
+        prints(fs_node_name(&fs_cache[i]));
+        if (fs_cache[i].is_dir) prints("/");
+        newline();
+    }
+
+    // Затем видимые записи нижнего слоя, которых нет в WexFS
+    FSPath here;
+    if (fs_path_resolve(".", &here) != 0) return;
+    for (u32 i = 0; i < fs_ram_count; i++) {
+        if (!fs_ram_in_dir(i, &here) || fs_ram_shadowed(i) || fs_lower_hidden(fs_ram_path(i))) continue;
+        const char* slash = strrchr(fs_ram_path(i), '/');
+        prints(slash ? slash + 1 : fs_ram_path(i));
+        if (fs_ram_entries[i].is_dir) prints("/");
+        newline();
+    }
+}
+
+void fs_mkdir(const char* name) {
+    if (fs_count >= (int)fs_node_slots) {
+        prints("Error: Maximum files reached\n");
+        return;
+    }
+
+    FSPath path;
+    if (fs_path_resolve(name, &path) != 0) {
+        fs_path_error(name);
+        return;
+    }
+
+    if (fs_path_find(&path) >= 0 || fs_lower_find(&path) >= 0) {
+        prints("Error: Name already exists: ");
+        prints(name);
+        newline();
+        return;
+    }
+
+    // Директория, пересозданная над удалённой из нижнего слоя, прячет его
+    // прежнее содержимое
+    int recreated = fs_upper_prepare(path.text);
+    if (!fs_node_create(path.text, 1)) {
+        prints("Error: Maximum files reached\n");
+        return;
+    }
+    FSPath opaque;
+    if (recreated && fs_opaque_path(path.text, path.len, &opaque) == 0) fs_node_create(opaque.text, 0);
+    fs_save_to_disk();
+    prints("Directory '");
+    prints(name);
+    prints("' created\n");
+}
+
+void fs_touch(const char* name) {
+    if (fs_count >= (int)fs_node_slots) {
+        prints("Error: Maximum files reached\n");
+        return;
+    }
+
+    FSPath path;
+    if (fs_path_resolve(name, &path) != 0) {
+        fs_path_error(name);
+        return;
+    }
+
+    if (fs_path_find(&path) >= 0 || fs_lower_find(&path) >= 0) {
+        prints("Error: Name already exists: ");
+        prints(name);
+        newline();
+        return;
+    }
+
+    fs_upper_prepare(path.text);
+    if (!fs_node_create(path.text, 0)) {
+        prints("Error: Maximum files reached\n");
+        return;
+    }
+    fs_save_to_disk();
+    prints("File '");
+    prints(name);
+    prints("' created\n");
+}
+
+void fs_cd(const char* name) {
+    FSPath path;
+    if (fs_path_resolve(name, &path) != 0) {
+        fs_path_error(name);
+        return;
+    }
+
+    if (path.text[0] == '/') {
+        strcpy(current_dir, "/");
+        return;
+    }
+
+    // Путь плюс '/' и '\0' должен поместиться в current_dir
+    if (path.len + 2 > MAX_PATH) {
+        fs_path_error(name);
+        return;
+    }
+
+    int index = fs_path_find(&path);
+    int is_dir = index >= 0 && fs_cache[index].is_dir;
+    if (index < 0) {
+        int lower = fs_lower_find(&path);
+        is_dir = lower >= 0 && fs_ram_entries[lower].is_dir;
+    }
+    if (!is_dir) {
+        prints("Error: Directory not found: ");
+        prints(name);
+        newline();
+        return;
+    }
+
+    // current_dir хранится с завершающим '/'
+    memcpy(current_dir, path.text, path.len);
+    current_dir[path.len] = '/';
+    current_dir[path.len + 1] = '\0';
+}
+
+FSNode* fs_find_file(const char* name) {
+    FSPath path;
+    if (fs_path_resolve(name, &path) != 0) {
+        fs_path_error(name);
+        return NULL;
+    }
+
+    int index = fs_path_find(&path);
+    if (index < 0 || fs_cache[index].is_dir) return NULL;
+    return &fs_cache[index];
+}
+
+void fs_copy(const char* src_name, const char* dest_name) {
+    FSPath src_path;
+    if (fs_path_resolve(src_name, &src_path) != 0) {
+        fs_path_error(src_name);
+        return;
+    }
+
+    // Источник может лежать и в нижнем слое; тогда его данные копируются
+    int src_index = fs_path_find(&src_path);
+    int src_lower = src_index < 0 ? fs_lower_find(&src_path) : -1;
+    int src_file = src_index >= 0 ? !fs_cache[src_index].is_dir : (src_lower >= 0 && !fs_ram_entries[src_lower].is_dir);
+    if (!src_file) {
+        prints("Error: Source file not found: ");
+        prints(src_name);
+        newline();
+        return;
+    }
+
+    if (fs_count >= (int)fs_node_slots) {
+        prints("Error: Maximum files reached\n");
+        return;
+    }
+
+    FSPath path;
+    if (fs_path_resolve(dest_name, &path) != 0) {
+        fs_path_error(dest_name);
+        return;
+    }
+
+    if (fs_path_find(&path) >= 0 || fs_lower_find(&path) >= 0) {
+        prints("Error: Name already exists: ");
+        prints(dest_name);
+        newline();
+        return;
+    }
+
+    // Копия в WexFS ссылается на тот же блок данных, пишутся только метаданные
+    fs_upper_prepare(path.text);
+    FSNode* dst = fs_node_create(path.text, 0);
+    if (!dst) {
+        prints("Error: Maximum files reached\n");
+        return;
+    }
+    if (src_index >= 0) {
+        fs_reflink(dst, &fs_cache[src_index]);
+    } else if (fs_copy_up(dst, src_lower) != 0) {
+        fs_node_remove(dst - fs_cache);
+        prints("Error: Not enough space\n");
+        return;
+    }
+    fs_save_to_disk();
+    prints("File copied to '");
+    prints(dest_name);
+    prints("'\n");
+}
+
+int folder_size(const char* folder_path) {
+    int index = fs_lookup(folder_path);
+    return (index >= 0 && fs_cache[index].is_dir) ? (int)fs_cache[index].tree_size : 0;
+}
+
+void fs_size(const char* name) {
+    int index = fs_lookup(name);
+    FSNode* node = index >= 0 ? &fs_cache[index] : NULL;
+
+    if (!node) {
+        prints("Error: File or folder not found: ");
+        prints(name);
+        newline();
+        return;
+    }
+
+    int size;
+    if (node->is_dir) {
+        size = node->tree_size;
+        prints("Folder size: ");
+    } else {
+        size = node->size;
+        prints("File size: ");
+    }
+
+    char size_str[16];
+    itoa(size, size_str, 10);
+    prints(size_str);
+    prints(" Bytes\n");
+}
+
+// Итоги WexFS уже посчитаны; из них вычитаются пустые пометки оверлея и
+// добавляются видимые файлы нижнего слоя
+static void du_print(const FSPath* dir) {
+    char num[16];
+    u32 size = 0;
+    u32 files = 0;
+
+    int index = fs_path_find(dir);
+    if (index >= 0) {
+        FSNode* top = &fs_cache[index];
+        int is_root = fs_node_is_root(top);
+        size = top->tree_size;
+        files = top->tree_files;
+        for (int i = 0; i < fs_count; i++) {
+            FSNode* node = &fs_cache[i];
+            if (node->is_dir || !fs_overlay_marker(fs_node_name(node))) continue;
+            if (is_root || fs_node_under(node, top)) files--;
+        }
+    }
+    for (u32 i = 0; i < fs_ram_count; i++) {
+        if (fs_ram_entries[i].is_dir || !fs_path_below(fs_ram_path(i), dir) || !fs_ram_visible(i)) continue;
+        size += fs_ram_entries[i].size;
+        files++;
+    }
+
+    itoa(size, num, 10);
+    prints(num);
+    for (int pad = strlen(num); pad < 10; pad++) putchar(' ');
+    itoa(files, num, 10);
+    prints(num);
+    prints(" files");
+    for (int pad = strlen(num); pad < 6; pad++) putchar(' ');
+    prints(dir->text);
+    newline();
+}
+
+void du_command(const char* path) {
+    // Без аргумента - текущая директория
+    if (path == NULL || path[0] == '\0') path = ".";
+
+    FSPath top;
+    if (fs_path_resolve(path, &top) != 0) {
+        fs_path_error(path);
+        return;
+    }
+    if (fs_path_type(&top) != 1) {
+        prints("Error: Directory not found: ");
+        prints(path);
+        newline();
+        return;
+    }
+
+    // Поддиректории обоих слоёв, затем сама директория
+    FSPath dir;
+    u32 pos = 0;
+    int is_dir;
+    while (fs_tree_next(&top, &pos, dir.text, &is_dir)) {
+        if (!is_dir) continue;
+        dir.len = strlen(dir.text);
+        du_print(&dir);
+    }
+    du_print(&top);
+}
+
+// '*' - любая последовательность, '?' - один символ; шаблон покрывает весь путь
+static int fs_glob_match(const char* pattern, const char* str) {
+    const char* star = NULL;
+    const char* retry = NULL;
+
+    while (*str) {
+        if (*pattern == '*') {
+            star = pattern++;
+            retry = str;
+        } else if (*pattern == '?' || *pattern == *str) {
+            pattern++;
+            str++;
+        } else if (star) {
+            pattern = star + 1;
+            str = ++retry;
+        } else {
+            return 0;
+        }
+    }
+    while (*pattern == '*') pattern++;
+    return *pattern == '\0';
+}
+
+void find_command(const char* pattern) {
+    prints("Searching for: ");
+    prints(pattern);
+    newline();
+
+    int glob = strchr(pattern, '*') != NULL || strchr(pattern, '?') != NULL;
+    u8 slots[MAX_FILES / 8];
+    char path[MAX_PATH];
+    fs_name_candidates(pattern, slots);
+
+    for (u32 slot = 0; slot < MAX_FILES; slot++) {
+        if (slots[slot >> 3] == 0) {
+            slot |= 7;
+            continue;
+        }
+        if (!BIT_TEST(slots, slot)) continue;
+
+        FSNode* node = fs_slot_node(slot);
+        if (!node || fs_overlay_marker(fs_node_name(node))) continue;
+        fs_node_path(node, path);
+        if (glob ? fs_glob_match(pattern, path) : strstr(path, pattern) != NULL) {
+            prints(path);
+            if(node->is_dir) prints("/");
+            newline();
+        }
+    }
+
+    // Затем видимые записи нижнего слоя, которых нет в WexFS
+    for (u32 i = 0; i < fs_ram_count; i++) {
+        const char* lower = fs_ram_path(i);
+        if (!(glob ? fs_glob_match(pattern, lower) : strstr(lower, pattern) != NULL)) continue;
+        if (!fs_ram_visible(i)) continue;
+        prints(lower);
+        if (fs_ram_entries[i].is_dir) prints("/");
+        newline();
+    }
+}
+
+// Содержимое файла из снимка; блоки читаются как есть, живое дерево не трогается
+static void fs_snap_cat(const FSNode* node, const u32* blocks) {
+    if (FS_MAP_INLINE(blocks)) {
+        const char* data = (const char*)&blocks[1];
+        for (u32 i = 0; i < node->size; i++) putchar(data[i]);
+    } else {
+        for (u32 pos = 0; pos < node->size; pos += fs_block_size) {
+            u32 block = blocks[pos / fs_block_size];
+            u32 chunk = node->size - pos < fs_block_size ? node->size - pos : fs_block_size;
+            if (block >= FS_MAX_BLOCKS) {
+                for (u32 i = 0; i < chunk; i++) putchar('\0');   // дыра читается нулями, как в fs_read
+                continue;
+            }
+            const char* data = fs_block_peek(block);
+            for (u32 i = 0; i < chunk; i++) putchar(data[i]);
+        }
+    }
+    newline();
+}
+
+static void fs_snap_show(const char* name, const char* path) {
+    int index = fs_snap_find(name);
+    if (index < 0) {
+        prints("Error: Snapshot not found: ");
+        prints(name);
+        newline();
+        return;
+    }
+
+    FSNode node;
+    u32 blocks[FS_NODE_BLOCKS];
+    char node_path[MAX_PATH];
+    u32 offset = 0;
+    int status;
+    fs_snap_open(&fs_snaps[index]);
+    while ((status = fs_snap_next(&fs_snaps[index], &offset, &node, blocks, node_path)) > 0) {
+        if (path[0] != '\0') {
+            if (strcmp(node_path, path[0] == '/' && path[1] ? path + 1 : path) != 0) continue;
+            if (node.is_dir) {
+                prints("Error: Is a directory\n");
+            } else {
+                fs_snap_cat(&node, blocks);
+            }
+            return;
+        }
+
+        char size_str[12];
+        prints("  ");
+        prints(node_path);
+        if (node.is_dir) {
+            if (strcmp(node_path, "/") != 0) prints("/");
+        } else {
+            prints("  (");
+            itoa(node.size, size_str, 10);
+            prints(size_str);
+            prints(" bytes)");
+        }
+        newline();
+    }
+
+    if (status < 0) {
+        prints("Error: Snapshot manifest is damaged\n");
+    } else if (path[0] != '\0') {
+        prints("Error: File not found in snapshot: ");
+        prints(path);
+        newline();
+    }
+}
+
+static void fs_snap_list(void) {
+    int shown = 0;
+    for (int i = 0; i < FS_MAX_SNAPSHOTS; i++) {
+        if (!fs_snaps[i].serial) continue;
+        char num_str[12];
+        prints("  #");
+        itoa(fs_snaps[i].serial, num_str, 10);
+        prints(num_str);
+        prints("  ");
+        prints(fs_snaps[i].name);
+        prints("  ");
+        itoa(fs_snaps[i].nodes, num_str, 10);
+        prints(num_str);
+        prints(" objects, ");
+        itoa(fs_snaps[i].bytes, num_str, 10);
+        prints(num_str);
+        prints(" bytes\n");
+        shown++;
+    }
+    if (!shown) prints("No snapshots.\n");
+}
+
+// snapshot create|list|show|delete|rollback [имя] [файл]
+void snapshot_command(const char* args) {
+    char verb[16];
+    char name[32];
+    const char* rest = args;
+    u32 n;
+
+    if (!fs_snap_start) {
+        prints("Error: This volume has no snapshot table (format it to enable snapshots)\n");
+        return;
+    }
+
+    for (n = 0; *rest && *rest != ' ' && n < sizeof(verb) - 1; n++) verb[n] = *rest++;
+    verb[n] = '\0';
+    while (*rest == ' ') rest++;
+    for (n = 0; *rest && *rest != ' ' && n < sizeof(name) - 1; n++) name[n] = *rest++;
+    name[n] = '\0';
+    while (*rest == ' ') rest++;
+
+    if (strcmp(verb, "list") == 0 || verb[0] == '\0') {
+        fs_snap_list();
+        return;
+    }
+    if (name[0] == '\0') {
+        prints("Usage: snapshot create|list|show|delete|rollback <name> [file]\n");
+        return;
+    }
+
+    if ((strcmp(verb, "create") == 0 || strcmp(verb, "rollback") == 0) && fs_volume_busy()) {
+        prints("Error: Volume is busy (open transaction or writable file view)\n");
+        return;
+    }
+
+    if (strcmp(verb, "create") == 0) {
+        if (fs_snapshot_create(name) != 0) {
+            prints("Error: Cannot create snapshot (name in use, table full or out of space)\n");
+            return;
+        }
+        prints("Snapshot '");
+        prints(name);
+        prints("' created\n");
+    } else if (strcmp(verb, "show") == 0) {
+        fs_snap_show(name, rest);
+    } else if (strcmp(verb, "delete") == 0) {
+        if (fs_snapshot_delete(name) != 0) {
+            prints("Error: Snapshot not found: ");
+            prints(name);
+            newline();
+            return;
+        }
+        prints("Snapshot deleted\n");
+    } else if (strcmp(verb, "rollback") == 0) {
+        prints("All changes made after this snapshot will be lost.\n");
+        prints("Continue? (y/N): ");
+        char confirm = keyboard_getchar();
+        putchar(confirm);
+        newline();
+        if (confirm != 'y' && confirm != 'Y') {
+            prints("Operation cancelled.\n");
+            return;
+        }
+        if (fs_snapshot_rollback(name) != 0) {
+            prints("Error: Cannot roll back to snapshot: ");
+            prints(name);
+            newline();
+            return;
+        }
+        prints("Filesystem rolled back to snapshot '");
+        prints(name);
+        prints("'\n");
+    } else {
+        prints("Usage: snapshot create|list|show|delete|rollback <name> [file]\n");
+    }
+}
+
+// defrag [-b]: -b включает фоновую дефрагментацию по шагу на ввод
+void defrag_command(const char* args) {
+    char num_str[12];
+
+    if (args && strcmp(args, "-b") == 0) {
+        fs_defrag_enabled = !fs_defrag_enabled;
+        fs_defrag.background = 0;
+        prints(fs_defrag_enabled ? "Background defragmentation enabled\n" : "Background defragmentation disabled\n");
+        return;
+    }
+    if (args && args[0] != '\0') {
+        prints("Usage: defrag [-b]\n");
+        return;
+    }
+
+    u32 before = fs_defrag_extents();
+    prints("Defragmenting ");
+    fs_defrag_start(0);
+    for (int steps = 0; !fs_defrag_step(); steps++) {
+        if (steps % 8 == 0) putchar('.');
+    }
+    prints(" done\n");
+
+    prints("Nodes moved: ");
+    itoa(fs_defrag.moved_nodes, num_str, 10);
+    prints(num_str);
+    prints(", blocks moved: ");
+    itoa(fs_defrag.moved_blocks, num_str, 10);
+    prints(num_str);
+    newline();
+    prints("Extents: ");
+    itoa(before, num_str, 10);
+    prints(num_str);
+    prints(" -> ");
+    itoa(fs_defrag_extents(), num_str, 10);
+    prints(num_str);
+    newline();
+}
+
+// Десятичное число из строки; -1, если это не число
+static int fs_mkfs_number(const char* s, u32* value) {
+    u32 n = 0;
+    if (*s < '0' || *s > '9') return -1;
+    while (*s >= '0' && *s <= '9') {
+        n = n * 10 + (*s - '0');
+        if (n > 1000000) return -1;
+        s++;
+    }
+    *value = n;
+    return 0;
+}
+
+// Список возможностей через запятую: lz,dedup,crc,snap или none
+static int fs_mkfs_features(const char* s, u32* features) {
+    static const char* names[] = { "lz", "dedup", "crc", "snap" };
+    char word[8];
+    u32 mask = 0;
+
+    while (*s) {
+        int len = 0;
+        while (*s && *s != ',') {
+            if (len >= (int)sizeof(word) - 1) return -1;
+            word[len++] = *s++;
+        }
+        word[len] = '\0';
+        if (*s == ',') s++;
+        if (strcmp(word, "none") == 0) continue;
+        int found = 0;
+        for (int i = 0; i < 4; i++) {
+            if (strcmp(word, names[i]) == 0) {
+                mask |= 1u << i;
+                found = 1;
+            }
+        }
+        if (!found) return -1;
+    }
+    *features = mask;
+    return 0;
+}
+
+// mkfs [-b <KB>] [-n <nodes>] [-f <features>]: форматирует том с заданными параметрами
+void mkfs_command(const char* args) {
+    u32 block_kb = FS_DEFAULT_BLOCK_SIZE / 1024;
+    u32 nodes = FS_DEFAULT_NODES;
+    u32 features = FS_FEATURE_DEFAULT;
+    char opt[24];
+    char num_str[12];
+
+    while (args && *args) {
+        while (*args == ' ') args++;
+        if (*args == '\0') break;
+        if (args[0] != '-' || (args[1] != 'b' && args[1] != 'n' && args[1] != 'f') || args[2] != ' ') {
+            prints("Usage: mkfs [-b <KB>] [-n <nodes>] [-f lz,dedup,crc,snap|none]\n");
+            return;
+        }
+        char flag = args[1];
+        args += 3;
+        while (*args == ' ') args++;
+        int len = 0;
+        while (*args && *args != ' ' && len < (int)sizeof(opt) - 1) opt[len++] = *args++;
+        opt[len] = '\0';
+
+        int bad;
+        if (flag == 'b') bad = fs_mkfs_number(opt, &block_kb);
+        else if (flag == 'n') bad = fs_mkfs_number(opt, &nodes);
+        else bad = fs_mkfs_features(opt, &features);
+        if (bad) {
+            prints("Error: Invalid value: ");
+            prints(opt);
+            newline();
+            return;
+        }
+    }
+
+    if (block_kb * 1024 < FS_MIN_BLOCK_SIZE || block_kb * 1024 > FS_MAX_BLOCK_SIZE || (block_kb & (block_kb - 1))) {
+        prints("Error: Block size must be a power of two from 1 to 64 KB\n");
+        return;
+    }
+    if (nodes < FS_MIN_NODES || nodes > MAX_FILES) {
+        prints("Error: Node count must be from ");
+        itoa(FS_MIN_NODES, num_str, 10);
+        prints(num_str);
+        prints(" to ");
+        itoa(MAX_FILES, num_str, 10);
+        prints(num_str);
+        newline();
+        return;
+    }
+
+    prints("Block size: ");
+    itoa(block_kb, num_str, 10);
+    prints(num_str);
+    prints(" KB, nodes: ");
+    itoa(nodes, num_str, 10);
+    prints(num_str);
+    prints(", volume: ");
+    itoa(block_kb * FS_MAX_BLOCKS / 1024, num_str, 10);
+    prints(num_str);
+    prints(" MB\nFeatures:");
+    if (features & FS_FEATURE_LZ) prints(" lz");
+    if (features & FS_FEATURE_DEDUP) prints(" dedup");
+    if (features & FS_FEATURE_CRC) prints(" crc");
+    if (features & FS_FEATURE_SNAP) prints(" snap");
+    if (!features) prints(" none");
+    newline();
+
+    prints("WARNING: This will erase ALL files and directories!\n");
+    prints("Continue? (y/N): ");
+    char confirm = keyboard_getchar();
+    putchar(confirm);
+    newline();
+    if (confirm != 'y' && confirm != 'Y') {
+        prints("Operation cancelled.\n");
+        return;
+    }
+
+    if (fs_mkfs(block_kb * 1024, nodes, features) != 0) {
+        prints("Error: Format failed\n");
+        return;
+    }
+    fs_save_to_disk();
+    prints("Filesystem formatted successfully.\n");
+}
+
+// migrate: переносит найденный на диске том WexFS 1.0 и печатает итог переноса
+void migrate_command(const char* args) {
+    u8 sector[SECTOR_SIZE];
+    FSSuperblock* sb = (FSSuperblock*)sector;
+
+    if (args && args[0] != '\0') {
+        prints("Usage: migrate\n");
+        return;
+    }
+
+    ata_read_sector(FS_SECTOR_START, sector);
+    if (sb->magic == FS_MAGIC && sb->version == FS_VERSION) {
+        prints("Volume is already WexFS 2.0\n");
+        if (fs_migrate_nodes) {
+            prints("Last run: ");
+            fs_migrate_report();
+        }
+        return;
+    }
+
+    // Загрузка сама переносит том или продолжает прерванный перенос
+    fs_init();
+}
+
+/* Function implementations */
+/* Consistency check
+ * Every phase is a single pass over the nodes or the blocks: names go into
+ * a small open-addressing table, parents are found through it and block
+ * references are recounted into one array. fsck runs all phases at once;
+ * the background mode runs FS_FSCK_SLICE steps per shell tick and starts
+ * over whenever the tree changes under it. */
+#define FS_FSCK_BUCKETS (MAX_FILES * 2)
+#define FS_FSCK_EMPTY 0xFFFF
+#define FS_FSCK_SLICE 8
+
+enum { FSCK_NAMES, FSCK_TREE, FSCK_BLOCKS, FSCK_TOTALS, FSCK_SPACE, FSCK_DATA, FSCK_DONE };
+
+static const char* fs_fsck_phases[] = {
+    "Checking names", "Checking directory tree", "Checking block pointers",
+    "Checking directory totals", "Checking free space", "Verifying checksums"
+};
+
+typedef struct {
+    int phase;
+    u32 pos;
+    int repair;
+    int background;
+    int column;                    // точки прогресса в текущей строке
+    u32 generation;
+    u32 errors;
+    u32 repaired;
+    int rebuild_tree;
+    int rebuild_refs;
+    u16 names[FS_FSCK_BUCKETS];    // индексы fs_cache по хэшу (родитель, имя)
+    char path[MAX_PATH];           // путь узла для сообщений
+    u16 refs[FS_MAX_BLOCKS];       // ссылки на блоки, пересчитанные по узлам
+    u32 tree_size[MAX_FILES];      // итоги директорий, пересчитанные по слотам
+    u32 tree_files[MAX_FILES];
+} FSCheck;
+
+static FSCheck fs_fsck;
+static int fs_fsck_enabled = 0;
+
+static u32 fs_fsck_hash(u32 parent, u16 name) {
+    u32 h = (parent * 31u + name) * 2654435761u;
+    return (h >> 16) & (FS_FSCK_BUCKETS - 1);
+}
+
+// Индекс узла с родителем parent и именем name или -1
+static int fs_fsck_find(u32 parent, u16 name) {
+    for (u32 h = fs_fsck_hash(parent, name), n = 0; n < FS_FSCK_BUCKETS; h = (h + 1) & (FS_FSCK_BUCKETS - 1), n++) {
+        if (fs_fsck.names[h] == FS_FSCK_EMPTY) return -1;
+        FSNode* other = &fs_cache[fs_fsck.names[h]];
+        if (other->parent == parent && other->name == name) return fs_fsck.names[h];
+    }
+    return -1;
+}
+
+static void fs_fsck_insert(int index) {
+    u32 h = fs_fsck_hash(fs_cache[index].parent, fs_cache[index].name);
+    while (fs_fsck.names[h] != FS_FSCK_EMPTY) h = (h + 1) & (FS_FSCK_BUCKETS - 1);
+    fs_fsck.names[h] = index;
+}
+
+static const char* fs_fsck_path(const FSNode* node) {
+    fs_node_path(node, fs_fsck.path);
+    return fs_fsck.path;
+}
+
+// Сообщает о проблеме; возвращает 1, если её нужно исправить
+static int fs_fsck_problem(const char* what, const char* name, u32 number) {
+    fs_fsck.errors++;
+    if (!fs_fsck.background) {
+        if (fs_fsck.column) {
+            newline();
+            fs_fsck.column = 0;
+        }
+        prints("ERROR: ");
+        prints(what);
+        if (name) {
+            prints(": ");
+            prints(name);
+        } else {
+            char num_str[12];
+            putchar(' ');
+            itoa(number, num_str, 10);
+            prints(num_str);
+        }
+        newline();
+    }
+    if (fs_fsck.repair) fs_fsck.repaired++;
+    return fs_fsck.repair;
+}
+
+// Создаёт недостающие директории на пути к name
+static int fs_fsck_make_parents(const char* name) {
+    FSPath dir;
+
+    if (fs_orphan_find("/", 1) < 0 && !fs_node_create("/", 1)) return -1;
+
+    strcpy(dir.text, name);
+    for (u32 k = 1; name[k]; k++) {
+        if (name[k] != '/') continue;
+        dir.text[k] = '\0';
+        dir.len = k;
+        int index = fs_path_find(&dir);
+        if (index >= 0 ? !fs_cache[index].is_dir : !fs_node_create(dir.text, 1)) return -1;
+        dir.text[k] = '/';
+    }
+    return 0;
+}
+
+// Итоги директорий заново по уже проверенным ссылкам на родителя
+static void fs_fsck_retotal(void) {
+    for (int i = 0; i < fs_count; i++) {
+        fs_cache[i].tree_size = 0;
+        fs_cache[i].tree_files = 0;
+    }
+    for (int i = 0; i < fs_count; i++) {
+        if (!fs_cache[i].is_dir) fs_tree_attach(&fs_cache[i], 1);
+    }
+}
+
+static int fs_fsck_block_busy(u32 block) {
+    for (int i = 0; i < fs_bcache_count; i++) {
+        if (fs_bcache[i].block == block && fs_bcache[i].dirty) return 1;
+    }
+    return 0;
+}
+
+static void fs_fsck_check_name(int index) {
+    FSNode* node = &fs_cache[index];
+
+    if (!BIT_TEST(fs_slot_map, node->slot) || fs_slot_index[node->slot] != index) {
+        if (fs_fsck_problem("Slot map out of sync", fs_fsck_path(node), 0)) {
+            BIT_SET(fs_slot_map, node->slot);
+            fs_slot_index[node->slot] = index;
+            fs_super_dirty = 1;
+            fs_dirty = 1;
+        }
+    }
+
+    if (fs_fsck_find(node->parent, node->name) >= 0) {
+        if (fs_fsck_problem("Duplicate filename", fs_fsck_path(node), 0)) {
+            // Дубликат получает свободное имя; содержимое не трогается
+            char name[MAX_PATH];
+            u32 len = fs_node_path(node, name);
+            if (len + 5 < MAX_PATH) {
+                strcat(name, ".dup0");
+                while (fs_node_rename(node, name) != 0) {
+                    if (name[len + 4] == '9') {
+                        prints("  No free name for duplicate\n");
+                        fs_fsck.repaired--;
+                        return;
+                    }
+                    name[len + 4]++;
+                }
+                fs_fsck.rebuild_tree = 1;
+            }
+        }
+    }
+    fs_fsck_insert(index);
+}
+
+static void fs_fsck_check_parent(int index) {
+    FSNode* node = &fs_cache[index];
+
+    if (fs_node_is_root(node)) return;
+
+    if (node->parent == FS_NO_SLOT) {
+        // Без директории узел хранит полный путь; недостающие директории создаются
+        if (!fs_fsck_problem("Orphaned entry", fs_fsck_path(node), 0)) return;
+        if (fs_fsck_make_parents(fs_fsck.path) != 0) {
+            prints("  Cannot recreate parent directory\n");
+            fs_fsck.repaired--;
+            return;
+        }
+        node = &fs_cache[index];
+        u32 parent = fs_parent_slot(fs_fsck.path);
+        if (node->parent == FS_NO_SLOT && parent != FS_NO_SLOT) fs_node_link(node, parent);
+        fs_fsck.rebuild_tree = 1;
+        return;
+    }
+
+    // Цепочка родителей должна дойти до узла без родителя через директории
+    FSNode* dir = fs_slot_node(node->parent);
+    int depth = 0;
+    while (dir && dir->is_dir && dir->parent != FS_NO_SLOT && depth < MAX_FILES) {
+        dir = fs_slot_node(dir->parent);
+        depth++;
+    }
+    if (dir && dir->is_dir && depth < MAX_FILES) return;
+
+    if (fs_fsck_problem("Wrong parent link", fs_fsck_path(node), 0)) {
+        int root = fs_orphan_find("/", 1);
+        if (root < 0) {
+            prints("  No root directory\n");
+            fs_fsck.repaired--;
+            return;
+        }
+        node->parent = fs_cache[root].slot;
+        fs_name_index_rebuild();
+        fs_node_set_dirty(node);
+        fs_fsck.rebuild_tree = 1;
+    }
+}
+
+static void fs_fsck_check_blocks(FSNode* node) {
+    if (node->is_dir) {
+        for (u32 b = 0; b < FS_NODE_BLOCKS; b++) {
+            if (FS_NODE_MAP(node)[b] == FS_NO_BLOCK) continue;
+            if (fs_fsck_problem("Directory has data blocks", fs_fsck_path(node), 0)) {
+                for (u32 i = 0; i < FS_NODE_BLOCKS; i++) FS_NODE_MAP(node)[i] = FS_NO_BLOCK;
+                fs_node_set_dirty(node);
+                fs_fsck.rebuild_refs = 1;
+            }
+            return;
+        }
+        return;
+    }
+
+    if (FS_NODE_INLINE(node)) {
+        if (node->size > FS_INLINE_MAX && fs_fsck_problem("Inline file too large", fs_fsck_path(node), 0)) {
+            fs_node_set_size(node, FS_INLINE_MAX);
+        }
+        return;
+    }
+
+    if (node->size > FS_MAX_FILE_SIZE && fs_fsck_problem("File size exceeds block map", fs_fsck_path(node), 0)) {
+        fs_node_set_size(node, FS_MAX_FILE_SIZE);
+    }
+
+    u32 needed = fs_node_block_count(node->size);
+    for (u32 b = 0; b < FS_NODE_BLOCKS; b++) {
+        u32 block = FS_NODE_MAP(node)[b];
+        if (block == FS_NO_BLOCK) continue;
+        if (block >= FS_MAX_BLOCKS || b >= needed) {
+            if (fs_fsck_problem("Bad block pointer", fs_fsck_path(node), 0)) {
+                FS_NODE_MAP(node)[b] = FS_NO_BLOCK;
+                fs_node_set_dirty(node);
+                fs_fsck.rebuild_refs = 1;
+            }
+            continue;
+        }
+        fs_fsck.refs[block]++;
+    }
+}
+
+static void fs_fsck_check_space(u32 block) {
+    u16 want = fs_fsck.refs[block];
+
+    if (fs_block_refs[block] != want) {
+        if (fs_fsck_problem(want ? "Reference count mismatch on block" : "Leaked block", NULL, block)) {
+            fs_fsck.rebuild_refs = 1;
+        }
+    } else if (want == 0 && (fs_hashes[block].flags & FS_HASH_VALID)) {
+        if (fs_fsck_problem("Stale hash entry on block", NULL, block)) fs_hash_unlink(block);
+    } else if (fs_hash_start && !fs_dirty && fs_hashes[block].refs != want) {
+        // Сохранённые счётчики переписываются при следующем сохранении
+        if (fs_fsck_problem("Stored reference count mismatch on block", NULL, block)) fs_dirty = 1;
+    }
+}
+
+static void fs_fsck_check_data(u32 block) {
+    if (!fs_crc_start || fs_fsck.refs[block] == 0 || fs_fsck_block_busy(block)) return;
+
+    u32 before = fs_crc_errors;
+    fs_crc_quiet = 1;
+    fs_read_block(block, (char*)fs_dedup_buffer);
+    fs_crc_quiet = 0;
+    if (fs_crc_errors != before && fs_fsck_problem("Checksum mismatch on block", NULL, block)) {
+        // Данные не восстановить; блок принимается таким, каким прочитан
+        fs_crc_set(block, fs_dedup_buffer, fs_block_size);
+        fs_dirty = 1;
+    }
+}
+
+// Метаданные сверяются с диском; имеет смысл только сразу после сохранения
+static void fs_fsck_check_meta(void) {
+    u8 record[FS_NODE_SECTORS * SECTOR_SIZE];
+    FSDiskNode* disk = (FSDiskNode*)record;
+    FSSuperblock* sb = (FSSuperblock*)record;
+    u32 before = fs_crc_errors;
+
+    fs_crc_quiet = 1;
+    ata_read_sector(FS_SECTOR_START, record);
+    u32 checksum = sb->checksum;
+    sb->checksum = 0;
+    if (!fs_crc_verify(checksum, record, SECTOR_SIZE, "superblock", FS_SECTOR_START)) {
+        fs_fsck_problem("Checksum mismatch in superblock", NULL, FS_SECTOR_START);
+    }
+    for (u32 j = 0; fs_btable_start && j < FS_BTABLE_SECTORS; j++) {
+        ata_read_sector(fs_btable_start + j, record);
+        if (!fs_crc_verify(fs_crcs[FS_CRC_BTABLE + j], record, SECTOR_SIZE, "block table sector", j)) {
+            fs_fsck_problem("Checksum mismatch in block table sector", NULL, j);
+        }
+    }
+    for (u32 j = 0; fs_hash_start && j < FS_HASH_SECTORS; j++) {
+        ata_read_sector(fs_hash_start + j, record);
+        if (!fs_crc_verify(fs_crcs[FS_CRC_HASH + j], record, SECTOR_SIZE, "hash sector", j)) {
+            fs_fsck_problem("Checksum mismatch in hash sector", NULL, j);
+        }
+    }
+    for (u32 slot = 0; slot < fs_node_slots; slot++) {
+        if (!BIT_TEST(fs_slot_map, slot)) continue;
+        for (int j = 0; j < FS_NODE_SECTORS; j++) {
+            ata_read_sector(FS_NODE_START + slot * FS_NODE_SECTORS + j, record + j * SECTOR_SIZE);
+        }
+        checksum = disk->checksum;
+        disk->checksum = 0;
+        if (!fs_crc_verify(checksum, disk, sizeof(FSDiskNode), "node slot", slot)) {
+            fs_fsck_problem("Checksum mismatch in node slot", NULL, slot);
+        }
+    }
+    fs_crc_quiet = 0;
+
+    if (fs_fsck.repair && fs_crc_errors != before) {
+        // Все метаданные переписываются и получают новые суммы
+        for (int i = 0; i < fs_count; i++) fs_node_set_dirty(&fs_cache[i]);
+        memset(fs_btable_dirty, 0xFF, sizeof(fs_btable_dirty));
+        memset(fs_hash_dirty, 0xFF, sizeof(fs_hash_dirty));
+        fs_super_dirty = 1;
+        fs_dirty = 1;
+    }
+}
+
+static u32 fs_fsck_phase_total(int phase) {
+    switch (phase) {
+        case FSCK_TOTALS: return 2 * fs_count;
+        case FSCK_SPACE: return FS_MAX_BLOCKS;
+        case FSCK_DATA: return fs_crc_start ? FS_MAX_BLOCKS : 0;
+        default: return fs_count;
+    }
+}
+
+static void fs_fsck_begin(int phase) {
+    if (!fs_fsck.background) {
+        char num_str[12];
+        prints("Phase ");
+        itoa(phase + 1, num_str, 10);
+        prints(num_str);
+        prints(": ");
+        prints(fs_fsck_phases[phase]);
+        prints(" ");
+    }
+
+    if (phase == FSCK_TOTALS) {
+        memset(fs_fsck.tree_size, 0, sizeof(fs_fsck.tree_size));
+        memset(fs_fsck.tree_files, 0, sizeof(fs_fsck.tree_files));
+        if (fs_fsck.rebuild_tree) {
+            fs_fsck_retotal();
+            fs_fsck.rebuild_tree = 0;
+        }
+    } else if (phase == FSCK_SPACE) {
+        fs_snap_refs(fs_fsck.refs);
+    } else if (phase == FSCK_DATA && !fs_fsck.background) {
+        fs_save_to_disk();
+    }
+}
+
+static void fs_fsck_item(int phase, u32 pos) {
+    switch (phase) {
+        case FSCK_NAMES:
+            fs_fsck_check_name(pos);
+            break;
+        case FSCK_TREE:
+            fs_fsck_check_parent(pos);
+            break;
+        case FSCK_BLOCKS:
+            fs_fsck_check_blocks(&fs_cache[pos]);
+            break;
+        case FSCK_TOTALS:
+            if (pos < (u32)fs_count) {
+                // Первая половина: размер каждого файла поднимается по родителям
+                FSNode* node = &fs_cache[pos];
+                if (node->is_dir) break;
+                FSNode* dir = fs_slot_node(node->parent);
+                for (int depth = 0; dir && depth < MAX_FILES; depth++) {
+                    fs_fsck.tree_size[dir->slot] += node->size;
+                    fs_fsck.tree_files[dir->slot]++;
+                    dir = fs_slot_node(dir->parent);
+                }
+            } else {
+                FSNode* node = &fs_cache[pos - fs_count];
+                if (!node->is_dir) break;
+                if (node->tree_size != fs_fsck.tree_size[node->slot] ||
+                    node->tree_files != fs_fsck.tree_files[node->slot]) {
+                    if (fs_fsck_problem("Directory totals out of date", fs_fsck_path(node), 0)) {
+                        fs_fsck.rebuild_tree = 1;
+                    }
+                }
+            }
+            break;
+        case FSCK_SPACE:
+            fs_fsck_check_space(pos);
+            break;
+        case FSCK_DATA:
+            fs_fsck_check_data(pos);
+            break;
+    }
+}
+
+static void fs_fsck_end(int phase) {
+    if (phase == FSCK_TOTALS && fs_fsck.rebuild_tree) {
+        fs_fsck_retotal();
+        fs_fsck.rebuild_tree = 0;
+    } else if (phase == FSCK_SPACE && fs_fsck.rebuild_refs) {
+        // Блоки без владельцев освобождаются, счётчики берутся из пересчёта
+        for (u32 b = 0; b < FS_MAX_BLOCKS; b++) {
+            if (fs_fsck.refs[b] == 0 && fs_block_refs[b] > 0) {
+                fs_bcache_drop(b);
+                fs_hash_unlink(b);
+            }
+        }
+        memcpy(fs_block_refs, fs_fsck.refs, sizeof(fs_block_refs));
+        fs_hash_rebuild();
+        fs_fsck.rebuild_refs = 0;
+        fs_dirty = 1;
+    } else if (phase == FSCK_DATA && !fs_fsck.background && fs_crc_start) {
+        fs_fsck_check_meta();
+    }
+
+    if (!fs_fsck.background) {
+        prints(" done\n");
+        fs_fsck.column = 0;
+    }
+}
+
+static void fs_fsck_start(int repair, int background) {
+    memset(&fs_fsck, 0, sizeof(fs_fsck));
+    memset(fs_fsck.names, 0xFF, sizeof(fs_fsck.names));
+    fs_fsck.repair = repair;
+    fs_fsck.background = background;
+    fs_fsck.generation = fs_generation;
+}
+
+// Выполняет до budget шагов; возвращает 1, когда проверка закончена
+static int fs_fsck_run(u32 budget) {
+    for (; budget > 0 && fs_fsck.phase != FSCK_DONE; budget--) {
+        u32 total = fs_fsck_phase_total(fs_fsck.phase);
+        if (fs_fsck.pos == 0) fs_fsck_begin(fs_fsck.phase);
+        if (fs_fsck.pos < total) {
+            fs_fsck_item(fs_fsck.phase, fs_fsck.pos);
+            fs_fsck.pos++;
+            // Точка прогресса на каждую шестнадцатую часть фазы
+            if (!fs_fsck.background && total >= 16 && fs_fsck.pos % (total / 16) == 0 &&
+                fs_fsck.column < 16) {
+                putchar('.');
+                fs_fsck.column++;
+            }
+            continue;
+        }
+        fs_fsck_end(fs_fsck.phase);
+        fs_fsck.phase++;
+        fs_fsck.pos = 0;
+    }
+    return fs_fsck.phase == FSCK_DONE;
+}
+
+// Один шаг фоновой проверки; вызывается из цикла оболочки
+void fs_fsck_tick(void) {
+    if (!fs_fsck_enabled || fs_volume_busy()) return;
+    if (!fs_fsck.background || fs_fsck.generation != fs_generation) fs_fsck_start(0, 1);
+    if (!fs_fsck_run(FS_FSCK_SLICE)) return;
+
+    if (fs_fsck.errors) {
+        char num_str[12];
+        newline();
+        prints("fsck: background check found ");
+        itoa(fs_fsck.errors, num_str, 10);
+        prints(num_str);
+        prints(" problem(s), run 'fsck -y' to repair\n");
+        fs_fsck_enabled = 0;
+        return;
+    }
+    fs_fsck_start(0, 1);
+}
+
+static void fs_fsck_full(int repair) {
+    prints("Checking filesystem integrity...\n");
+    prints("Filesystem: WexFS\n");
+    prints("Version: 2.0\n");
+    prints("======================================\n");
+
+    fs_fsck_start(repair, 0);
+    while (!fs_fsck_run(FS_MAX_BLOCKS)) {
+    }
+    if (repair && fs_fsck.repaired) fs_save_to_disk();
+
+    int errors_found = fs_fsck.errors;
+    int warnings_found = 0;
+
+    // Проверка максимального количества файлов
+    if (fs_count >= (int)fs_node_slots) {
+        prints("WARNING: Filesystem at maximum capacity (");
+        char max_str[10];
+        itoa(fs_node_slots, max_str, 10);
+        prints(max_str);
+        prints(" files)\n");
+        warnings_found++;
+    }
+
+    // Статистика
+    int total_files = 0;
+    int total_dirs = 0;
+    int inline_files = 0;
+    int used_blocks = 0;
+    int shared_blocks = 0;
+    int packed_blocks = 0;
+    int saved_sectors = 0;
+
+    for (int i = 0; i < fs_count; i++) {
+        if (fs_cache[i].is_dir) {
+            total_dirs++;
+        } else {
+            total_files++;
+            if (FS_NODE_INLINE(&fs_cache[i])) inline_files++;
+        }
+    }
+    for (int b = 0; b < FS_MAX_BLOCKS; b++) {
+        if (fs_block_refs[b] > 0) used_blocks++;
+        if (fs_block_refs[b] > 1) shared_blocks++;
+        if (fs_block_refs[b] > 0 && (fs_btable[b].flags & FS_BLOCK_LZ)) {
+            packed_blocks++;
+            saved_sectors += fs_block_sectors - (fs_btable[b].length + SECTOR_SIZE - 1) / SECTOR_SIZE;
+        }
+    }
+
+    prints("======================================\n");
+    prints("Filesystem check completed.\n");
+
+    char buf[20];
+    itoa(total_files, buf, 10);
+    prints("Files: "); prints(buf);
+    itoa(inline_files, buf, 10);
+    prints(" ("); prints(buf); prints(" inline)"); newline();
+    itoa(total_dirs, buf, 10);
+    prints("Directories: "); prints(buf); newline();
+    itoa(fs_count, buf, 10);
+    prints("Total objects: "); prints(buf); newline();
+    itoa(fs_node_slots - fs_count, buf, 10);
+    prints("Free slots: "); prints(buf); newline();
+    itoa(used_blocks, buf, 10);
+    prints("Data blocks: "); prints(buf);
+    itoa(shared_blocks, buf, 10);
+    prints(" ("); prints(buf); prints(" shared)"); newline();
+    if (fs_feature_flags & FS_FEATURE_LZ) {
+        itoa(packed_blocks, buf, 10);
+        prints("Compressed blocks: "); prints(buf);
+        itoa(saved_sectors, buf, 10);
+        prints(" ("); prints(buf); prints(" sectors saved)"); newline();
+    }
+    if (fs_snap_start) {
+        int snapshots = 0;
+        for (int i = 0; i < FS_MAX_SNAPSHOTS; i++) {
+            if (fs_snaps[i].serial) snapshots++;
+        }
+        itoa(snapshots, buf, 10);
+        prints("Snapshots: "); prints(buf); newline();
+    }
+    if (fs_crc_start) {
+        if (fs_crc_hw < 0) fs_crc_init();
+        prints("Checksums: CRC32C (");
+        prints(fs_crc_hw ? "hardware" : "software");
+        prints(")\n");
+    }
+
+    if (errors_found > 0) {
+        itoa(errors_found, buf, 10);
+        prints("Errors found: "); prints(buf); newline();
+        if (fs_fsck.repaired) {
+            itoa(fs_fsck.repaired, buf, 10);
+            prints("Repaired: "); prints(buf); newline();
+            errors_found -= fs_fsck.repaired;
+        } else {
+            prints("Run 'fsck -y' to repair filesystem errors.\n");
+        }
+    } else {
+        prints("No errors found.\n");
+    }
+
+    if (warnings_found > 0) {
+        itoa(warnings_found, buf, 10);
+        prints("Warnings: "); prints(buf); newline();
+    }
+
+    prints("Filesystem is ");
+    if (errors_found == 0) {
+        prints("OK");
+    } else {
+        prints("CORRUPTED");
+    }
+    prints(".\n");
+}
+
+// Проверка без исправлений; возвращает число найденных ошибок
+int fs_check_integrity(void) {
+    fs_fsck_full(0);
+    return fs_fsck.errors;
+}
+
+// fsck [-y] [-b]: -y исправляет без вопроса, -b включает фоновую проверку
+void fsck_command(const char* args) {
+    if (args && strcmp(args, "-b") == 0) {
+        fs_fsck_enabled = !fs_fsck_enabled;
+        fs_fsck.background = 0;
+        prints(fs_fsck_enabled ? "Background check enabled\n" : "Background check disabled\n");
+        return;
+    }
+    if (args && strcmp(args, "-y") == 0) {
+        fs_fsck_full(1);
+        return;
+    }
+    if (args && args[0] != '\0') {
+        prints("Usage: fsck [-y] [-b]\n");
+        return;
+    }
+
+    prints("Filesystem Consistency Check\n");
+    prints("============================\n");
+    prints("This utility will check WexFS filesystem for errors\n");
+    prints("and report any inconsistencies.\n\n");
+
+    prints("Continue? (y/N): ");
+
+    char confirm = keyboard_getchar();
+    putchar(confirm);
+    newline();
+
+    if (confirm != 'y' && confirm != 'Y') {
+        prints("Operation cancelled.\n");
+        return;
+    }
+
+    fs_fsck_full(0);
+    if (fs_fsck.errors == 0) return;
+
+    prints("Repair now? (y/N): ");
+    confirm = keyboard_getchar();
+    putchar(confirm);
+    newline();
+    if (confirm == 'y' || confirm == 'Y') fs_fsck_full(1);
+}
+
+void fs_cat(const char* filename) {
+    if (filename == NULL || strlen(filename) == 0) {
+        prints("Usage: cat <filename>\n");
+        return;
+    }
+
+    // Файл может лежать и в WexFS, и на RAM-томе: открываем его общим путём
+    int fd = fs_open(filename, FS_O_READ);
+    if (fd < 0) {
+        FSPath path;
+        int resolved = fs_path_resolve(filename, &path) == 0;
+        int index = resolved ? fs_path_find(&path) : -1;
+        int lower = resolved && index < 0 ? fs_lower_find(&path) : -1;
+        if ((index >= 0 && fs_cache[index].is_dir) || (lower >= 0 && fs_ram_entries[lower].is_dir)) {
+            prints("Error: '");
+            prints(filename);
+            prints("' is a directory\n");
+        } else {
+            prints("Error: File not found: ");
+            prints(filename);
+            newline();
+        }
+        return;
+    }
+
+    // Выводим содержимое прямо из кэша блоков, страница за страницей
+    if (fs_lseek(fd, 0, FS_SEEK_END) > 0) {
+        int view = fs_mmap(fd, FS_MAP_READ);
+        if (view < 0) {
+            fs_close(fd);
+            prints("Error: Cannot map file\n");
+            return;
+        }
+        u32 offset = 0;
+        u32 avail;
+        char* page;
+        while ((page = fs_view_page(view, offset, &avail)) != NULL) {
+            for (u32 i = 0; i < avail; i++) {
+                putchar(page[i]);
+            }
+            offset += avail;
+        }
+        fs_munmap(view);
+        newline();
+    } else {
+        prints("File is empty\n");
+    }
+    fs_close(fd);
+}
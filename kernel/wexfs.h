@@ -0,0 +1,339 @@
+#ifndef WEXFS_H
+#define WEXFS_H
+
+/* WexFS - common filesystem core shared by kernel, installer and recovery */
+
+typedef unsigned long long u64;
+typedef unsigned int u32;
+typedef unsigned short u16;
+typedef unsigned char u8;
+
+#ifndef NULL
+#define NULL ((void*)0)
+#endif
+#define MAX_NAME 256
+#define MAX_PATH 1024
+#define SECTOR_SIZE 512
+#define FS_SECTOR_START 1
+#define MAX_FILES 1024                 /* node slots a volume may have */
+
+/* WexFS 2 on-disk layout, in this order:
+ *   FS_SECTOR_START   superblock (slot map of the node table)
+ *   FS_NODE_START     node table, FS_NODE_SECTORS per slot
+ *   block table       one FSBlockEntry per data block
+ *   hash index        content hash and reference count of every data block
+ *   checksums         CRC32C of every data block and metadata sector
+ *   snapshot table    snapshot entries; manifests live in data blocks
+ *   data              FS_MAX_BLOCKS data blocks
+ * Block size, node slots (FS_MIN_NODES..MAX_FILES) and the optional regions
+ * are chosen at format time (mkfs) and recorded in the superblock; an absent
+ * region has start 0.
+ * Data blocks are reference counted, so several nodes may share one block
+ * until one of them is written (copy-on-write); blocks with equal content
+ * are merged when they are written out. The superblock and node records
+ * carry their own CRC32C. Volumes without a block table store every
+ * block raw. */
+#define FS_MAGIC 0x32465857            /* "WXF2" */
+#define FS_VERSION 2
+#define FS_MIN_BLOCK_SIZE 1024
+#define FS_MAX_BLOCK_SIZE 65536
+#define FS_DEFAULT_BLOCK_SIZE 4096
+#define FS_MIN_NODES 8
+#define FS_DEFAULT_NODES 64
+#define FS_NODE_SECTORS 3
+#define FS_NODE_START (FS_SECTOR_START + 1)
+#define FS_MAX_BLOCKS 1024
+#define FS_NO_BLOCK 0xFFFFFFFF
+#define FS_NO_SLOT 0xFFFFFFFF
+#define FS_NODE_BLOCKS 64                    /* block pointers per node */
+#define FS_MAX_FILE_SIZE (FS_NODE_BLOCKS * fs_block_size)
+#define FS_INLINE_BLOCK 0xFFFFFFFE           /* blocks[0] of a file stored inline */
+#define FS_INLINE_MAX ((FS_NODE_BLOCKS - 1) * 4)
+#define FS_CACHE_BLOCKS 64                   /* most data blocks kept in memory */
+#define FS_CACHE_BYTES (256 * 1024)          /* cache memory, split by block size */
+#define FS_NAME_POOL (MAX_FILES * 32)        /* bytes of interned node names */
+#define FS_NO_NAME 0xFFFF
+#define FS_BTABLE_SECTORS (FS_MAX_BLOCKS * 4 / SECTOR_SIZE)
+#define FS_HASH_SECTORS (FS_MAX_BLOCKS * 16 / SECTOR_SIZE)
+#define FS_CRC_ENTRIES (FS_MAX_BLOCKS + FS_BTABLE_SECTORS + FS_HASH_SECTORS + FS_SNAP_SECTORS)
+#define FS_CRC_SECTORS ((FS_CRC_ENTRIES * 4 + SECTOR_SIZE - 1) / SECTOR_SIZE)
+#define FS_SNAP_SECTORS 1
+
+/* Volume features, chosen at format time */
+#define FS_FEATURE_LZ 1                      /* compress data blocks */
+#define FS_FEATURE_DEDUP 2                   /* hash index, merge equal blocks */
+#define FS_FEATURE_CRC 4                     /* checksum region */
+#define FS_FEATURE_SNAP 8                    /* snapshot table */
+#define FS_FEATURE_DEFAULT (FS_FEATURE_DEDUP | FS_FEATURE_CRC | FS_FEATURE_SNAP)
+
+/* Block table flags */
+#define FS_BLOCK_LZ 1                        /* stored compressed, length bytes */
+
+/* Snapshots */
+#define FS_MAX_SNAPSHOTS 8
+#define FS_SNAP_BLOCKS 6                     /* manifest blocks listed in a snapshot entry */
+
+/* Hash entry flags */
+#define FS_HASH_VALID 1                      /* hash matches the block on disk */
+
+/* File descriptors */
+#define FS_MAX_FDS 16
+#define FS_O_READ   1
+#define FS_O_WRITE  2
+#define FS_O_CREATE 4
+#define FS_O_TRUNC  8
+#define FS_O_APPEND 16
+#define FS_SEEK_SET 0
+#define FS_SEEK_CUR 1
+#define FS_SEEK_END 2
+
+/* File views */
+#define FS_MAX_VIEWS 4
+#define FS_VIEW_PAGES 2                      /* blocks a view keeps pinned */
+#define FS_MAP_READ  1
+#define FS_MAP_WRITE 2
+
+/* The first WexFS 2 volumes had 64 slots and keep their slot map in front
+ * of the later fields; the map of higher slots follows them. */
+#define FS_SB_SLOTS 64
+
+typedef struct {
+    u32 magic;
+    u32 version;
+    u32 node_start;
+    u32 node_slots;
+    u32 node_sectors;
+    u32 data_start;
+    u32 block_count;
+    u32 block_sectors;
+    u32 node_count;
+    u8 slot_map[FS_SB_SLOTS / 8];
+    u32 features;
+    u32 btable_start;        /* 0 on volumes formatted without a block table */
+    u32 hash_start;          /* 0 on volumes formatted without a hash index */
+    u32 crc_start;           /* 0 on volumes formatted without checksums */
+    u32 checksum;            /* CRC32C of this sector with checksum = 0 */
+    u32 snap_start;          /* 0 on volumes formatted without snapshots */
+    u8 slot_map_high[(MAX_FILES - FS_SB_SLOTS) / 8];   /* zero on older volumes */
+} FSSuperblock;
+
+typedef struct {
+    u16 length;
+    u16 flags;
+} FSBlockEntry;
+
+typedef struct {
+    u32 hash_lo;
+    u32 hash_hi;
+    u32 refs;
+    u32 flags;
+} FSHashEntry;
+
+typedef struct {
+    char name[MAX_PATH];
+    u32 is_dir;
+    u32 size;
+    u32 blocks[FS_NODE_BLOCKS];
+    u32 checksum;            /* CRC32C of the record with checksum = 0 */
+} FSDiskNode;
+
+typedef struct {
+    char name[24];
+    u32 serial;              /* 0 marks a free entry */
+    u32 nodes;
+    u32 bytes;               /* file bytes captured */
+    u32 length;              /* manifest bytes */
+    u32 manifest[FS_SNAP_BLOCKS];
+} FSSnapshot;
+
+/* RAM volume: a read-only archive the boot loader puts into memory (a
+ * multiboot module), used in place without copying. Layout: FSRamHeader,
+ * then count FSRamEntry sorted by path (strcmp), then the NUL-terminated
+ * paths and the file data. Offsets count from the start of the archive and
+ * paths have the canonical form of node names ("SystemRoot/config"). */
+#define FS_RAM_MAGIC 0x44525857        /* "WXRD" */
+#define FS_RAM_VERSION 1
+
+typedef struct {
+    u32 magic;
+    u32 version;
+    u32 count;
+    u32 length;              /* bytes of the whole archive */
+} FSRamHeader;
+
+typedef struct {
+    u32 path;                /* offset of the path */
+    u32 data;                /* offset of the data, 0 for directories */
+    u32 size;
+    u32 is_dir;
+} FSRamEntry;
+
+typedef char fs_snap_table_fits[(sizeof(FSSnapshot) * FS_MAX_SNAPSHOTS <= FS_SNAP_SECTORS * SECTOR_SIZE) ? 1 : -1];
+
+typedef char fs_superblock_fits[(sizeof(FSSuperblock) <= SECTOR_SIZE) ? 1 : -1];
+
+/* A node record must fit into its slot of the node table */
+typedef char fs_disk_node_fits[(sizeof(FSDiskNode) <= FS_NODE_SECTORS * SECTOR_SIZE) ? 1 : -1];
+
+/* In memory a node keeps the slot of its parent directory and one path
+ * component interned in the name pool; a node without a parent (the root,
+ * or an entry whose directory is missing) keeps its whole path instead.
+ * Full paths are put together only where they are printed or written. */
+typedef struct {
+    u16 name;                     /* name pool id */
+    u16 is_dir;
+    u32 size;
+    u32 slot;                     /* node table slot on disk */
+    u32 parent;                   /* slot of the parent directory or FS_NO_SLOT */
+    u32 tree_size;                /* directories: bytes of all files below */
+    u32 tree_files;               /* directories: number of files below */
+} FSNode;
+
+/* Canonical path: "/" for the root, "a/b" below it (the form of node names),
+ * kept with its length */
+typedef struct {
+    u32 len;
+    char text[MAX_PATH];
+} FSPath;
+
+/* Block maps live apart from the nodes, indexed by slot, so that scans of
+ * the node table touch only names, sizes and totals. A map holds data block
+ * indices or FS_NO_BLOCK. Files up to FS_INLINE_MAX bytes keep their data in
+ * blocks[1..] of the map and use no data blocks; they move to blocks once
+ * they grow. */
+#define FS_NODE_MAP(node) (fs_node_maps[(node)->slot])
+#define FS_MAP_INLINE(blocks) ((blocks)[0] == FS_INLINE_BLOCK)
+#define FS_NODE_INLINE(node) FS_MAP_INLINE(FS_NODE_MAP(node))
+
+extern FSNode fs_cache[MAX_FILES];
+extern u32 fs_node_maps[MAX_FILES][FS_NODE_BLOCKS];
+extern int fs_count;
+extern char current_dir[MAX_PATH];
+extern int fs_dirty;
+extern u16 fs_block_refs[FS_MAX_BLOCKS];
+extern u32 fs_block_size;
+
+/* A host build (WEXFS_HOST) links the core into a libc program; the
+ * primitives below get their own names there so they do not clash with libc. */
+#ifdef WEXFS_HOST
+#define memcpy  wexfs_memcpy
+#define memset  wexfs_memset
+#define strcmp  wexfs_strcmp
+#define strlen  wexfs_strlen
+#define strcpy  wexfs_strcpy
+#define strchr  wexfs_strchr
+#define strstr  wexfs_strstr
+#define strcat  wexfs_strcat
+#define strrchr wexfs_strrchr
+#define itoa    wexfs_itoa
+#define putchar wexfs_putchar
+u32 host_clock_ms(void);
+#endif
+
+/* Provided by every image that links the core */
+void memcpy(void* dst, void* src, int len);
+void memset(void* ptr, int value, int num);
+int strcmp(const char* a, const char* b);
+int strlen(const char* s);
+void strcpy(char* dst, const char* src);
+char* strchr(const char* s, int c);
+char* strstr(const char* haystack, const char* needle);
+char* strcat(char* dest, const char* src);
+char* strrchr(const char* s, int c);
+void itoa(int value, char* str, int base);
+void putchar(char ch);
+void prints(const char* s);
+void newline();
+char keyboard_getchar();
+void ata_read_sector(u32 lba, u8* buffer);
+void ata_write_sector(u32 lba, u8* buffer);
+
+/* Storage layer */
+void fs_load_from_disk();
+void fs_save_to_disk();
+void fs_mark_dirty();
+void fs_begin(void);
+int fs_commit(void);
+void fs_init();
+void fs_reset(u32 features);
+int fs_mkfs(u32 block_size, u32 node_slots, u32 features);
+u32 fs_volume_sectors(void);
+u32 fs_tsc_per_ms(void);        // TSC в единицах по 1024 такта за 1 мс
+FSNode* fs_node_create(const char* path, int is_dir);
+void fs_node_remove(int index);
+const char* fs_node_name(const FSNode* node);
+u32 fs_node_path(const FSNode* node, char* buf);
+int fs_node_under(const FSNode* node, const FSNode* dir);
+int fs_node_rename(FSNode* node, const char* path);
+int fs_write_content(FSNode* node, const char* data, u32 len);
+void fs_reflink(FSNode* dst, FSNode* src);
+int fs_node_pread(FSNode* node, void* buf, u32 len, u32 offset);
+int fs_node_pwrite(FSNode* node, const void* buf, u32 len, u32 offset);
+int fs_node_truncate(FSNode* node, u32 size);
+
+/* Overlay: the RAM volume is a read-only lower layer under WexFS, which
+ * wins where both have a path. Writing to a lower file copies it up into
+ * WexFS. Removing a lower path leaves an empty whiteout file ".wh.<name>"
+ * next to it in WexFS; a directory made again over a removed one
+ * gets FS_OPAQUE and hides everything the lower layer has below it.
+ * fs_unlink returns -1 if nothing has the path, -2 if no whiteout fits. */
+#define FS_WHITEOUT ".wh."
+#define FS_OPAQUE   ".wh..wh..opq"
+int fs_ram_mount(const void* archive, u32 length);
+int fs_unlink(const char* name);
+int fs_path_type(const FSPath* path);
+int fs_tree_next(const FSPath* dir, u32* pos, char* path, int* is_dir);
+
+/* Snapshots: the node table is captured, data blocks are shared */
+int fs_snapshot_create(const char* name);
+int fs_snapshot_delete(const char* name);
+int fs_snapshot_rollback(const char* name);
+
+/* Paths: "." and ".." are resolved, repeated '/' collapse, names without a
+ * leading '/' are relative to current_dir */
+int fs_path_resolve(const char* name, FSPath* path);
+int fs_path_next(const FSPath* path, u32* pos, const char** part, u32* part_len);
+int fs_path_find(const FSPath* path);
+
+/* Byte-range file API; files are read and written through the block cache */
+int fs_open(const char* name, int flags);
+int fs_close(int fd);
+int fs_read(int fd, void* buf, u32 len);
+int fs_write(int fd, const void* buf, u32 len);
+int fs_pread(int fd, void* buf, u32 len, u32 offset);
+int fs_pwrite(int fd, const void* buf, u32 len, u32 offset);
+int fs_lseek(int fd, int offset, int whence);
+int fs_truncate(int fd, u32 size);
+
+/* File views (mmap-style): a page is one block of the file, faulted into
+ * the block cache on first touch and pinned there while the view holds it.
+ * A page pointer stays valid until the view drops that page: on a fault
+ * past FS_VIEW_PAGES, on fs_msync and on fs_munmap. Views do not change
+ * the file size; written pages reach the disk on fs_msync or fs_munmap. */
+int fs_mmap(int fd, int prot);
+char* fs_view_page(int view, u32 offset, u32* avail);
+int fs_msync(int view);
+int fs_munmap(int view);
+
+/* Shell-level filesystem commands */
+void fs_ls();
+void fs_mkdir(const char* name);
+void fs_touch(const char* name);
+void fs_cd(const char* name);
+FSNode* fs_find_file(const char* name);
+void fs_copy(const char* src_name, const char* dest_name);
+int folder_size(const char* folder_path);
+void fs_size(const char* name);
+void du_command(const char* path);
+void find_command(const char* pattern);
+void snapshot_command(const char* args);
+void defrag_command(const char* args);
+void mkfs_command(const char* args);
+void migrate_command(const char* args);
+void fs_defrag_tick(void);
+int fs_check_integrity(void);
+void fsck_command(const char* args);
+void fs_fsck_tick(void);
+void fs_cat(const char* filename);
+
+#endif
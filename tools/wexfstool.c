@@ -0,0 +1,619 @@
+/* wexfstool - create, inspect, populate, check and benchmark WexFS images,
+ * and pack RAM volume archives for the boot loader
+ * Runs on the build host and links the same kernel/wexfs.c as the kernel,
+ * built with WEXFS_HOST. An image is a raw disk: sector 0 belongs to the
+ * boot loader and the volume starts at FS_SECTOR_START. The image file is
+ * mapped into memory, so sector I/O is a plain copy. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "wexfs.h"
+
+#define BENCH_ROUNDS 16
+#define BENCH_SMALL_FILES 32
+
+static u8* image = NULL;
+static u32 image_sectors = 0;
+static int image_fd = -1;
+static int image_errors = 0;
+static int quiet = 0;                        // подавляет вывод ядра ФС
+
+/* Image primitives */
+void memcpy(void* dst, void* src, int len) { __builtin_memcpy(dst, src, len); }
+void memset(void* ptr, int value, int num) { __builtin_memset(ptr, value, num); }
+int strcmp(const char* a, const char* b) { return __builtin_strcmp(a, b); }
+int strlen(const char* s) { return (int)__builtin_strlen(s); }
+void strcpy(char* dst, const char* src) { __builtin_strcpy(dst, src); }
+char* strchr(const char* s, int c) { return __builtin_strchr(s, c); }
+char* strstr(const char* haystack, const char* needle) { return __builtin_strstr(haystack, needle); }
+char* strcat(char* dest, const char* src) { return __builtin_strcat(dest, src); }
+char* strrchr(const char* s, int c) { return __builtin_strrchr(s, c); }
+void putchar(char ch) { if (!quiet) fputc(ch, stdout); }
+void prints(const char* s) { if (!quiet) fputs(s, stdout); }
+void newline() { if (!quiet) fputc('\n', stdout); }
+
+void itoa(int value, char* str, int base) {
+    char tmp[34];
+    int i = 0;
+    int negative = value < 0 && base == 10;
+    unsigned int u = negative ? -(unsigned int)value : (unsigned int)value;
+
+    do {
+        tmp[i++] = "0123456789abcdef"[u % base];
+        u /= base;
+    } while (u);
+    if (negative) tmp[i++] = '-';
+    while (i) *str++ = tmp[--i];
+    *str = '\0';
+}
+
+char keyboard_getchar() {
+    int ch = getchar();
+    return ch == EOF ? 'n' : (char)ch;
+}
+
+void ata_read_sector(u32 lba, u8* buffer) {
+    if (lba >= image_sectors) {
+        __builtin_memset(buffer, 0, SECTOR_SIZE);
+        image_errors++;
+        return;
+    }
+    __builtin_memcpy(buffer, image + (size_t)lba * SECTOR_SIZE, SECTOR_SIZE);
+}
+
+void ata_write_sector(u32 lba, u8* buffer) {
+    if (lba >= image_sectors) {
+        image_errors++;
+        return;
+    }
+    __builtin_memcpy(image + (size_t)lba * SECTOR_SIZE, buffer, SECTOR_SIZE);
+}
+
+u32 host_clock_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u32)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+static double seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Image file */
+// Отображает файл образа; sectors = 0 оставляет прежний размер
+static int image_open(const char* path, u32 sectors, int create) {
+    struct stat st;
+
+    image_fd = open(path, create ? (O_RDWR | O_CREAT | O_TRUNC) : O_RDWR, 0644);
+    if (image_fd < 0) {
+        fprintf(stderr, "Error: Cannot open image %s\n", path);
+        return -1;
+    }
+    if (sectors && ftruncate(image_fd, (off_t)sectors * SECTOR_SIZE) != 0) {
+        fprintf(stderr, "Error: Cannot resize image %s\n", path);
+        return -1;
+    }
+    fstat(image_fd, &st);
+    image_sectors = (u32)(st.st_size / SECTOR_SIZE);
+    if (image_sectors <= FS_SECTOR_START) {
+        fprintf(stderr, "Error: Image %s is empty\n", path);
+        return -1;
+    }
+    image = mmap(NULL, (size_t)image_sectors * SECTOR_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, image_fd, 0);
+    if (image == MAP_FAILED) {
+        fprintf(stderr, "Error: Cannot map image %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+static int image_close(void) {
+    msync(image, (size_t)image_sectors * SECTOR_SIZE, MS_SYNC);
+    munmap(image, (size_t)image_sectors * SECTOR_SIZE);
+    close(image_fd);
+    if (image_errors) {
+        fprintf(stderr, "Error: %d sector(s) outside the image\n", image_errors);
+        return 1;
+    }
+    return 0;
+}
+
+// Монтирует существующий образ; тома WexFS 1.0 инструмент не переносит
+static int image_mount(const char* path) {
+    if (image_open(path, 0, 0) != 0) return -1;
+
+    FSSuperblock* sb = (FSSuperblock*)(image + FS_SECTOR_START * SECTOR_SIZE);
+    if (sb->magic != FS_MAGIC || sb->version != FS_VERSION) {
+        fprintf(stderr, "Error: %s is not a WexFS %d image\n", path, FS_VERSION);
+        return -1;
+    }
+    fs_init();
+    return 0;
+}
+
+/* Parameters */
+static int parse_features(const char* s, u32* features) {
+    static const char* names[] = { "lz", "dedup", "crc", "snap" };
+    u32 mask = 0;
+
+    while (*s) {
+        size_t len = strcspn(s, ",");
+        int found = len == 4 && strncmp(s, "none", 4) == 0;
+        for (int i = 0; i < 4; i++) {
+            if (len == (size_t)strlen(names[i]) && strncmp(s, names[i], len) == 0) {
+                mask |= 1u << i;
+                found = 1;
+            }
+        }
+        if (!found) return -1;
+        s += len;
+        if (*s == ',') s++;
+    }
+    *features = mask;
+    return 0;
+}
+
+// Общие ключи mkfs и bench: -b <KB> -n <nodes> -f <features> -s <MB>
+static int parse_format(int argc, char** argv, u32* block_size, u32* nodes, u32* features, u32* disk_mb) {
+    *block_size = FS_DEFAULT_BLOCK_SIZE;
+    *nodes = FS_DEFAULT_NODES;
+    *features = FS_FEATURE_DEFAULT;
+    *disk_mb = 0;
+
+    for (int i = 0; i < argc; i++) {
+        if (i + 1 >= argc || argv[i][0] != '-' || argv[i][2] != '\0') return -1;
+        const char* value = argv[++i];
+        switch (argv[i - 1][1]) {
+        case 'b': *block_size = (u32)atoi(value) * 1024; break;
+        case 'n': *nodes = (u32)atoi(value); break;
+        case 's': *disk_mb = (u32)atoi(value); break;
+        case 'f':
+            if (parse_features(value, features) != 0) return -1;
+            break;
+        default:
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Tree helpers */
+static int node_index(const char* path) {
+    FSPath canonical;
+    canonical.len = strlen(path);
+    if (canonical.len >= MAX_PATH) return -1;
+    strcpy(canonical.text, path);
+    return fs_path_find(&canonical);
+}
+
+// Путь образа без ведущего '/', как в таблице узлов
+static const char* image_path(const char* path) {
+    if (*path == ':') path++;
+    while (*path == '/' && path[1] != '\0') path++;
+    return path;
+}
+
+// Создаёт каталог со всеми недостающими родителями
+static int make_dirs(const char* path) {
+    char prefix[MAX_PATH];
+    size_t len = strlen(path);
+
+    if (len >= MAX_PATH) return -1;
+    for (size_t i = 1; i <= len; i++) {
+        if (path[i] != '/' && path[i] != '\0') continue;
+        __builtin_memcpy(prefix, path, i);
+        prefix[i] = '\0';
+        int index = node_index(prefix);
+        if (index >= 0) {
+            if (!fs_cache[index].is_dir) return -1;
+            continue;
+        }
+        if (!fs_node_create(prefix, 1)) return -1;
+    }
+    return 0;
+}
+
+static int put_file(const char* host, const char* path) {
+    FILE* in = fopen(host, "rb");
+    if (!in) {
+        fprintf(stderr, "Error: Cannot read %s\n", host);
+        return -1;
+    }
+    fseek(in, 0, SEEK_END);
+    long size = ftell(in);
+    fseek(in, 0, SEEK_SET);
+    if (size > (long)FS_MAX_FILE_SIZE) {
+        fprintf(stderr, "Error: %s is larger than %u bytes\n", host, (u32)FS_MAX_FILE_SIZE);
+        fclose(in);
+        return -1;
+    }
+
+    char* data = malloc(size ? size : 1);
+    size_t got = fread(data, 1, size, in);
+    fclose(in);
+
+    const char* slash = strrchr(path, '/');
+    if (slash) {
+        char parent[MAX_PATH];
+        __builtin_memcpy(parent, path, slash - path);
+        parent[slash - path] = '\0';
+        if (make_dirs(parent) != 0) {
+            fprintf(stderr, "Error: Cannot create directory for %s\n", path);
+            free(data);
+            return -1;
+        }
+    }
+
+    int fd = fs_open(path, FS_O_WRITE | FS_O_CREATE | FS_O_TRUNC);
+    int written = fd < 0 ? -1 : fs_write(fd, data, (u32)got);
+    if (fd >= 0) fs_close(fd);
+    free(data);
+    if (written != (int)got) {
+        fprintf(stderr, "Error: Cannot write %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+// Каталог хоста копируется целиком, с подкаталогами
+static int put_tree(const char* host, const char* path) {
+    struct stat st;
+
+    if (stat(host, &st) != 0) {
+        fprintf(stderr, "Error: Cannot read %s\n", host);
+        return -1;
+    }
+    if (!S_ISDIR(st.st_mode)) return put_file(host, path);
+
+    if (strcmp(path, "/") != 0 && make_dirs(path) != 0) {
+        fprintf(stderr, "Error: Cannot create directory %s\n", path);
+        return -1;
+    }
+    DIR* dir = opendir(host);
+    if (!dir) return -1;
+
+    int result = 0;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') continue;
+        char host_child[4096], child[MAX_PATH];
+        snprintf(host_child, sizeof(host_child), "%s/%s", host, entry->d_name);
+        if (strcmp(path, "/") == 0) snprintf(child, sizeof(child), "%s", entry->d_name);
+        else snprintf(child, sizeof(child), "%s/%s", path, entry->d_name);
+        if (put_tree(host_child, child) != 0) result = -1;
+    }
+    closedir(dir);
+    return result;
+}
+
+static int get_file(const char* path, const char* host) {
+    char chunk[65536];
+    int fd = fs_open(path, FS_O_READ);
+
+    if (fd < 0) {
+        fprintf(stderr, "Error: File not found: %s\n", path);
+        return -1;
+    }
+    FILE* out = fopen(host, "wb");
+    if (!out) {
+        fprintf(stderr, "Error: Cannot write %s\n", host);
+        fs_close(fd);
+        return -1;
+    }
+    int n;
+    while ((n = fs_read(fd, chunk, sizeof(chunk))) > 0) fwrite(chunk, 1, n, out);
+    fclose(out);
+    fs_close(fd);
+    return 0;
+}
+
+/* RAM volume archive */
+typedef struct {
+    char path[MAX_PATH];
+    char host[4096];
+    u32 size;
+    int is_dir;
+} PackItem;
+
+static PackItem* pack_items = NULL;
+static int pack_count = 0;
+
+// Собирает записи архива: каталог хоста со всеми подкаталогами
+static int pack_collect(const char* host, const char* path) {
+    struct stat st;
+
+    if (stat(host, &st) != 0) {
+        fprintf(stderr, "Error: Cannot read %s\n", host);
+        return -1;
+    }
+    if (path[0] != '\0') {
+        pack_items = realloc(pack_items, (pack_count + 1) * sizeof(PackItem));
+        PackItem* item = &pack_items[pack_count++];
+        snprintf(item->path, sizeof(item->path), "%s", path);
+        snprintf(item->host, sizeof(item->host), "%s", host);
+        item->is_dir = S_ISDIR(st.st_mode);
+        item->size = item->is_dir ? 0 : (u32)st.st_size;
+    }
+    if (!S_ISDIR(st.st_mode)) return 0;
+
+    DIR* dir = opendir(host);
+    if (!dir) return -1;
+    int result = 0;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') continue;
+        char host_child[4096], child[MAX_PATH];
+        snprintf(host_child, sizeof(host_child), "%s/%s", host, entry->d_name);
+        if (path[0] == '\0') snprintf(child, sizeof(child), "%s", entry->d_name);
+        else snprintf(child, sizeof(child), "%s/%s", path, entry->d_name);
+        if (pack_collect(host_child, child) != 0) result = -1;
+    }
+    closedir(dir);
+    return result;
+}
+
+static int by_pack_path(const void* a, const void* b) {
+    return strcmp(((const PackItem*)a)->path, ((const PackItem*)b)->path);
+}
+
+static int by_name(const void* a, const void* b) {
+    char path_a[MAX_PATH], path_b[MAX_PATH];
+    fs_node_path(&fs_cache[*(const int*)a], path_a);
+    fs_node_path(&fs_cache[*(const int*)b], path_b);
+    return strcmp(path_a, path_b);
+}
+
+/* Commands */
+static int cmd_mkfs(const char* path, int argc, char** argv) {
+    u32 block_size, nodes, features, disk_mb;
+
+    if (parse_format(argc, argv, &block_size, &nodes, &features, &disk_mb) != 0) return 2;
+    if (fs_mkfs(block_size, nodes, features) != 0) {
+        fprintf(stderr, "Error: Invalid format parameters\n");
+        return 1;
+    }
+    u32 sectors = fs_volume_sectors();
+    if (disk_mb * 2048 > sectors) sectors = disk_mb * 2048;
+    if (image_open(path, sectors, 1) != 0) return 1;
+    fs_save_to_disk();
+    printf("%s: %u KB blocks, %u nodes, %u MB\n", path, block_size / 1024, nodes, sectors / 2048);
+    return image_close();
+}
+
+static int cmd_ls(const char* path) {
+    int order[MAX_FILES];
+
+    if (image_mount(path) != 0) return 1;
+    for (int i = 0; i < fs_count; i++) order[i] = i;
+    qsort(order, fs_count, sizeof(int), by_name);
+    for (int i = 0; i < fs_count; i++) {
+        FSNode* node = &fs_cache[order[i]];
+        char name[MAX_PATH];
+        fs_node_path(node, name);
+        printf("%c %10u  %s%s\n", node->is_dir ? 'd' : '-', node->is_dir ? node->tree_size : node->size,
+               name[0] == '/' ? "" : "/", name);
+    }
+    return image_close();
+}
+
+static int cmd_mkdir(const char* path, const char* dir) {
+    if (image_mount(path) != 0) return 1;
+    int result = make_dirs(image_path(dir));
+    if (result != 0) fprintf(stderr, "Error: Cannot create directory %s\n", dir);
+    fs_save_to_disk();
+    return image_close() || result != 0;
+}
+
+// Пути внутри образа начинаются с ':', остальные относятся к хосту
+static int cmd_cp(const char* path, const char* src, const char* dst) {
+    if ((src[0] == ':') == (dst[0] == ':')) {
+        fprintf(stderr, "Error: Exactly one of the paths must start with ':'\n");
+        return 2;
+    }
+    if (image_mount(path) != 0) return 1;
+    int result = dst[0] == ':' ? put_tree(src, image_path(dst)) : get_file(image_path(src), dst);
+    fs_save_to_disk();
+    return image_close() || result != 0;
+}
+
+static int cmd_fsck(const char* path, int repair) {
+    if (image_mount(path) != 0) return 1;
+    int errors = 0;
+    if (repair) {
+        fsck_command("-y");
+        fs_save_to_disk();
+    } else {
+        errors = fs_check_integrity();
+    }
+    return image_close() || errors != 0;
+}
+
+// Архив RAM-тома: заголовок, записи по порядку путей, пути, данные файлов
+static int cmd_pack(const char* archive, const char* host, const char* dst) {
+    const char* root = dst ? image_path(dst) : "";
+    if (strcmp(root, "/") == 0) root = "";
+    if (pack_collect(host, root) != 0) return 1;
+    qsort(pack_items, pack_count, sizeof(PackItem), by_pack_path);
+
+    u32 length = sizeof(FSRamHeader) + pack_count * sizeof(FSRamEntry);
+    for (int i = 0; i < pack_count; i++) length += strlen(pack_items[i].path) + 1 + pack_items[i].size;
+
+    u8* out = calloc(1, length);
+    FSRamHeader* header = (FSRamHeader*)out;
+    FSRamEntry* entries = (FSRamEntry*)(out + sizeof(FSRamHeader));
+    header->magic = FS_RAM_MAGIC;
+    header->version = FS_RAM_VERSION;
+    header->count = pack_count;
+    header->length = length;
+
+    u32 pos = sizeof(FSRamHeader) + pack_count * sizeof(FSRamEntry);
+    for (int i = 0; i < pack_count; i++) {
+        entries[i].path = pos;
+        __builtin_strcpy((char*)out + pos, pack_items[i].path);
+        pos += strlen(pack_items[i].path) + 1;
+    }
+    int result = 0;
+    for (int i = 0; i < pack_count; i++) {
+        entries[i].is_dir = pack_items[i].is_dir;
+        entries[i].size = pack_items[i].size;
+        entries[i].data = pack_items[i].is_dir ? 0 : pos;
+        if (pack_items[i].is_dir) continue;
+        FILE* in = fopen(pack_items[i].host, "rb");
+        if (!in || fread(out + pos, 1, pack_items[i].size, in) != pack_items[i].size) {
+            fprintf(stderr, "Error: Cannot read %s\n", pack_items[i].host);
+            result = 1;
+        }
+        if (in) fclose(in);
+        pos += pack_items[i].size;
+    }
+
+    // Архив проверяется тем же кодом, что и при загрузке
+    if (result == 0 && fs_ram_mount(out, length) != pack_count) {
+        fprintf(stderr, "Error: Archive does not mount; are two paths equal?\n");
+        result = 1;
+    }
+    FILE* file = result == 0 ? fopen(archive, "wb") : NULL;
+    if (result == 0 && (!file || fwrite(out, 1, length, file) != length)) {
+        fprintf(stderr, "Error: Cannot write %s\n", archive);
+        result = 1;
+    }
+    if (file) fclose(file);
+    if (result == 0) printf("%s: %d entries, %u bytes\n", archive, pack_count, length);
+    free(out);
+    free(pack_items);
+    return result;
+}
+
+// Замер на образе в памяти: запись и чтение больших файлов, создание мелких
+static int cmd_bench(int argc, char** argv) {
+    u32 block_size, nodes, features, disk_mb;
+
+    if (parse_format(argc, argv, &block_size, &nodes, &features, &disk_mb) != 0) return 2;
+    if (fs_mkfs(block_size, nodes, features) != 0) {
+        fprintf(stderr, "Error: Invalid format parameters\n");
+        return 1;
+    }
+    image_sectors = fs_volume_sectors();
+    image = mmap(NULL, (size_t)image_sectors * SECTOR_SIZE, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (image == MAP_FAILED) return 1;
+    quiet = 1;
+    fs_save_to_disk();
+
+    // Три четверти блоков тома заняты файлами наибольшего размера
+    u32 file_size = FS_MAX_FILE_SIZE;
+    int files = (int)(FS_MAX_BLOCKS * 3 / 4 / FS_NODE_BLOCKS);
+    if (files > (int)nodes - BENCH_SMALL_FILES / 2 - 1) files = (int)nodes - BENCH_SMALL_FILES / 2 - 1;
+    char* data = malloc(file_size);
+    char* check = malloc(file_size);
+    u32 seed = 12345;
+    for (u32 i = 0; i < file_size; i++) {
+        seed = seed * 1103515245 + 12345;
+        data[i] = (char)(seed >> 16);
+    }
+
+    double write_time = 0, read_time = 0;
+    double bytes = 0;
+    for (int round = 0; round < BENCH_ROUNDS; round++) {
+        double start = seconds();
+        for (int f = 0; f < files; f++) {
+            char name[16];
+            snprintf(name, sizeof(name), "bench%d", f);
+            data[0] = (char)(round + f);
+            int fd = fs_open(name, FS_O_WRITE | FS_O_CREATE | FS_O_TRUNC);
+            fs_write(fd, data, file_size);
+            fs_close(fd);
+        }
+        write_time += seconds() - start;
+
+        // Чтение после перемонтирования идёт мимо кэша блоков
+        start = seconds();
+        fs_init();
+        for (int f = 0; f < files; f++) {
+            char name[16];
+            snprintf(name, sizeof(name), "bench%d", f);
+            int fd = fs_open(name, FS_O_READ);
+            int n = fs_read(fd, check, file_size);
+            fs_close(fd);
+            data[0] = (char)(round + f);
+            if (n != (int)file_size || __builtin_memcmp(data, check, file_size) != 0) {
+                fprintf(stderr, "Error: Data mismatch in %s\n", name);
+                return 1;
+            }
+        }
+        read_time += seconds() - start;
+        bytes += (double)files * file_size;
+    }
+
+    double start = seconds();
+    int ops = 0;
+    for (int round = 0; round < BENCH_ROUNDS; round++) {
+        for (int f = 0; f < BENCH_SMALL_FILES / 2; f++) {
+            char name[16];
+            snprintf(name, sizeof(name), "small%d", f);
+            int fd = fs_open(name, FS_O_WRITE | FS_O_CREATE);
+            fs_write(fd, name, strlen(name));
+            fs_close(fd);
+            ops++;
+        }
+        for (int f = 0; f < BENCH_SMALL_FILES / 2; f++) {
+            char name[16];
+            snprintf(name, sizeof(name), "small%d", f);
+            fs_node_remove(node_index(name));
+            ops++;
+        }
+        fs_save_to_disk();
+    }
+    double meta_time = seconds() - start;
+
+    printf("Block size %u KB, %d files of %u KB, %d rounds\n", block_size / 1024, files, file_size / 1024, BENCH_ROUNDS);
+    printf("Write:    %8.1f MB/s\n", bytes / write_time / 1048576);
+    printf("Read:     %8.1f MB/s\n", bytes / read_time / 1048576);
+    printf("Metadata: %8.0f ops/s\n", ops / meta_time);
+    free(data);
+    free(check);
+    munmap(image, (size_t)image_sectors * SECTOR_SIZE);
+    return 0;
+}
+
+static int usage(void) {
+    fprintf(stderr,
+            "Usage: wexfstool mkfs <image> [-b KB] [-n nodes] [-f lz,dedup,crc,snap|none] [-s MB]\n"
+            "       wexfstool ls <image>\n"
+            "       wexfstool mkdir <image> <path>\n"
+            "       wexfstool cp <image> <host-path> :<path>\n"
+            "       wexfstool cp <image> :<path> <host-path>\n"
+            "       wexfstool fsck <image> [-y]\n"
+            "       wexfstool pack <archive> <host-dir> [:<path>]\n"
+            "       wexfstool bench [-b KB] [-n nodes] [-f features]\n");
+    return 2;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) return usage();
+    const char* cmd = argv[1];
+
+    if (strcmp(cmd, "bench") == 0) return cmd_bench(argc - 2, argv + 2);
+    if (argc < 3) return usage();
+    const char* path = argv[2];
+
+    if (strcmp(cmd, "mkfs") == 0) return cmd_mkfs(path, argc - 3, argv + 3);
+    if (strcmp(cmd, "ls") == 0 && argc == 3) return cmd_ls(path);
+    if (strcmp(cmd, "mkdir") == 0 && argc == 4) return cmd_mkdir(path, argv[3]);
+    if (strcmp(cmd, "cp") == 0 && argc == 5) return cmd_cp(path, argv[3], argv[4]);
+    if (strcmp(cmd, "fsck") == 0 && argc == 3) return cmd_fsck(path, 0);
+    if (strcmp(cmd, "fsck") == 0 && argc == 4 && strcmp(argv[3], "-y") == 0) return cmd_fsck(path, 1);
+    if (strcmp(cmd, "pack") == 0 && argc == 4) return cmd_pack(path, argv[3], NULL);
+    if (strcmp(cmd, "pack") == 0 && argc == 5 && argv[4][0] == ':') return cmd_pack(path, argv[3], argv[4]);
+    return usage();
+}